@@ -11,7 +11,7 @@ def client():
         s = socket.socket()
         s.connect((host, port))
         message = input('-> ')
-        s.send(str(message).encode('utf-8'))
+        s.send((str(message) + '\n').encode('utf-8'))
         data = s.recv(1024).decode('utf-8')
         print('Received from server: ' + data)
         s.close()
@@ -1,6 +1,8 @@
 """Mininet-WiFi: A simple networking testbed for Wireless OpenFlow/SDWN!
    author: Ramon Fontes (ramonrf@dca.fee.unicamp.br)"""
 
+import numpy as np
+
 
 class AssociationControl(object):
     "Mechanisms that optimize the use of the APs"
@@ -43,3 +45,50 @@ def ssf(self, intf, ap_intf):
             intf.disconnect_pexec(ap_intf)
             self.changeAP = True
         return self.changeAP
+
+
+class AssociationEngine(object):
+    """LLF/SSF decisions for all stations at once
+
+    rssi: (stations, aps) matrix, nan where the ap is out of range
+    current: ap index of each station, -1 when not associated
+    load: associated stations per ap
+    cap: admission cap per ap (inf for none)
+    returns the new ap index of each station; only the entries that
+    differ from current are reassociations"""
+
+    hysteresis = {'ssf': 0.1, 'llf': 2}
+
+    @classmethod
+    def decide(cls, ac, rssi, current, load, cap):
+        n = len(current)
+        rows = np.arange(n)
+        associated = current >= 0
+        in_range = ~np.isnan(rssi)
+        cur = np.where(associated, current, 0)
+        if ac == 'ssf':
+            score = np.where(in_range, rssi, -np.inf)
+        elif ac == 'llf':
+            score = np.where(in_range, -load[np.newaxis, :].astype(float),
+                             -np.inf)
+        else:
+            return current.copy()
+        best = np.argmax(score, axis=1)
+        gain = score[rows, best] - score[rows, cur]
+        move = associated & (best != cur) & (gain > cls.hysteresis[ac])
+        # admit the largest gains first while the target ap has room
+        order = np.flatnonzero(move)
+        order = order[np.argsort(-gain[order], kind='stable')]
+        target = best[order]
+        by_target = np.argsort(target, kind='stable')
+        sorted_target = target[by_target]
+        first = np.searchsorted(sorted_target, sorted_target, side='left')
+        rank = np.empty(len(order), dtype=np.intp)
+        rank[by_target] = np.arange(len(order)) - first
+        if ac == 'llf':
+            # do not let every station flock to the same idle ap at once
+            cap = np.minimum(cap, np.ceil(load.mean()))
+        admitted = order[rank < (cap - load)[target]]
+        decision = current.copy()
+        decision[admitted] = best[admitted]
+        return decision
@@ -0,0 +1,102 @@
+"""
+    Packet capture on many nodes through one mncap process (see mncap.c):
+    TPACKET_V3 rings opened in each node's namespace, merged into a
+    single time-ordered pcapng file with one interface ID per captured
+    interface. tcpdump, when installed, only compiles the filter.
+"""
+
+import os
+import re
+import signal
+from subprocess import Popen, PIPE, check_output, CalledProcessError
+from tempfile import mkstemp
+
+from mininet.log import info, error
+
+# tcpdump -y names of the pcap link types mncap reports
+DLT = {1: 'EN10MB', 127: 'IEEE802_11_RADIOTAP'}
+
+
+class Capture(object):
+
+    def __init__(self, filename, intfs, filter=None, snaplen=65535,
+                 block_kb=256, blocks=16):
+        """filename: pcapng output
+           intfs: wireless interfaces, or mncap targets '[pid:]intf'
+                  (a bare name such as 'hwsim0' is in the root namespace)
+           filter: tcpdump filter expression
+           snaplen: bytes kept per packet
+           block_kb, blocks: ring size per interface"""
+        self.filename = filename
+        self.names = [intf if isinstance(intf, str) else intf.name
+                      for intf in intfs]
+        self.targets = [self.target(intf) for intf in intfs]
+        self.filter = filter
+        self.args = ['-s', str(snaplen), '-b', str(block_kb),
+                     '-n', str(blocks)]
+        self.files = []
+        self.proc = None
+        self.stats = {}
+
+    @staticmethod
+    def target(intf):
+        if isinstance(intf, str):
+            return intf
+        node = intf.node
+        if getattr(node, 'inNamespace', False) and node.pid:
+            return '%d:%s' % (node.pid, intf.name)
+        return intf.name
+
+    def compile(self):
+        "tcpdump -ddd programs for the link types of the interfaces"
+        args = []
+        for linktype, dlt in DLT.items():
+            fd, path = mkstemp(prefix='mncap', suffix='.bpf')
+            try:
+                prog = check_output(['tcpdump', '-ddd', '-y', dlt,
+                                     self.filter])
+            except (OSError, CalledProcessError) as e:
+                os.close(fd)
+                os.remove(path)
+                raise Exception('could not compile the capture filter "%s" '
+                                'with tcpdump: %s' % (self.filter, e))
+            os.write(fd, prog)
+            os.close(fd)
+            self.files.append(path)
+            args += ['-f', '%d:%s' % (linktype, path)]
+        return args
+
+    def start(self):
+        args = self.compile() if self.filter else []
+        info('*** Capturing %d interfaces to %s\n'
+             % (len(self.targets), self.filename))
+        self.proc = Popen(['mncap', '-w', self.filename] + self.args + args +
+                          self.targets, stderr=PIPE)
+        return self
+
+    def stop(self):
+        """Ends the capture; returns {interface: (packets, dropped)} as
+        counted by the kernel"""
+        if self.proc is None:
+            return self.stats
+        if self.proc.poll() is None:
+            self.proc.send_signal(signal.SIGINT)
+        _, err = self.proc.communicate()
+        for line in err.decode().splitlines():
+            m = re.match(r'mncap: interface (\d+) .*: (\d+) packets, '
+                         r'(\d+) dropped', line)
+            if m:
+                self.stats[self.names[int(m.group(1))]] = (int(m.group(2)),
+                                                           int(m.group(3)))
+            else:
+                error(line + '\n')
+        drops = sum(dropped for _, dropped in self.stats.values())
+        info('*** Capture %s: %d packets, %d dropped by the kernel\n'
+             % (self.filename, sum(n for n, _ in self.stats.values()), drops))
+        for name, (_, dropped) in sorted(self.stats.items()):
+            if dropped:
+                info('    %s: %d dropped\n' % (name, dropped))
+        for path in self.files:
+            os.remove(path)
+        self.files, self.proc = [], None
+        return self.stats
@@ -0,0 +1,290 @@
+"""
+    Topology checkpoints: node positions, radio settings, associations
+    and tc parameters saved to a compact binary file, and restored onto a
+    running topology by applying only what differs, so repeated runs of
+    a scenario reuse the radios, namespaces and hostapd processes that
+    are already up instead of rebuilding them.
+
+    A topology kept loaded with Mininet_wifi.resident() outlives the
+    script that built it: later runs, in other processes, restore the
+    checkpoint onto it through the control API (Checkpoint.attach).
+"""
+
+import struct
+from time import time
+
+from mininet.log import info, warn
+
+from mn_wifi.control import ControlClient
+from mn_wifi.link import master, adhoc, mesh
+from mn_wifi.sinr import SINREngine
+
+
+STATION, AP, CAR, AIRCRAFT, SATELLITE, UNKNOWN = 0, 1, 2, 3, 4, 255
+
+
+class Checkpoint(object):
+    """Binary checkpoint
+
+    layout (little endian):
+        header: magic 'MNCP', u16 version, u16 flags, u32 nnodes,
+                u32 nintfs, 8 bytes reserved
+        nodes:  nnodes x (32s name, f64 x, f64 y, f64 z, u8 has position,
+                u8 kind (version 2))
+        intfs:  nintfs x (u32 node, 32s name, 6s mac, i32 phy,
+                i32 txpower, i32 antenna gain, i32 channel, i32 medium id,
+                f64 range, i32 associated intf (-1 for none), u8 has tc,
+                f64 tc bw, f64 tc loss, f64 tc latency)"""
+
+    MAGIC = b'MNCP'
+    VERSION = 2
+    header = struct.Struct('<4sHHII8x')
+    nodes_v1 = struct.Struct('<32sdddB')
+    node = struct.Struct('<32sdddBB')
+    intf = struct.Struct('<I32s6siiiiidiBddd')
+
+    def __init__(self, nodes=(), intfs=()):
+        self.nodes = list(nodes)  # (name, position or None, kind)
+        self.intfs = list(intfs)  # dicts, see save()
+
+    @staticmethod
+    def wireless_nodes(net):
+        return list(dict.fromkeys(net.stations + net.aps + net.cars +
+                                  net.aircrafts + net.satellites))
+
+    @staticmethod
+    def kind_of(net, node):
+        for kind, nodes in ((AP, net.aps), (CAR, net.cars),
+                            (AIRCRAFT, net.aircrafts),
+                            (SATELLITE, net.satellites),
+                            (STATION, net.stations)):
+            if node in nodes:
+                return kind
+        return UNKNOWN
+
+    @classmethod
+    def capture(cls, net):
+        nodes, intfs, index = [], [], {}
+        for n, node in enumerate(cls.wireless_nodes(net)):
+            pos = getattr(node, 'position', None)
+            nodes.append((node.name, [float(v) for v in pos[:3]]
+                          if pos is not None and len(pos) >= 3 else None,
+                          cls.kind_of(net, node)))
+            for wlan, intf in enumerate(node.wintfs.values()):
+                index[intf] = len(intfs)
+                phyid = getattr(node, 'phyid', [])
+                intfs.append(dict(
+                    node=n, name=intf.name, mac=intf.mac or '',
+                    phy=phyid[wlan] if wlan < len(phyid) else -1,
+                    txpower=int(getattr(intf, 'txpower', 0) or 0),
+                    gain=int(getattr(intf, 'antennaGain', 0) or 0),
+                    channel=int(getattr(intf, 'channel', 0) or 0),
+                    medium=int(getattr(intf, 'medium_id', 0) or 0),
+                    range=float(getattr(intf, 'range', 0) or 0),
+                    assoc=getattr(intf, 'associatedTo', None),
+                    tc=getattr(intf, 'tc_values', None)))
+        for intf in intfs:
+            intf['assoc'] = index.get(intf['assoc'], -1)
+        return cls(nodes, intfs)
+
+    @staticmethod
+    def encode(name):
+        "name as stored in a 32s field; longer names would be cut"
+        data = name.encode()
+        if len(data) > 32:
+            raise Exception('%s: checkpoints hold names of up to 32 bytes'
+                            % name)
+        return data
+
+    def save(self, filename):
+        # encode first so a long name does not leave half a file behind
+        node_names = [self.encode(name) for name, _, _ in self.nodes]
+        intf_names = [self.encode(intf['name']) for intf in self.intfs]
+        with open(filename, 'wb') as f:
+            f.write(self.header.pack(self.MAGIC, self.VERSION, 0,
+                                     len(self.nodes), len(self.intfs)))
+            for name, (_, pos, kind) in zip(node_names, self.nodes):
+                f.write(self.node.pack(name, *(pos or (0, 0, 0)),
+                                       pos is not None, kind))
+            for name, intf in zip(intf_names, self.intfs):
+                mac = bytes.fromhex(intf['mac'].replace(':', '')) \
+                    if intf['mac'] else b''
+                tc = intf['tc'] or (0, 0, 0)
+                f.write(self.intf.pack(
+                    intf['node'], name, mac, intf['phy'],
+                    intf['txpower'], intf['gain'], intf['channel'],
+                    intf['medium'], intf['range'], intf['assoc'],
+                    intf['tc'] is not None, *tc))
+
+    @classmethod
+    def load(cls, filename):
+        with open(filename, 'rb') as f:
+            data = f.read()
+        magic, version, _, nnodes, nintfs = cls.header.unpack_from(data, 0)
+        if magic != cls.MAGIC or version not in (1, cls.VERSION):
+            raise Exception('%s is not a topology checkpoint' % filename)
+        node_fmt = cls.node if version == cls.VERSION else cls.nodes_v1
+        off, nodes, intfs = cls.header.size, [], []
+        for _ in range(nnodes):
+            fields = node_fmt.unpack_from(data, off)
+            off += node_fmt.size
+            name, x, y, z, has_pos = fields[:5]
+            nodes.append((name.rstrip(b'\0').decode(),
+                          [x, y, z] if has_pos else None,
+                          fields[5] if len(fields) > 5 else UNKNOWN))
+        for _ in range(nintfs):
+            (node, name, mac, phy, txpower, gain, channel, medium, range_,
+             assoc, has_tc, bw, loss, latency) = cls.intf.unpack_from(data, off)
+            off += cls.intf.size
+            intfs.append(dict(
+                node=node, name=name.rstrip(b'\0').decode(),
+                mac=':'.join('%02x' % b for b in mac) if any(mac) else '',
+                phy=phy, txpower=txpower, gain=gain, channel=channel,
+                medium=medium, range=range_, assoc=assoc,
+                tc=(bw, loss, latency) if has_tc else None))
+        return cls(nodes, intfs)
+
+    @classmethod
+    def attach(cls, filename, ip='127.0.0.1', port=12345):
+        """Restores filename onto a topology kept loaded by another process
+        (Mininet_wifi.resident); returns a ControlClient connected to it,
+        or None when no topology is listening on ip:port"""
+        try:
+            client = ControlClient(ip, port)
+        except OSError:
+            return None
+        client.restore(filename)
+        return client
+
+    def add_missing(self, net, byname):
+        """Adds the stations and cars of the checkpoint the topology lacks,
+        through the warm pool when it runs; returns how many"""
+        added = 0
+        wlans = {}
+        for intf in self.intfs:
+            wlans[intf['node']] = wlans.get(intf['node'], 0) + 1
+        for n, (name, pos, kind) in enumerate(self.nodes):
+            if name in byname or kind not in (STATION, CAR):
+                continue
+            params = dict(wlans=wlans.get(n, 1))
+            if pos is not None:
+                params['position'] = ','.join(str(v) for v in pos)
+            add = net.addStation if kind == STATION else net.addCar
+            node = add(name, **params)
+            net.addWlans(node)
+            byname[name] = node
+            added += 1
+        return added
+
+    def remove_extra(self, net, byname):
+        "Deletes the stations and cars the checkpoint does not have"
+        names = set(name for name, _, _ in self.nodes)
+        extra = [node for name, node in list(byname.items())
+                 if name not in names and
+                 self.kind_of(net, node) in (STATION, CAR)]
+        for node in extra:
+            for intf in node.wintfs.values():
+                if isinstance(intf.associatedTo, master):
+                    intf.disconnect_pexec(intf.associatedTo)
+            net.delNode(node)
+            del byname[node.name]
+        return len(extra)
+
+    def restore(self, net, prune=False):
+        """Brings a running topology to this checkpoint, touching only
+        what differs; returns the number of changes per kind
+        prune: also delete the stations and cars added since"""
+        start = time()
+        byname = dict((node.name, node) for node in self.wireless_nodes(net))
+        changes = dict(moves=0, radios=0, associations=0, tc=0,
+                       added=self.add_missing(net, byname),
+                       removed=self.remove_extra(net, byname) if prune else 0)
+        current = []
+        for intf in self.intfs:
+            node = byname.get(self.nodes[intf['node']][0])
+            current.append(node.getNameToWintf(intf['name'])
+                           if node and intf['name'] in node.params['wlan']
+                           else None)
+        missing = [self.nodes[intf['node']][0] + ':' + intf['name']
+                   for intf, cur in zip(self.intfs, current) if cur is None]
+        if missing:
+            warn('*** Checkpoint interfaces not in the topology: %s\n'
+                 % ' '.join(missing[:10]))
+
+        for saved, intf in zip(self.intfs, current):
+            if intf is not None:
+                changes['radios'] += self.restore_radio(saved, intf)
+
+        moves = {}
+        for name, pos, _ in self.nodes:
+            node = byname.get(name)
+            if node is not None and pos is not None and \
+                    [float(v) for v in getattr(node, 'position', ())[:3]] != pos:
+                moves[node] = pos
+        if moves:
+            net.setPositions(moves)
+            changes['moves'] = len(moves)
+
+        for saved, intf in zip(self.intfs, current):
+            if intf is None or isinstance(intf, (master, adhoc, mesh)) or \
+                    isinstance(intf.associatedTo, str):  # bgscan/active_scan
+                continue
+            target = current[saved['assoc']] if saved['assoc'] >= 0 else None
+            if intf.associatedTo != target:
+                if intf.associatedTo:
+                    intf.disconnect_pexec(intf.associatedTo)
+                if target is not None:
+                    intf.associate_infra(target)
+                changes['associations'] += 1
+
+        for saved, intf in zip(self.intfs, current):
+            if intf is not None and saved['tc'] is not None and \
+                    getattr(intf, 'tc_values', None) != saved['tc']:
+                intf.config_tc(bw=saved['tc'][0], loss=saved['tc'][1],
+                               latency=saved['tc'][2])
+                changes['tc'] += 1
+
+        info('*** Checkpoint restored in %.2fs: %d nodes added, %d removed, '
+             '%d moves, %d radio settings, %d associations, %d tc updates\n'
+             % (time() - start, changes['added'], changes['removed'],
+                changes['moves'], changes['radios'], changes['associations'],
+                changes['tc']))
+        return changes
+
+    @staticmethod
+    def restore_radio(saved, intf):
+        "Applies the saved radio settings of intf that differ"
+        changed = 0
+        phyid = getattr(intf.node, 'phyid', [])
+        wlan = intf.node.params['wlan'].index(intf.name)
+        if saved['mac'] and saved['mac'] != intf.mac or \
+                saved['phy'] >= 0 and wlan < len(phyid) and \
+                saved['phy'] != phyid[wlan]:
+            warn('*** %s: radio differs from the checkpoint, '
+                 'restoring its settings anyway\n' % intf.name)
+        # the same steps as setTxPower/setAntennaGain, without a links
+        # pass per interface: positions are applied in one batch later
+        if saved['txpower'] != int(getattr(intf, 'txpower', 0) or 0):
+            intf.txpower = saved['txpower']
+            intf.iwdev_cmd('{} set txpower fixed {}'.format(
+                intf.name, intf.txpower * 100))
+            intf.setTXPowerWmediumd()
+            changed += 1
+        if saved['gain'] != int(getattr(intf, 'antennaGain', 0) or 0):
+            intf.antennaGain = saved['gain']
+            intf.setGainWmediumd(saved['gain'])
+            changed += 1
+        if saved['medium'] != int(getattr(intf, 'medium_id', 0) or 0):
+            intf.setMediumId(saved['medium'])
+            changed += 1
+        if isinstance(intf, master) and saved['channel'] and \
+                saved['channel'] != int(intf.channel or 0):
+            intf.channel = saved['channel']
+            intf.setAPChannel(saved['channel'])
+            changed += 1
+        if saved['range'] != float(getattr(intf, 'range', 0) or 0):
+            intf.range = saved['range']
+            changed += 1
+        if changed:
+            SINREngine.touch(intf)
+        return changed
@@ -16,6 +16,8 @@
 from mn_wifi.btvirt.clean import Cleanup as CleanBTVirt
 from mn_wifi.wmediumdConnector import w_server
 from mn_wifi.module import Mac80211Hwsim
+from mn_wifi.link import HostapdGroup
+from mn_wifi.netlink import PhyIndex
 
 
 class Cleanup(object):
@@ -72,6 +74,9 @@ def kill_mod_proc(cls):
         cls.killprocs('sumo-gui')
         cls.killprocs('olsrd2_static')
         cls.killprocs('hostapd')
+        if HostapdGroup.groups:
+            sh('rm -f /var/run/hostapd-mn{}-*'.format(getpid()))
+            HostapdGroup.reset()
         cls.killprocs('rpld')
         cls.killprocs('btvirt')
         sleep(0.1)
@@ -85,9 +90,13 @@ def kill_mod_proc(cls):
         sleep(0.1)
 
         info("\n*** Removing WiFi module and Configurations\n")        
-        phy = co('find /sys/kernel/debug/ieee80211 -name hwsim | cut -d/ -f 6 | sort',
-                 shell=True).decode('utf-8').split("\n")
-        phy.pop()
+        if PhyIndex.enabled:
+            phy = PhyIndex.phy_names()
+            PhyIndex.stop()
+        else:
+            phy = co('find /sys/kernel/debug/ieee80211 -name hwsim | cut -d/ -f 6 | sort',
+                     shell=True).decode('utf-8').split("\n")
+            phy.pop()
         phy.sort(key=len, reverse=False)
 
         for phydev in phy:
@@ -0,0 +1,103 @@
+"""
+    Satellite positions for whole constellations: the TLE file is read
+    once and every epoch propagates all satellites in one call of the
+    compiled SGP4 of the sgp4 package (the one skyfield runs on), followed
+    by a vectorized TEME to geodetic conversion.
+"""
+
+from datetime import datetime, timezone
+
+import numpy as np
+from mininet.log import error
+
+R_MEAN = 6371000.0  # average radius of the Earth in meters, as deg_to_meters
+WGS84_A = 6378.137  # km
+WGS84_F = 1 / 298.257223563
+WGS84_E2 = WGS84_F * (2 - WGS84_F)
+
+
+def read_tle(tle_file):
+    "Returns {catalog number: (line1, line2)} of a two or three line file"
+    tles = {}
+    with open(tle_file) as f:
+        lines = [line.rstrip() for line in f if line.strip()]
+    for n, line in enumerate(lines[:-1]):
+        if line.startswith('1 ') and lines[n + 1].startswith('2 '):
+            tles[int(line[2:7])] = line, lines[n + 1]
+    return tles
+
+
+def gmst(jd, fr):
+    "Greenwich mean sidereal time (IAU 1982) in radians"
+    tut1 = (jd - 2451545.0 + fr) / 36525.0
+    temp = -6.2e-6 * tut1 ** 3 + 0.093104 * tut1 ** 2 + \
+        (876600.0 * 3600 + 8640184.812866) * tut1 + 67310.54841
+    return np.remainder(np.radians(temp / 240.0), 2 * np.pi)
+
+
+def teme_to_geodetic(r, theta):
+    """Latitude and longitude in degrees and altitude in km of (n, 3) TEME
+    positions in km, polar motion neglected"""
+    c, s = np.cos(theta), np.sin(theta)
+    x = c * r[:, 0] + s * r[:, 1]
+    y = -s * r[:, 0] + c * r[:, 1]
+    z = r[:, 2]
+    p = np.hypot(x, y)
+    lat = np.arctan2(z, p * (1 - WGS84_E2))
+    for _ in range(4):
+        n = WGS84_A / np.sqrt(1 - WGS84_E2 * np.sin(lat) ** 2)
+        lat = np.arctan2(z + WGS84_E2 * n * np.sin(lat), p)
+    n = WGS84_A / np.sqrt(1 - WGS84_E2 * np.sin(lat) ** 2)
+    alt = p * np.cos(lat) + (z + WGS84_E2 * n * np.sin(lat)) * np.sin(lat) - n
+    return np.degrees(lat), np.degrees(np.arctan2(y, x)), alt
+
+
+def deg_to_meters(lat, lon, ref_lat=0.0, ref_lon=0.0):
+    "Vectorized Mininet_wifi.deg_to_meters"
+    dy = R_MEAN * np.radians(lat - ref_lat)
+    dx = R_MEAN * np.cos(np.radians(ref_lat)) * np.radians(lon - ref_lon)
+    return dx, dy
+
+
+class Constellation(object):
+    "All satellites of one TLE file that the topology uses"
+
+    def __init__(self, tle_file, catnrs):
+        from sgp4.api import Satrec, SatrecArray
+
+        tles = read_tle(tle_file)
+        self.index = []  # position of each catnr in the arrays, None if missing
+        satrecs = []
+        for catnr in catnrs:
+            if int(catnr) not in tles:
+                error('*** Satellite %s not found in %s\n' % (catnr, tle_file))
+                self.index.append(None)
+                continue
+            self.index.append(len(satrecs))
+            satrecs.append(Satrec.twoline2rv(*tles[int(catnr)]))
+        self.sats = SatrecArray(satrecs) if satrecs else None
+
+    def propagate(self, when):
+        """Returns x, y (meters, as deg_to_meters), altitude (km) and speed
+        (km/h) arrays of the satellites at datetime when, and the mask of
+        those that propagated"""
+        when = when.astimezone(timezone.utc)
+        jd, fr = self.julian(when)
+        err, r, v = self.sats.sgp4(np.array([jd]), np.array([fr]))
+        r, v, ok = r[:, 0], v[:, 0], err[:, 0] == 0
+        lat, lon, alt = teme_to_geodetic(r, gmst(jd, fr))
+        dx, dy = deg_to_meters(lat, lon)
+        speed = np.linalg.norm(v, axis=1) * 3600
+        return dx, dy, alt, speed, ok
+
+    @staticmethod
+    def julian(when):
+        "Julian day split into a whole part and a fraction, as sgp4 wants"
+        from sgp4.api import jday
+        seconds = when.second + when.microsecond * 1e-6
+        return jday(when.year, when.month, when.day,
+                    when.hour, when.minute, seconds)
+
+    @staticmethod
+    def now():
+        return datetime.now(timezone.utc)
@@ -0,0 +1,424 @@
+"""
+    Control API served by Mininet_wifi.socketServer: a single event loop
+    that speaks length-prefixed binary frames and, for older clients, the
+    text protocol (set.sta1.setPosition("1,2,0")), one command per line.
+    Requests that change the topology (positions, calls, restores and the
+    text commands) run one at a time on a single worker, in the order the
+    loop received them; shell commands go to a small pool of workers, so
+    a slow one does not stall the other clients. Each connection still
+    has its requests run and answered in order.
+
+    frame: u32 payload length, payload (big endian)
+    request payload: u8 opcode, u32 request id, body
+        SET_POSITIONS  u16 count, count x (u8 len, name, f32 x, y, z)
+        CALL           str node, str method, str argument
+        GET            str node, str attribute
+        CMD            str node, str command
+        RESTORE        str checkpoint file, u8 prune (optional)
+        CHECKPOINT     str checkpoint file
+    reply payload: u8 opcode | 0x80, u32 request id, u8 status, str result
+    where str is a u16 length followed by utf-8 bytes
+"""
+
+import selectors
+import socket
+import struct
+from collections import deque
+from concurrent.futures import ThreadPoolExecutor
+from queue import Queue, Empty
+from time import time
+
+from mininet.log import info, debug
+
+
+SET_POSITIONS, CALL, GET, CMD, RESTORE, CHECKPOINT = 1, 2, 3, 4, 5, 6
+REPLY = 0x80
+OK, ERROR = 0, 1
+
+frame_hdr = struct.Struct('!I')
+req_hdr = struct.Struct('!BI')
+reply_hdr = struct.Struct('!BIB')
+count_fmt = struct.Struct('!H')
+pos_fmt = struct.Struct('!fff')
+MAX_FRAME = 1 << 24
+
+
+def pack_str(value):
+    data = str(value).encode('utf-8')
+    return count_fmt.pack(len(data)) + data
+
+
+def unpack_str(buf, off):
+    n, = count_fmt.unpack_from(buf, off)
+    off += count_fmt.size
+    return bytes(buf[off:off + n]).decode('utf-8'), off + n
+
+
+def frame(payload):
+    return frame_hdr.pack(len(payload)) + payload
+
+
+def encode_positions(req_id, positions):
+    "SET_POSITIONS request for a dict of node name to (x, y, z)"
+    parts = [req_hdr.pack(SET_POSITIONS, req_id),
+             count_fmt.pack(len(positions))]
+    for name, pos in positions.items():
+        name = name.encode('utf-8')
+        parts.append(struct.pack('!B', len(name)) + name +
+                     pos_fmt.pack(*pos))
+    return frame(b''.join(parts))
+
+
+def encode_request(opcode, req_id, *args):
+    "CALL, GET or CMD request"
+    return frame(req_hdr.pack(opcode, req_id) +
+                 b''.join(pack_str(arg) for arg in args))
+
+
+def decode_reply(payload):
+    "Returns (request id, status, result)"
+    opcode, req_id, status = reply_hdr.unpack_from(payload)
+    result, _ = unpack_str(payload, reply_hdr.size)
+    return req_id, status, result
+
+
+def decode_positions(payload, off):
+    count, = count_fmt.unpack_from(payload, off)
+    off += count_fmt.size
+    positions = {}
+    for _ in range(count):
+        n = payload[off]
+        name = bytes(payload[off + 1:off + 1 + n]).decode('utf-8')
+        off += 1 + n
+        positions[name] = pos_fmt.unpack_from(payload, off)
+        off += pos_fmt.size
+    return positions
+
+
+class ControlClient(object):
+    "Blocking client of the binary protocol; requests may be pipelined"
+
+    def __init__(self, ip='127.0.0.1', port=12345):
+        self.sock = socket.create_connection((ip, port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buf = bytearray()
+        self.req_id = 0
+
+    def next_id(self):
+        self.req_id = (self.req_id + 1) & 0xffffffff
+        return self.req_id
+
+    def send(self, data):
+        self.sock.sendall(data)
+
+    def recv_reply(self):
+        "Returns (request id, status, result) of the next reply"
+        while True:
+            if len(self.buf) >= frame_hdr.size:
+                size, = frame_hdr.unpack_from(self.buf)
+                end = frame_hdr.size + size
+                if len(self.buf) >= end:
+                    reply = decode_reply(self.buf[frame_hdr.size:end])
+                    del self.buf[:end]
+                    return reply
+            data = self.sock.recv(65536)
+            if not data:
+                raise ConnectionError('control server closed the connection')
+            self.buf += data
+
+    def call(self, data):
+        self.send(data)
+        _, status, result = self.recv_reply()
+        if status != OK:
+            raise RuntimeError(result)
+        return result
+
+    def set_positions(self, positions):
+        return self.call(encode_positions(self.next_id(), positions))
+
+    def set(self, node, method, *args):
+        return self.call(encode_request(CALL, self.next_id(), node, method, *args))
+
+    def get(self, node, attr):
+        return self.call(encode_request(GET, self.next_id(), node, attr))
+
+    def cmd(self, node, command):
+        return self.call(encode_request(CMD, self.next_id(), node, command))
+
+    def restore(self, filename, prune=False):
+        "Restores a checkpoint onto the topology served (see checkpoint.py)"
+        return self.call(frame(req_hdr.pack(RESTORE, self.next_id()) +
+                               pack_str(filename) +
+                               struct.pack('!B', bool(prune))))
+
+    def checkpoint(self, filename):
+        return self.call(encode_request(CHECKPOINT, self.next_id(), filename))
+
+    def close(self):
+        self.sock.close()
+
+
+class Connection(object):
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.inbuf = bytearray()
+        self.outbuf = bytearray()
+        self.binary = None  # decided by the first byte
+        self.jobs = deque()  # requests waiting for the previous one
+        self.busy = False  # a request of this connection is on a worker
+        self.closed = False
+        self.lines = False  # the client ends its text commands with newlines
+        self.last = time()  # of the last bytes received
+
+
+class ControlServer(object):
+    "Serves every client from one selector loop"
+
+    # an unterminated text command runs after this many seconds of
+    # silence, for clients that never end their commands with a newline
+    text_idle = 0.2
+
+    def __init__(self, net, ip='127.0.0.1', port=12345, workers=4):
+        self.net = net
+        family = socket.AF_INET6 if ':' in ip else socket.AF_INET
+        self.sock = socket.socket(family, socket.SOCK_STREAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind((ip, port))
+        self.sock.listen(128)
+        self.sock.setblocking(False)
+        self.selector = selectors.DefaultSelector()
+        self.selector.register(self.sock, selectors.EVENT_READ)
+        # workers report through done and wake the loop through a socket;
+        # requests that change net run one at a time on the state worker,
+        # shell commands (CMD) on the pool
+        self.state = ThreadPoolExecutor(max_workers=1)
+        self.pool = ThreadPoolExecutor(max_workers=workers)
+        self.done = Queue()
+        self.wake_r, self.wake_w = socket.socketpair()
+        self.wake_r.setblocking(False)
+        self.selector.register(self.wake_r, selectors.EVENT_READ)
+        self.conns = set()
+        self.keep_alive = True
+
+    def serve(self):
+        while self.keep_alive:
+            partial = [conn for conn in self.conns if conn.binary is False
+                       and not conn.lines and conn.inbuf]
+            timeout = self.text_idle if partial else 0.5
+            for key, events in self.selector.select(timeout=timeout):
+                if key.fileobj is self.sock:
+                    self.accept()
+                    continue
+                if key.fileobj is self.wake_r:
+                    self.finish()
+                    continue
+                conn = key.data
+                try:
+                    if events & selectors.EVENT_READ:
+                        self.read(conn)
+                    if events & selectors.EVENT_WRITE:
+                        self.write(conn)
+                except (OSError, ValueError) as e:
+                    debug('control connection: %s\n' % e)
+                    self.close(conn)
+            for conn in partial:
+                # clients that send one command without a newline and
+                # wait for the reply
+                if not conn.closed and conn.inbuf and \
+                        time() - conn.last >= self.text_idle:
+                    cmd = conn.inbuf.decode('utf-8', 'replace')
+                    conn.inbuf = bytearray()
+                    self.submit(conn, self.text_job(cmd, b''))
+        self.state.shutdown(wait=False)
+        self.pool.shutdown(wait=False)
+        self.selector.close()
+        self.sock.close()
+        self.wake_r.close()
+        self.wake_w.close()
+
+    def accept(self):
+        try:
+            sock, _ = self.sock.accept()
+        except BlockingIOError:
+            return
+        sock.setblocking(False)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        conn = Connection(sock)
+        self.conns.add(conn)
+        self.selector.register(sock, selectors.EVENT_READ, conn)
+
+    def close(self, conn):
+        if conn.closed:
+            return
+        conn.closed = True
+        conn.jobs.clear()
+        self.conns.discard(conn)
+        self.selector.unregister(conn.sock)
+        conn.sock.close()
+
+    def read(self, conn):
+        data = conn.sock.recv(65536)
+        if not data:
+            self.close(conn)
+            return
+        conn.inbuf += data
+        conn.last = time()
+        if conn.binary is None:
+            # frames start with the high byte of their length
+            conn.binary = conn.inbuf[0] == 0
+        if conn.binary:
+            self.read_frames(conn)
+        else:
+            self.read_lines(conn)
+
+    def read_lines(self, conn):
+        "Text commands, one per line; the reply ends with a newline too"
+        lines = conn.inbuf.split(b'\n')
+        conn.inbuf = bytearray(lines.pop())
+        conn.lines = conn.lines or bool(lines)
+        for line in lines:
+            cmd = line.rstrip(b'\r').decode('utf-8', 'replace')
+            if cmd:
+                self.submit(conn, self.text_job(cmd, b'\n'))
+
+    def text_job(self, cmd, end):
+        return lambda: str(self.net.socket_command(cmd)).encode('utf-8') + end
+
+    def read_frames(self, conn):
+        buf = conn.inbuf
+        off = 0
+        while len(buf) - off >= frame_hdr.size:
+            size, = frame_hdr.unpack_from(buf, off)
+            if size > MAX_FRAME:
+                raise ValueError('frame of %d bytes' % size)
+            end = off + frame_hdr.size + size
+            if len(buf) < end:
+                break
+            payload = memoryview(buf)[off + frame_hdr.size:end]
+            opcode, job = self.handle(payload)
+            payload.release()
+            # GET is answered in the loop, CMD on the pool, the rest on
+            # the state worker
+            self.submit(conn, job, inline=opcode == GET,
+                        pool=self.pool if opcode == CMD else None)
+            off = end
+        del buf[:off]
+
+    def handle(self, payload):
+        """Decodes a request; returns its opcode and a job that runs it
+        and returns the reply frame"""
+        opcode, req_id = req_hdr.unpack_from(payload)
+        off = req_hdr.size
+        try:
+            if opcode == SET_POSITIONS:
+                positions = decode_positions(payload, off)
+
+                def run():
+                    self.net.setPositions(positions)
+                    return len(positions)
+            elif opcode in (CALL, GET, CMD):
+                args = []
+                while off < len(payload):
+                    arg, off = unpack_str(payload, off)
+                    args.append(arg)
+
+                def run():
+                    node = self.net.getNodeByName(args[0])
+                    if opcode == CALL:
+                        return getattr(node, args[1])(*args[2:])
+                    elif opcode == GET:
+                        return getattr(node, args[1])
+                    return node.pexec(args[1])
+            elif opcode in (RESTORE, CHECKPOINT):
+                filename, off = unpack_str(payload, off)
+                prune = off < len(payload) and bool(payload[off])
+
+                def run():
+                    if opcode == RESTORE:
+                        return self.net.restore(filename, prune=prune)
+                    return self.net.checkpoint(filename)
+            else:
+                raise ValueError('unknown opcode %d' % opcode)
+        except Exception as e:
+            failure = e
+
+            def run():
+                raise failure
+
+        def job():
+            try:
+                status, result = OK, run()
+            except Exception as e:
+                status, result = ERROR, e
+            return frame(reply_hdr.pack(opcode | REPLY, req_id, status) +
+                         pack_str(result))
+        return opcode, job
+
+    def submit(self, conn, job, inline=False, pool=None):
+        """Runs job in the loop (inline, when nothing of conn is pending)
+        or on pool (the state worker by default) after the requests of
+        conn received before it"""
+        if inline and not conn.busy and not conn.jobs:
+            self.send(conn, job())
+            return
+        conn.jobs.append((job, pool or self.state))
+        self.next_job(conn)
+
+    def next_job(self, conn):
+        if conn.busy or not conn.jobs:
+            return
+        conn.busy = True
+        job, pool = conn.jobs.popleft()
+        pool.submit(self.run, conn, job)
+
+    def run(self, conn, job):
+        "Worker side: runs job and hands the reply back to the loop"
+        try:
+            reply = job()
+        except Exception as e:
+            reply = str(e).encode('utf-8')
+        self.done.put((conn, reply))
+        try:
+            self.wake_w.send(b'\0')
+        except OSError:
+            pass
+
+    def finish(self):
+        "Loop side: sends the replies of the requests the workers ran"
+        try:
+            while self.wake_r.recv(4096):
+                pass
+        except BlockingIOError:
+            pass
+        while True:
+            try:
+                conn, reply = self.done.get_nowait()
+            except Empty:
+                return
+            conn.busy = False
+            if conn.closed:
+                continue
+            try:
+                self.send(conn, reply)
+                self.next_job(conn)
+            except (OSError, ValueError) as e:
+                debug('control connection: %s\n' % e)
+                self.close(conn)
+
+    def send(self, conn, data):
+        conn.outbuf += data
+        self.write(conn)
+
+    def write(self, conn):
+        if conn.outbuf:
+            sent = conn.sock.send(conn.outbuf)
+            del conn.outbuf[:sent]
+        events = selectors.EVENT_READ
+        if conn.outbuf:
+            events |= selectors.EVENT_WRITE
+        self.selector.modify(conn.sock, events, conn)
+
+    def stop(self):
+        self.keep_alive = False
+        info('*** Stopping control server\n')
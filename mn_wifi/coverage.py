@@ -0,0 +1,175 @@
+"""
+    Coverage rasters of static APs. For each AP interface the RSSI of the
+    active propagation model is computed once over its coverage square
+    (position +/- range, on the plane of the stations) at a fixed
+    resolution; the per-tick RSSI of a station in range is then a
+    bilinear interpolation instead of a propagation model evaluation.
+    A raster is rebuilt when the txpower, gain, height, frequency, range
+    or position of its AP changes, and APs that keep moving are left to
+    the model. Models that depend on the receiver beyond an additive gain
+    (twoRayGround, young) are always evaluated.
+"""
+
+import numpy as np
+
+from mn_wifi.metrics import Metrics
+from mn_wifi.propagationModels import PropagationModel as ppm
+
+
+C = 299792458.0
+MODELS = ('friis', 'logDistance', 'logNormalShadowing', 'ITU')
+
+
+def path_loss(freq, dist):
+    "PropagationModel.path_loss for an array of distances"
+    lambda_ = C / (freq * 10 ** 9)
+    return 10 * np.log10((4 * np.pi * dist) ** 2 * ppm.sL / lambda_ ** 2)
+
+
+def loss(rx_freq, tx_freq, dist):
+    """Loss (dB) of the active model over an array of distances, for the
+    models where the gains only add up (MODELS); truncated where
+    PropagationModel truncates"""
+    dist = np.where(dist == 0, 0.1, dist)
+    if ppm.model == 'friis':
+        return np.trunc(path_loss(rx_freq, dist))
+    if ppm.model in ('logDistance', 'logNormalShadowing'):
+        pl = int(path_loss(rx_freq, np.array(1.0)))
+        pldb = 10 * ppm.exp * np.log10(dist)
+        if ppm.model == 'logNormalShadowing':
+            pldb = pldb + ppm.gRandom
+        return pl + np.trunc(pldb)
+    # ITU
+    N = np.where(dist > 16, 38, 28) if not ppm.pL else ppm.pL
+    return np.trunc(20 * np.log10(tx_freq * 10 ** 3) + N * np.log10(dist) +
+                    ppm.lF * ppm.nFloors - 28)
+
+
+class CoverageRaster(object):
+
+    enabled = False
+    res = 1.0  # meters per cell
+    max_cells = 512  # per side; coarser cells beyond it
+    max_planes = 4  # rasters per AP interface (station freq, height)
+    rasters = {}  # ap_intf -> {(freq, z): Raster}
+    moves = {}  # ap node -> rebuilds caused by a position change
+    mobile = set()  # ap nodes not worth a raster
+    builds = hits = misses = 0
+
+    @classmethod
+    def start(cls, res):
+        cls.enabled = res > 0
+        cls.res = float(res or 1)
+        if cls.enabled:
+            Metrics.source('coverage', cls.gauges)
+
+    @classmethod
+    def rssi(cls, intf, ap_intf):
+        """RSSI of intf from ap_intf at the current positions, or None
+        when the model has to be evaluated"""
+        ap = ap_intf.node
+        if ppm.model not in MODELS or ap in cls.mobile:
+            return None
+        pos = intf.node.position
+        key = (intf.freq, round(float(pos[2]), 1))
+        planes = cls.rasters.get(ap_intf)
+        raster = planes.get(key) if planes else None
+        if raster is None or not raster.valid(ap_intf):
+            raster = cls.build(ap_intf, key, raster)
+            if raster is None:
+                cls.misses += 1
+                return None
+        value = raster.lookup(float(pos[0]), float(pos[1]))
+        if value is None:
+            cls.misses += 1
+            return None
+        cls.hits += 1
+        return value + intf.antennaGain
+
+    @classmethod
+    def build(cls, ap_intf, key, old):
+        ap = ap_intf.node
+        if old is not None and old.position != Raster.position_of(ap):
+            cls.moves[ap] = cls.moves.get(ap, 0) + 1
+            if cls.moves[ap] > 1:
+                cls.mobile.add(ap)
+                cls.rasters.pop(ap_intf, None)
+                return None
+        planes = cls.rasters.setdefault(ap_intf, {})
+        if key not in planes and len(planes) >= cls.max_planes:
+            return None
+        planes[key] = Raster(ap_intf, key[0], key[1], cls.res, cls.max_cells)
+        cls.builds += 1
+        return planes[key]
+
+    @classmethod
+    def gauges(cls):
+        return {'mn_wifi_coverage_rasters': sum(len(p) for p in
+                                                cls.rasters.values()),
+                'mn_wifi_coverage_builds': cls.builds,
+                'mn_wifi_coverage_lookups{result="raster"}': cls.hits,
+                'mn_wifi_coverage_lookups{result="model"}': cls.misses}
+
+    @classmethod
+    def stop(cls):
+        Metrics.source('coverage')
+        cls.rasters, cls.moves, cls.mobile = {}, {}, set()
+        cls.builds = cls.hits = cls.misses = 0
+
+
+class Raster(object):
+    "RSSI without the receiver gain on a grid of one plane"
+
+    step = 2  # dB across a cell above which the model is evaluated
+
+    def __init__(self, ap_intf, freq, z, res, max_cells):
+        self.signature = self.signature_of(ap_intf)
+        self.position = self.position_of(ap_intf.node)
+        x, y, apz = (float(v) for v in self.position)
+        reach = float(ap_intf.range) + res
+        self.res = max(res, 2 * reach / (max_cells - 1))
+        self.n = int(np.ceil(2 * reach / self.res)) + 1
+        self.x0, self.y0 = x - reach, y - reach
+        xs = self.x0 + np.arange(self.n) * self.res
+        ys = self.y0 + np.arange(self.n) * self.res
+        dist = np.sqrt((xs[None, :] - x) ** 2 + (ys[:, None] - y) ** 2 +
+                       (z - apz) ** 2)
+        self.grid = self.model(ap_intf, freq, dist)
+        # cells the interpolation gets wrong (next to the AP, across the
+        # ITU breakpoint) are left to the model
+        corners = np.stack([self.grid[:-1, :-1], self.grid[:-1, 1:],
+                            self.grid[1:, :-1], self.grid[1:, 1:]])
+        self.steep = (corners.max(axis=0) - corners.min(axis=0)) > self.step
+
+    @staticmethod
+    def position_of(node):
+        return tuple(node.position[:3])
+
+    @staticmethod
+    def signature_of(ap_intf):
+        return (ap_intf.txpower, ap_intf.antennaGain,
+                getattr(ap_intf, 'antennaHeight', None), ap_intf.freq,
+                ap_intf.range, ppm.model, ppm.gRandom)
+
+    def valid(self, ap_intf):
+        return self.signature == self.signature_of(ap_intf) and \
+            self.position == self.position_of(ap_intf.node)
+
+    @staticmethod
+    def model(ap_intf, freq, dist):
+        "RSSI of the model with the receiver gain left out"
+        return ap_intf.txpower + ap_intf.antennaGain - \
+            loss(freq, ap_intf.freq, dist)
+
+    def lookup(self, x, y):
+        "Bilinear interpolation at (x, y); None outside the raster"
+        fx = (x - self.x0) / self.res
+        fy = (y - self.y0) / self.res
+        i, j = int(fx), int(fy)
+        if fx < 0 or fy < 0 or i >= self.n - 1 or j >= self.n - 1 or \
+                self.steep[j, i]:
+            return None
+        tx, ty = fx - i, fy - j
+        g = self.grid
+        return float((g[j, i] * (1 - tx) + g[j, i + 1] * tx) * (1 - ty) +
+                     (g[j + 1, i] * (1 - tx) + g[j + 1, i + 1] * tx) * ty)
@@ -4,23 +4,81 @@
    @Contributor: Joaquin Alvarez (j.alvarez@uah.es)
 """
 
-from os import system as sh, getpid
+from os import system as sh, getpid, listdir, path
 import re
 import subprocess
 from time import sleep
 from glob import glob
 from subprocess import check_output as co, CalledProcessError
 
+import numpy as np
 from mininet.link import Intf, TCIntf, Link
 from mininet.log import error, debug, info
 
+from mn_wifi.coverage import CoverageRaster
 from mn_wifi.devices import DeviceRate
 from mn_wifi.manetRoutingProtocols import manetProtocols
 from mn_wifi.propagationModels import SetSignalRange, GetPowerGivenRange
 from mn_wifi.wmediumdConnector import DynamicIntfRef, \
     WStarter, SNRLink, w_pos, w_cst, w_server, ERRPROBLink, \
-    wmediumd_mode, w_txpower, w_gain, w_height, w_medium
+    wmediumd_mode, w_txpower, w_gain, w_height, w_medium, w_shm
 from mn_wifi.frequency import Frequency as Getfreq
+from mn_wifi.metrics import Metrics
+from mn_wifi.sinr import SINREngine
+from mn_wifi.wpactrl import CtrlPool
+
+
+class LinkEquation(object):
+    """Channel equations (IntfWireless.eq*) compiled once into functions
+    of dist, evaluated for a single distance or for an array of them, and
+    optionally looked up in a table quantized by step meters"""
+
+    funcs = {}
+    tables = {}
+    max_table = 1 << 16  # entries per table; farther distances are evaluated
+
+    @classmethod
+    def get(cls, expr, args='dist'):
+        key = (expr, args)
+        if key not in cls.funcs:
+            cls.funcs[key] = eval('lambda {}: {}'.format(args, expr), globals())
+        return cls.funcs[key]
+
+    @classmethod
+    def batch(cls, expr, dists, *args):
+        "Evaluates expr for every distance in dists"
+        dists = np.asarray(dists, dtype=float)
+        func = cls.get(expr, cls.args(len(args)))
+        try:
+            values = func(dists, *args)
+        except TypeError:
+            # expression that does not take arrays (e.g. math.*)
+            values = np.vectorize(func)(dists, *args)
+        return np.broadcast_to(np.asarray(values, dtype=float), dists.shape)
+
+    @classmethod
+    def lookup(cls, expr, dist, step, *args):
+        "Value of expr at dist rounded to a multiple of step"
+        i = int(round(dist / step))
+        if i >= cls.max_table:
+            return float(cls.get(expr, cls.args(len(args)))(i * step, *args))
+        key = (expr, step) + args
+        table = cls.tables.get(key)
+        if table is None or i >= len(table):
+            size = min(max(i + 1, 2 * len(table) if table is not None else 1024),
+                       cls.max_table)
+            table = cls.tables[key] = cls.batch(expr, np.arange(size) * step, *args)
+        return float(table[i])
+
+    @staticmethod
+    def args(n):
+        return 'dist, custombw' if n else 'dist'
+
+    @classmethod
+    def value(cls, expr, dist, step=0, *args):
+        if step:
+            return cls.lookup(expr, dist, step, *args)
+        return cls.get(expr, cls.args(len(args)))(dist, *args)
 
 
 class IntfWireless(Intf):
@@ -33,6 +91,8 @@ class IntfWireless(Intf):
     eqDelay = '(dist / 10) + 1'
     eqLatency = '(dist / 10)/2'
     eqBw = ' * (1.01 ** -dist)'
+    eqStep = 0  # quantize distances to this step (m), 0 for exact values
+    tcThreshold = 0  # relative bw/loss/latency change that reaches tc
 
     def __init__(self, name, node=None, port=None, link=None,
                  mac=None, **params):
@@ -60,22 +120,31 @@ def configWLink(self, dist=0):
         bw = self.get_bw(dist)
         loss = self.get_loss(dist)
         latency = self.get_latency(dist)
-        self.config_tc(bw=bw, loss=loss, latency=latency)
+        if self.tc_changed(bw, loss, latency):
+            self.config_tc(bw=bw, loss=loss, latency=latency)
+        else:
+            Metrics.inc('mn_wifi_tc_skipped')
+
+    def tc_changed(self, *values):
+        "Whether values differ from the last ones sent to tc by more than tcThreshold"
+        last = getattr(self, 'tc_values', None)
+        return not last or any(abs(new - old) > self.tcThreshold * abs(old)
+                               for new, old in zip(values, last))
 
     def getDelay(self, dist):
         "Based on RandomPropagationDelayModel"
-        return eval(self.eqDelay)
+        return LinkEquation.value(self.eqDelay, dist, self.eqStep)
 
     def get_latency(self, dist):
-        return eval(self.eqLatency)
+        return LinkEquation.value(self.eqLatency, dist, self.eqStep)
 
     def get_loss(self, dist):
-        return eval(self.eqLoss)
+        return LinkEquation.value(self.eqLoss, dist, self.eqStep)
 
     def get_bw(self, dist):
-        # dist is used by eval
         custombw = self.getCustomRate()
-        rate = eval(str(custombw) + self.eqBw)
+        rate = LinkEquation.value('custombw' + self.eqBw, dist,
+                                  self.eqStep, custombw)
         if rate <= 0.0: rate = 0.1
         return rate
 
@@ -89,6 +158,11 @@ def set_tc(self, iface, bw=0, loss=0, latency=0):
         if latency > 0.1: cmd += 'latency {:.2f}ms '.format(latency)
         if loss > 0.1: cmd += 'loss {:.1f}% '.format(loss)
         self.node.pexec(cmd)
+        if iface == self.name:
+            # whoever writes the qdisc (configWLink, setTC, replays,
+            # restores) keeps what tc_changed compares against
+            self.tc_values = (bw, loss, latency)
+        Metrics.inc('mn_wifi_tc_updates')
 
     def get_default_gw(self):
         return DeviceRate(self).rate if 'model' in self.node.params \
@@ -162,6 +236,8 @@ def wpa_pexec(self):
         return self.node.pexec(self.get_wpa_cmd())
 
     def kill_hostapd_process(self):
+        if HostapdGroup.remove(self):
+            return
         pattern = "mn{}_{}.apconf".format(getpid(), self.name)
         while True:
             try:
@@ -202,7 +278,11 @@ def sendIntfTowmediumd(self):
         "Dynamically sending nodes to wmediumd"
         self.wmIface = DynamicIntfRef(self.node, intf=self.name)
         self.node.wmIfaces.append(self.wmIface)
-        w_server.register_interface(self.mac)
+        # radios taken from the warm pool have already settled
+        self.wmIface.sta_id = w_server.register_interface(
+            self.mac, getattr(self.node, 'settle', 1))
+        if w_shm.enabled:
+            w_shm.register(self.wmIface)
 
     def getCustomRate(self):
         mode_rate = {'a': 11, 'b': 3, 'g': 11, 'n': 600, 'n2': 600,
@@ -222,7 +302,13 @@ def rec_rssi(self):
             self.node.phyid[self.id], abs(int(self.rssi)))
         self.cmd(cmd)
 
-    def get_rssi(self, ap_intf, dist):
+    def get_rssi(self, ap_intf, dist, cached=False):
+        """cached: dist is the current distance to ap_intf, so the
+        coverage raster of a static AP may answer"""
+        if cached and CoverageRaster.enabled:
+            rssi = CoverageRaster.rssi(self, ap_intf)
+            if rssi is not None:
+                return rssi
         from mn_wifi.propagationModels import PropagationModel as ppm
         return float(ppm(self, ap_intf, dist).rssi)
 
@@ -261,6 +347,7 @@ def setChannel(self, channel):
         "Set Channel"
         from mn_wifi.node import AP
         self.channel = channel
+        SINREngine.touch(self)
         if isinstance(self, AP):
             self.setAPChannel(channel)
         elif isinstance(self, mesh):
@@ -327,6 +414,7 @@ def setDefaultRange(self):
 
     def setAntennaGain(self, gain):
         self.antennaGain = int(gain)
+        SINREngine.touch(self)
         self.setDefaultRange()
         self.setGainWmediumd(gain)
         self.node.configLinks()
@@ -348,6 +436,7 @@ def setRange(self, range):
 
     def setTxPower(self, txpower):
         self.txpower = int(txpower)
+        SINREngine.touch(self)
         self.iwdev_cmd('{} set txpower fixed {}'.format(self.name, self.txpower * 100))
         self.setDefaultRange()
         self.setTXPowerWmediumd()
@@ -501,6 +590,7 @@ def update_client_params(self, ap_intf):
         self.channel = ap_intf.channel
         self.mode = ap_intf.mode
         self.ssid = ap_intf.ssid
+        SINREngine.touch(self)
 
     def wep(self, ap_intf):
         passwd = self.passwd if self.passwd else ap_intf.passwd
@@ -510,16 +600,46 @@ def wep(self, ap_intf):
     def setConnected(self, ap_intf):
         self.associatedTo = ap_intf
         ap_intf.associatedStations.append(self)
+        SINREngine.touch(self)
 
     def setDisconnected(self, ap_intf):
         self.rssi = 0
         self.channel = 0
         self.associatedTo = None
+        SINREngine.touch(self)
         if self in ap_intf.associatedStations:
             ap_intf.associatedStations.remove(self)
 
     def roam(self, bssid):
+        "Returns the path taken: 'ctrl_iface' or 'wpa_cli'"
+        if CtrlPool.enabled and CtrlPool.wpa(self, 'ROAM {}'.format(bssid)) == 'OK':
+            return 'ctrl_iface'
         self.wpa_cli_cmd('roam {}'.format(bssid))
+        return 'wpa_cli'
+
+    def wpa_ctrl_connect(self, ap_intf):
+        """Points the running wpa_supplicant to ap_intf through its control
+        interface; returns False when it has to be (re)started instead"""
+        if not CtrlPool.has_wpa(self):
+            return False
+        ssid = CtrlPool.wpa(self, 'GET_NETWORK 0 ssid')
+        if ssid != '"{}"'.format(ap_intf.ssid):
+            # another network, start over with a new config
+            CtrlPool.wpa(self, 'TERMINATE')
+            return False
+        for cmd in ('BSS_FLUSH 0', 'BSSID 0 {}'.format(ap_intf.mac),
+                    'REASSOCIATE'):
+            if CtrlPool.wpa(self, cmd) != 'OK':
+                return False
+        self.setConnected(ap_intf)
+        return True
+
+    def wpa_ctrl_disconnect(self, ap_intf):
+        "Disconnects keeping wpa_supplicant and its config for a later handover"
+        if CtrlPool.wpa(self, 'DISCONNECT') != 'OK':
+            return False
+        self.setDisconnected(ap_intf)
+        return True
 
     def wep_connect(self, passwd, ap_intf):
         self.iwdev_cmd('{} connect {} key d:0:{}'.format(
@@ -544,30 +664,36 @@ def iwconfig_connect(self, ap_intf):
         self.setConnected(ap_intf)
 
     def associate_infra(self, ap_intf):
-        associated = 0
+        """Returns the path the association took (ctrl_iface, wpa_cli,
+        wpa_supplicant, iwconfig, iw), None when nothing was done"""
+        path = None
         if ap_intf.ieee80211r and (not self.encrypt or 'wpa' in self.encrypt):
             if not self.associatedTo:
                 wpa_file_exists = self.check_if_wpafile_exist()
                 if wpa_file_exists:
-                    self.roam(ap_intf.mac)
+                    path = self.roam(ap_intf.mac)
                 else:
                     self.wpa(ap_intf)
+                    path = 'wpa_supplicant'
             else:
-                self.roam(ap_intf.mac)
-            associated = 1
+                path = self.roam(ap_intf.mac)
         elif not ap_intf.encrypt:
-            associated = 1
+            path = 'iwconfig'
             self.iwconfig_connect(ap_intf)
         else:
             if not self.associatedTo:
                 if 'wpa' in ap_intf.encrypt and (not self.encrypt or 'wpa' in self.encrypt):
-                    self.wpa(ap_intf)
-                    associated = 1
+                    if CtrlPool.enabled and self.wpa_ctrl_connect(ap_intf):
+                        path = 'ctrl_iface'
+                    else:
+                        self.wpa(ap_intf)
+                        path = 'wpa_supplicant'
                 elif ap_intf.encrypt == 'wep':
                     self.wep(ap_intf)
-                    associated = 1
-        if associated:
+                    path = 'iw'
+        if path:
             self.update_client_params(ap_intf)
+        return path
 
     def configureWirelessLink(self, ap_intf):
         dist = self.node.get_distance_to(ap_intf.node)
@@ -582,7 +708,7 @@ def configureWirelessLink(self, ap_intf):
                 if self not in ap_intf.associatedStations:
                     ap_intf.associatedStations.append(self)
             if not wmediumd_mode.mode == w_cst.INTERFERENCE_MODE:
-                self.rssi = self.get_rssi(ap_intf, dist)
+                self.rssi = self.get_rssi(ap_intf, dist, cached=True)
 
     def associate(self, ap_intf):
         "Associate to Access Point"
@@ -946,6 +1072,8 @@ def ap_config_file(self, cmd, intf):
         apconfname = 'mn{}_{}-wlan{}.apconf'.format(getpid(), intf.node.name, intf.id + 1)
         content = cmd + "\' > {}".format(apconfname)
         intf.cmd(content)
+        if HostapdGroup.enabled and HostapdGroup.add(intf, apconfname):
+            return
         cmd = self.get_hostapd_cmd(intf)
         try:
             intf.cmd(cmd)
@@ -968,6 +1096,129 @@ def get_hostapd_cmd(intf):
         return cmd
 
 
+class HostapdGroup(object):
+    """Runs the AP interfaces of a namespace (all root namespace APs, or
+    the wlans of an AP in its own namespace) in shared hostapd processes
+    of up to size interfaces each, instead of one process per interface.
+    Interfaces added or removed afterwards go through the global control
+    interface of the group."""
+
+    enabled = False
+    size = 0  # interfaces per process, 0 for a single process
+    pending = {}  # namespace -> [(intf, apconf)]
+    members = {}  # intf name -> (global ctrl, apconf)
+    groups = []  # (global ctrl, pidfile)
+    started = False
+
+    @staticmethod
+    def namespace(intf):
+        return intf.node.name if intf.node.inNamespace else ''
+
+    @classmethod
+    def add(cls, intf, apconf):
+        "Returns False when the interface needs its own hostapd"
+        if intf.node.params.get('hostapd_flags') or \
+                'phywlan' in intf.node.params:
+            return False
+        if not cls.started:
+            cls.pending.setdefault(cls.namespace(intf), []).append((intf, apconf))
+            return True
+        for ctrl, _ in reversed(cls.groups):
+            if ctrl.startswith(cls.ctrl_prefix(intf)):
+                phy = intf.cmd('cat /sys/class/net/{}/phy80211/name'
+                               .format(intf.name)).strip()
+                reply = CtrlPool.request(ctrl, 'ADD bss_config={}:{}'.format(
+                    phy, path.abspath(apconf)))
+                if reply == 'OK':
+                    cls.members[intf.name] = (ctrl, apconf)
+                    return True
+        return False
+
+    @classmethod
+    def remove(cls, intf):
+        if intf.name not in cls.members:
+            return False
+        ctrl, _ = cls.members.pop(intf.name)
+        CtrlPool.request(ctrl, 'REMOVE {}'.format(intf.name))
+        return True
+
+    @staticmethod
+    def ctrl_prefix(intf):
+        ns = intf.node.name if intf.node.inNamespace else 'root'
+        return '/var/run/hostapd-mn{}-{}-'.format(getpid(), ns)
+
+    @classmethod
+    def start(cls):
+        "Starts the hostapd processes of the interfaces configured so far"
+        for ifaces in cls.pending.values():
+            size = cls.size or len(ifaces)
+            for n in range(0, len(ifaces), size):
+                chunk = ifaces[n:n + size]
+                intf = chunk[0][0]
+                ctrl = '{}{}'.format(cls.ctrl_prefix(intf), n // size)
+                pidfile = '{}.pid'.format(ctrl)
+                intf.cmd('hostapd -B -g {} -P {} {}'.format(
+                    ctrl, pidfile, ' '.join(apconf for _, apconf in chunk)))
+                cls.groups.append((ctrl, pidfile))
+                for intf, apconf in chunk:
+                    cls.members[intf.name] = (ctrl, apconf)
+        if any(intf.country_code == 'US' for intf in cls.pending_intfs()):
+            sleep(0.5)
+        if any(intf.channel == 'acs_survey' or int(intf.channel) == 0
+               for intf in cls.pending_intfs()):
+            info("*** Waiting for ACS... It takes 10 seconds.\n")
+            sleep(10)
+        cls.pending = {}
+        cls.started = True
+
+    @classmethod
+    def pending_intfs(cls):
+        return [intf for ifaces in cls.pending.values() for intf, _ in ifaces]
+
+    @staticmethod
+    def processes():
+        "pids of the hostapd processes of this instance"
+        pids = []
+        tag = 'mn{}_'.format(getpid()).encode()
+        for pid in listdir('/proc'):
+            if not pid.isdigit():
+                continue
+            try:
+                with open('/proc/{}/cmdline'.format(pid), 'rb') as f:
+                    cmdline = f.read()
+            except (IOError, OSError):
+                continue
+            if cmdline.startswith(b'hostapd') and tag in cmdline:
+                pids.append(int(pid))
+        return pids
+
+    @classmethod
+    def report(cls, elapsed):
+        "Logs processes, memory and startup time of the AP layout"
+        rss = 0
+        pids = cls.processes()
+        for pid in pids:
+            try:
+                with open('/proc/{}/status'.format(pid)) as f:
+                    for line in f:
+                        if line.startswith('VmRSS:'):
+                            rss += int(line.split()[1])
+            except (IOError, OSError):
+                pass
+        log = info if cls.enabled else debug
+        log('*** hostapd: {} processes ({}), {:.1f} MiB RSS, '
+            'started in {:.2f}s\n'.format(
+                len(pids), 'grouped' if cls.enabled else 'one per interface',
+                rss / 1024.0, elapsed))
+
+    @classmethod
+    def reset(cls):
+        cls.pending = {}
+        cls.members = {}
+        cls.groups = []
+        cls.started = False
+
+
 class WirelessLink(TCIntf, IntfWireless):
     """Interface customized by tc (traffic control) utility
        Allows specification of bandwidth limits (various methods)
@@ -1121,6 +1372,7 @@ def __init__(self, node1, node2, port1=None, port2=None, **params):
             intf.freq = ap_intf.freq
             intf.txpower = ap_intf.txpower
             intf.antennaGain = ap_intf.antennaGain
+            SINREngine.touch(intf)
             node2.params['wlan'].append(intfName2)
             sleep(1)
 
@@ -1929,6 +2181,7 @@ def __init__(self, node, intf, proto_args='', **params):
         else:
             self.wmIface = DynamicIntfRef(node, intf=self.name)
             if wmediumd_mode.mode and wmediumd_mode.mode != w_cst.ERRPROB_MODE:
+                self.wmIface.sta_id = node.wmIfaces[wlan].sta_id
                 node.wmIfaces[wlan] = self.wmIface
             self.node.cmd('ip link set {} down'.format(intf))
             self.iwdev_cmd(self.set_mesh_type(intf, port))
@@ -0,0 +1,197 @@
+"""
+Counters of the emulator's hot paths (node spawns, mobility ticks,
+handovers, tc updates, wmediumd messages, telemetry samples) in the
+Prometheus text format, served with no network access: through a file
+rewritten every interval (node_exporter textfile style) and/or a UNIX
+socket that answers every connection with the current values.
+
+    nc -U /tmp/mn.sock
+    curl --unix-socket /tmp/mn.sock http://localhost/metrics
+
+The names and the matching mnexec USDT probes are listed in
+doc/metrics.md.
+"""
+
+import os
+import socket
+from threading import Thread as thread, Lock
+from time import time, sleep
+
+from mininet.log import debug, error
+
+
+class Metrics(object):
+
+    enabled = False
+    counters = {}
+    sources = {}  # name -> function returning {metric: value}
+    interval = 1.0
+    file_ = None
+    socket_ = None
+    keep_alive = False
+    __sock = None
+    __lock = Lock()
+    help = {
+        'mn_wifi_node_spawns': ('counter', 'mnexec node shells started'),
+        'mn_wifi_node_spawn_seconds': ('counter',
+                                       'time spent starting node shells'),
+        'mn_wifi_mobility_ticks': ('counter', 'Mobility.config_links passes'),
+        'mn_wifi_mobility_tick_seconds': ('counter',
+                                          'time spent in config_links'),
+        'mn_wifi_mobility_last_tick_timestamp_seconds': (
+            'gauge', 'unix time of the last config_links pass'),
+        'mn_wifi_handovers': ('counter', 'associations to an AP'),
+        'mn_wifi_disconnects': ('counter', 'disconnections from an AP'),
+        'mn_wifi_tc_updates': ('counter', 'tc qdisc commands sent'),
+        'mn_wifi_tc_skipped': ('counter',
+                               'link updates below the tc threshold'),
+        'mn_wifi_wmediumd_messages': ('counter',
+                                      'updates sent to the medium'),
+        'mn_wifi_telemetry_samples': ('counter',
+                                      'telemetry samples written'),
+        'mn_wifi_telemetry_drops': ('counter',
+                                    'telemetry samples dropped'),
+        'mn_wifi_virtual_time_speedup': (
+            'gauge', 'simulated seconds per real second so far'),
+        'mn_wifi_pool_claims': ('counter', 'warm pool claims'),
+        'mn_wifi_pool_claim_seconds': ('counter',
+                                       'time spent in warm pool claims'),
+        'mn_wifi_pool_hits': ('counter', 'claims served from the warm pool'),
+        'mn_wifi_pool_misses': ('counter',
+                                'claims served without the warm pool'),
+        'mn_wifi_pool_spare': ('gauge', 'spare resources in the warm pool'),
+        'mn_wifi_coverage_rasters': ('gauge', 'coverage rasters in memory'),
+        'mn_wifi_coverage_builds': ('gauge', 'coverage rasters computed'),
+        'mn_wifi_coverage_lookups': ('gauge', 'RSSI lookups by source'),
+        'mn_wifi_sinr_refreshes': ('counter',
+                                   'interfaces recomputed by the SINR engine'),
+    }
+
+    @classmethod
+    def inc(cls, name, value=1):
+        if not cls.enabled:
+            return
+        with cls.__lock:
+            cls.counters[name] = cls.counters.get(name, 0) + value
+
+    @classmethod
+    def observe(cls, count, seconds, start):
+        "Counts an event in count and its duration since start in seconds"
+        if not cls.enabled:
+            return
+        dur = time() - start
+        with cls.__lock:
+            cls.counters[count] = cls.counters.get(count, 0) + 1
+            cls.counters[seconds] = cls.counters.get(seconds, 0) + dur
+
+    @classmethod
+    def set(cls, name, value):
+        if cls.enabled:
+            cls.counters[name] = value
+
+    @classmethod
+    def source(cls, name, func=None):
+        "Adds (or removes, with func None) values computed at scrape time"
+        if func:
+            cls.sources[name] = func
+        else:
+            cls.sources.pop(name, None)
+
+    @classmethod
+    def render(cls):
+        with cls.__lock:
+            values = dict(cls.counters)
+        for func in list(cls.sources.values()):
+            try:
+                values.update(func())
+            except Exception as e:  # a source must not break the scrape
+                debug('metrics source failed: %s\n' % e)
+        lines = []
+        described = set()
+        for key in sorted(values):
+            base, _, labels = key.partition('{')
+            kind, text = cls.help.get(base, ('gauge', ''))
+            name = base + '_total' if kind == 'counter' else base
+            if text and base not in described:
+                described.add(base)
+                lines.append('# HELP %s %s' % (name, text))
+                lines.append('# TYPE %s %s' % (name, kind))
+            lines.append('%s%s %r' % (name, '{' + labels if labels else '',
+                                      float(values[key])))
+        return '\n'.join(lines) + '\n'
+
+    @classmethod
+    def start(cls, file_=None, socket_=None, interval=1.0):
+        if not file_ and not socket_:
+            return
+        cls.enabled = True
+        cls.keep_alive = True
+        cls.file_ = file_
+        cls.socket_ = socket_
+        cls.interval = interval
+        if file_:
+            thread(target=cls.write_file, daemon=True).start()
+        if socket_:
+            if os.path.exists(socket_):
+                os.remove(socket_)
+            cls.__sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            cls.__sock.bind(socket_)
+            cls.__sock.listen(8)
+            thread(target=cls.serve, daemon=True).start()
+
+    @classmethod
+    def write_file(cls):
+        tmp = cls.file_ + '.tmp'
+        while cls.keep_alive:
+            try:
+                with open(tmp, 'w') as f:
+                    f.write(cls.render())
+                os.replace(tmp, cls.file_)
+            except (IOError, OSError) as e:
+                error('*** Could not write metrics to %s: %s\n'
+                      % (cls.file_, e))
+                return
+            sleep(cls.interval)
+
+    @classmethod
+    def serve(cls):
+        while cls.keep_alive:
+            try:
+                conn, _ = cls.__sock.accept()
+            except OSError:
+                return
+            try:
+                # answer HTTP clients (curl --unix-socket) with a header,
+                # anything else (nc -U) with the bare text
+                conn.settimeout(0.2)
+                try:
+                    request = conn.recv(1024)
+                except socket.timeout:
+                    request = b''
+                body = cls.render().encode()
+                if request.startswith(b'GET'):
+                    body = b'HTTP/1.0 200 OK\r\nContent-Type: text/plain; ' \
+                           b'version=0.0.4\r\nContent-Length: %d\r\n\r\n' \
+                           % len(body) + body
+                conn.sendall(body)
+            except OSError:
+                pass
+            finally:
+                conn.close()
+
+    @classmethod
+    def stop(cls):
+        if not cls.enabled:
+            return
+        cls.keep_alive = False
+        cls.enabled = False
+        if cls.__sock:
+            cls.__sock.close()
+            cls.__sock = None
+            try:
+                os.remove(cls.socket_)
+            except OSError:
+                pass
+        cls.counters = {}
+        cls.sources = {}
+
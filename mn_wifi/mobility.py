@@ -13,9 +13,14 @@
 
 from mininet.log import debug
 from mn_wifi.link import mesh, adhoc, ITSLink, master
-from mn_wifi.associationControl import AssociationControl as AssCtrl
+from mn_wifi.associationControl import AssociationEngine
+from mn_wifi.metrics import Metrics
 from mn_wifi.plot import PlotGraph
-from mn_wifi.wmediumdConnector import w_cst, wmediumd_mode
+from mn_wifi.shard import ShardPool
+from mn_wifi.sinr import SINREngine
+from mn_wifi.vclock import VirtualClock
+from mn_wifi.wmediumdConnector import w_cst, w_server, wmediumd_mode
+from mn_wifi.wpactrl import CtrlPool
 
 
 class Mobility(object):
@@ -35,6 +40,7 @@ def move_factor(self, node, diff_time):
         init_pos = (node.params['initPos'])
         fin_pos = (node.params['finPos'])
         node.position = init_pos
+        SINREngine.moved(node)
         pos_x = float(fin_pos[0]) - float(init_pos[0])
         pos_y = float(fin_pos[1]) - float(init_pos[1])
         pos_z = float(fin_pos[2]) - float(init_pos[2]) if len(fin_pos) == 3 else float(0)
@@ -64,12 +70,27 @@ def calculate_diff_time(self, node, time=0):
 
     def set_pos(self, node, pos):
         node.position = pos
-        if wmediumd_mode.mode == w_cst.INTERFERENCE_MODE and self.thread_._keep_alive:
+        SINREngine.moved(node)
+        if wmediumd_mode.mode == w_cst.INTERFERENCE_MODE and \
+                self.thread_._keep_alive and not ShardPool.sends(node):
             node.set_pos_wmediumd(pos)
 
+    def set_positions(self, nodes, positions):
+        "set_pos for many nodes, with one batched wmediumd update"
+        wpos = []
+        SINREngine.moved(*nodes)
+        for node, pos in zip(nodes, positions):
+            node.position = pos
+            if wmediumd_mode.mode == w_cst.INTERFERENCE_MODE and \
+                    self.thread_._keep_alive and not ShardPool.sends(node):
+                wpos += node.get_pos_wmediumd(pos)
+        if wpos:
+            w_server.update_positions(wpos)
+
     def set_wifi_params(self):
         "Opens a thread for wifi parameters"
         if self.allAutoAssociation:
+            VirtualClock.paced = True
             thread_ = thread(name='wifiParameters', target=self.parameters)
             thread_.daemon = True
             thread_.start()
@@ -99,14 +120,24 @@ def remove_node_in_range(intf, ap_intf):
     def ap_out_of_range(self, intf, ap_intf):
         "When ap is out of range"
         if ap_intf == intf.associatedTo:
+            start = time()
+            path = None  # how the station was disconnected
             if ap_intf.encrypt and not ap_intf.ieee80211r:
                 if ap_intf.encrypt == 'wpa' and not ap_intf.ieee80211r:
-                    self.kill_wpasupprocess(intf)
-                    self.check_if_wpafile_exist(intf)
+                    if CtrlPool.enabled and intf.wpa_ctrl_disconnect(ap_intf):
+                        path = 'ctrl_iface'
+                    else:
+                        self.kill_wpasupprocess(intf)
+                        self.check_if_wpafile_exist(intf)
+                        path = 'pkill'
             elif wmediumd_mode.mode == w_cst.SNR_MODE:
                 intf.setSNRWmediumd(ap_intf, -10)
-            if not ap_intf.ieee80211r:
+            if not ap_intf.ieee80211r and intf.associatedTo:
                 intf.disconnect(ap_intf)
+                path = path or 'iw'
+                Metrics.inc('mn_wifi_disconnects')
+            if CtrlPool.measure and path:
+                CtrlPool.record('%s disconnect' % path, time() - start)
             self.remove_node_in_range(intf, ap_intf)
         elif not intf.associatedTo:
             intf.rssi = 0
@@ -114,12 +145,16 @@ def ap_out_of_range(self, intf, ap_intf):
     def ap_in_range(self, intf, ap, dist):
         for ap_intf in ap.wintfs.values():
             if isinstance(ap_intf, master):
-                rssi = intf.get_rssi(ap_intf, dist)
+                rssi = intf.get_rssi(ap_intf, dist, cached=True)
                 intf.apsInRange[ap_intf.node] = rssi
                 ap_intf.stationsInRange[intf.node] = rssi
                 if ap_intf == intf.associatedTo:
                     if intf not in ap_intf.associatedStations:
                         ap_intf.associatedStations.append(intf)
+                    if SINREngine.enabled:
+                        intf.sinr = SINREngine.sinr(intf, ap_intf)
+                        if intf.sinr is not None:
+                            intf.est_rate = SINREngine.rate(intf, intf.sinr)
                     if dist >= 0.01:
                         if intf.bgscan_module or (intf.active_scan
                                                   and intf.encrypt == 'wpa'):
@@ -144,9 +179,11 @@ def check_in_range(self, intf, ap_intf):
             return 0
         return 1
 
-    def set_handover(self, intf, aps):
+    def set_handover(self, intf, aps, dists=None):
+        if SINREngine.enabled and not intf.associatedTo:
+            aps = SINREngine.best(intf, aps)
         for ap in aps:
-            dist = intf.node.get_distance_to(ap)
+            dist = dists[ap] if dists else intf.node.get_distance_to(ap)
             for ap_wlan, ap_intf in enumerate(ap.wintfs.values()):
                 self.do_handover(intf, ap_intf)
             self.ap_in_range(intf, ap, dist)
@@ -159,14 +196,16 @@ def check_if_ap_exists(intf, ap_intf):
         return 1
 
     def do_handover(self, intf, ap_intf):
-        "Association Control: mechanisms that optimize the use of the APs"
-        changeAP = False
-        if self.ac and intf.associatedTo and ap_intf.node != intf.associatedTo:
-            changeAP = AssCtrl(intf, ap_intf, self.ac).changeAP
-        if self.check_if_ap_exists(intf, ap_intf):
-            if not intf.associatedTo or changeAP:
-                if ap_intf.node != intf.associatedTo:
-                    intf.associate_infra(ap_intf)
+        "Associates a station that is not associated yet"
+        if not intf.associatedTo and self.check_if_ap_exists(intf, ap_intf):
+            self.associate_intf(intf, ap_intf)
+
+    def associate_intf(self, intf, ap_intf):
+        start = time()
+        path = intf.associate_infra(ap_intf)
+        Metrics.inc('mn_wifi_handovers')
+        if CtrlPool.measure and path:
+            CtrlPool.record('%s associate' % path, time() - start)
 
     def parameters(self):
         "Applies channel params and handover"
@@ -183,25 +222,131 @@ def associate_interference_mode(self, intf, ap_intf):
 
         return self.check_in_range(intf, ap_intf)
 
+    def config_intf_links(self, intf):
+        aps = []
+        for ap in self.aps:
+            for ap_intf in ap.wintfs.values():
+                if not isinstance(ap_intf, adhoc) and not isinstance(ap_intf, mesh):
+                    if wmediumd_mode.mode == w_cst.INTERFERENCE_MODE:
+                        ack = self.associate_interference_mode(intf, ap_intf)
+                    else:
+                        ack = self.check_in_range(intf, ap_intf)
+                    if ack and ap not in aps:
+                        aps.append(ap)
+        self.set_handover(intf, aps)
+
+    def config_shard_links(self, nodes):
+        """Applies the in-range APs found by the shard workers; returns
+        the nodes they do not evaluate"""
+        ap_intfs = [ap_intf for ap in self.aps for ap_intf in ap.wintfs.values()
+                    if not isinstance(ap_intf, adhoc) and not isinstance(ap_intf, mesh)]
+        stations = list(dict.fromkeys(list(self.stations) + list(self.mobileNodes)))
+        index, ap_intfs, ap_nodes, near, dist = \
+            ShardPool.tick(stations, self.aps, ap_intfs)
+        col = dict((ap_intf, j) for j, ap_intf in enumerate(ap_intfs))
+        rest = []
+        full = False
+        for node in nodes:
+            row = index.get(node)
+            if row is None:
+                rest.append(node)
+                continue
+            if (near[row] >= 0).all():
+                # more APs in range than the worker keeps: evaluated here
+                full = True
+                rest.append(node)
+                continue
+            in_range = set()
+            dists = {}
+            for j, d in zip(near[row].tolist(), dist[row].tolist()):
+                if j >= 0:
+                    in_range.add(j)
+                    dists[ap_nodes[j]] = d
+            aps = [ap for ap in self.aps if ap in dists]
+            for intf in node.wintfs.values():
+                if isinstance(intf, adhoc) or isinstance(intf, mesh) or isinstance(intf, ITSLink):
+                    continue
+                if wmediumd_mode.mode == w_cst.INTERFERENCE_MODE and \
+                        (intf.bgscan_module or (intf.active_scan and 'wpa' in intf.encrypt)):
+                    self.config_intf_links(intf)
+                    continue
+                ap_intf = intf.associatedTo
+                if ap_intf in col and col[ap_intf] not in in_range:
+                    self.ap_out_of_range(intf, ap_intf)
+                if not intf.associatedTo and len(in_range) < len(col):
+                    intf.rssi = 0
+                self.set_handover(intf, aps, dists)
+        if full:
+            ShardPool.grow()
+        return rest
+
+    @staticmethod
+    def send_shard_positions(nodes):
+        wpos = [wpos for node in nodes if ShardPool.sends(node)
+                for wpos in node.get_pos_wmediumd(node.position)]
+        if wpos:
+            w_server.update_positions(wpos)
+
     def config_links(self, nodes):
+        start = time()
+        seq = VirtualClock.begin()
+        if SINREngine.enabled:
+            SINREngine.update(self.stations, self.aps)
+        if ShardPool.enabled and len(nodes) >= ShardPool.min_nodes:
+            nodes = self.config_shard_links(nodes)
+        elif ShardPool.enabled:
+            # a few nodes (one setPosition, auto association): cheaper
+            # here than a tick of every worker, which would also have
+            # sent their positions to wmediumd
+            self.send_shard_positions(nodes)
         for node in nodes:
             for intf in node.wintfs.values():
                 if isinstance(intf, adhoc) or isinstance(intf, mesh) or isinstance(intf, ITSLink):
                     pass
                 else:
-                    aps = []
-                    for ap in self.aps:
-                        for ap_intf in ap.wintfs.values():
-                            if not isinstance(ap_intf, adhoc) and not isinstance(ap_intf, mesh):
-                                if wmediumd_mode.mode == w_cst.INTERFERENCE_MODE:
-                                    ack = self.associate_interference_mode(intf, ap_intf)
-                                else:
-                                    ack = self.check_in_range(intf, ap_intf)
-                                if ack and ap not in aps:
-                                    aps.append(ap)
-                    self.set_handover(intf, aps)
+                    self.config_intf_links(intf)
+        if self.ac:
+            self.association_control(nodes)
+        if Metrics.enabled:
+            Metrics.observe('mn_wifi_mobility_ticks',
+                            'mn_wifi_mobility_tick_seconds', start)
+            Metrics.set('mn_wifi_mobility_last_tick_timestamp_seconds', time())
+        VirtualClock.end(seq)
         sleep(0.0001)
 
+    def association_control(self, nodes):
+        "Association Control: mechanisms that optimize the use of the APs"
+        ap_intfs = [ap_intf for ap in self.aps for ap_intf in ap.wintfs.values()
+                    if isinstance(ap_intf, master)]
+        intfs = [intf for node in nodes for intf in node.wintfs.values()
+                 if isinstance(intf.associatedTo, master)]
+        if not intfs or len(ap_intfs) < 2:
+            return
+        col = dict((ap_intf, n) for n, ap_intf in enumerate(ap_intfs))
+        rssi = np.full((len(intfs), len(ap_intfs)), np.nan)
+        current = np.full(len(intfs), -1, dtype=np.intp)
+        for row, intf in enumerate(intfs):
+            current[row] = col.get(intf.associatedTo, -1)
+            in_range = [n for n, ap_intf in enumerate(ap_intfs)
+                        if ap_intf.node in intf.apsInRange]
+            values = [intf.apsInRange[ap_intfs[n].node] for n in in_range]
+            if SINREngine.enabled:
+                # rank by SINR, so an AP drowned by co-channel ones loses;
+                # by RSSI when the engine does not know one of the APs, so
+                # a row never mixes dB and dBm
+                sinr = [SINREngine.sinr(intf, ap_intfs[n]) for n in in_range]
+                if None not in sinr:
+                    values = sinr
+            rssi[row, in_range] = values
+        load = np.array([len(ap_intf.associatedStations) for ap_intf in ap_intfs])
+        cap = np.array([float(ap_intf.node.params.get('max_num_sta', np.inf))
+                        for ap_intf in ap_intfs])
+        decision = AssociationEngine.decide(self.ac, rssi, current, load, cap)
+        for row in np.flatnonzero(decision != current):
+            intf, ap_intf = intfs[row], ap_intfs[decision[row]]
+            intf.disconnect_pexec(intf.associatedTo)
+            self.associate_intf(intf, ap_intf)
+
     def set_mob_started(self):
         self.mobStarted = True
 
@@ -234,12 +379,18 @@ def config_mobility(self, *args, **kwargs):
 class ConfigMobLinks(Mobility):
 
     def __init__(self, node=None):
+        ":param node: node or list of nodes that moved, None for all"
         self.config_mob_links(node)
 
     def config_mob_links(self, node):
         "Applies channel params and handover"
         from mn_wifi.node import AP
-        if node:
+        if isinstance(node, list):
+            if any(isinstance(n, AP) or n in self.aps for n in node):
+                nodes = self.stations
+            else:
+                nodes = node
+        elif node:
             if isinstance(node, AP) or node in self.aps:
                 nodes = self.stations
             else:
@@ -378,7 +529,7 @@ def start_mob_mod(self, mob, nodes, draw):
             if draw:
                 PlotGraph.pause()
             else:
-                sleep(0.5)
+                VirtualClock.sleep(0.5)
             while self.pause_simulation:
                 pass
 
@@ -391,6 +542,8 @@ def __init__(self, **kwargs):
         super().__init__(**kwargs)
 
     def get_most_accurate_time_func(self):
+        if VirtualClock.enabled:
+            return VirtualClock.now, 1
         time_func = time
         time_multiple = 1
         import_fail = False
@@ -440,7 +593,7 @@ def start_mob_mod(self, mob, nodes, draw):
             else:
                 while self.time_func() < next_tick_time:
                     # If time() has been exceeded since the while loop check, don't sleep
-                    sleep(max((next_tick_time - self.time_func()) / self.time_multiple, 0))
+                    VirtualClock.sleep(max((next_tick_time - self.time_func()) / self.time_multiple, 0))
             next_tick_time = next_tick_time + self.tick_time
 
 
@@ -467,6 +620,7 @@ def configure(self, stations, aps, stat_nodes, mob_nodes,
         self.mobileNodes = mob_nodes
         nodes = stations + aps
 
+        SINREngine.moved(*mob_nodes)
         for node in mob_nodes:
             node.position = node.params['initPos']
             node.matrix_id = 0
@@ -3,10 +3,11 @@
 
 from os import system as sh, path, getpid, devnull
 from re import search
-from time import sleep
 from subprocess import check_output as co, PIPE, Popen, call, CalledProcessError
 from logging import basicConfig, exception, DEBUG
 from mininet.log import debug, info, error
+from mn_wifi.netlink import PhyIndex
+from mn_wifi.profiler import StartupProfiler
 
 
 class Mac80211Hwsim(object):
@@ -51,14 +52,17 @@ def start(self, nodes, nradios, alt_module, rec_rssi, **params):
         """
         if rec_rssi:
             self.add_phy_id(nodes)
+        if PhyIndex.enabled:
+            PhyIndex.watch(None)
 
         cmd = 'iw dev 2>&1 | grep Interface | awk \'{print $2}\''
         Mac80211Hwsim.phyWlans = self.get_intf_list(cmd)  # gets physical wlan(s)
         self.load_module(nradios, nodes, alt_module, **params)  # loads wifi module
         phys = self.get_intf_list(self.get_hwsim_list())  # gets virtual and phy interfaces
         wlan_list = self.get_wlan_list(phys, **params)  # gets wlan list
-        for node in nodes:
-            self.assign_iface(node, phys, wlan_list, **params)
+        with StartupProfiler.span('assign_iface'):
+            for node in nodes:
+                self.assign_iface(node, phys, wlan_list, **params)
 
     @staticmethod
     def create_static_radios(nradios, alt_module, modprobe):
@@ -78,10 +82,11 @@ def load_module(self, nradios, nodes, alt_module, **params):
         debug('Loading %s virtual wifi interfaces\n' % nradios)
         if not self.externally_managed:
             modprobe = 'modprobe mac80211_hwsim radios'
-            if alt_module:
-                output = sh('insmod {} radios=0 >/dev/null 2>&1'.format(alt_module))
-            else:
-                output = sh('{}=0 >/dev/null 2>&1'.format(modprobe))
+            with StartupProfiler.cmd('insmod' if alt_module else modprobe):
+                if alt_module:
+                    output = sh('insmod {} radios=0 >/dev/null 2>&1'.format(alt_module))
+                else:
+                    output = sh('{}=0 >/dev/null 2>&1'.format(modprobe))
 
             if output == 0:
                 self.__create_hwsim_mgmt_devices(nradios, nodes, **params)
@@ -92,8 +97,14 @@ def load_module(self, nradios, nodes, alt_module, **params):
             self.__create_hwsim_mgmt_devices(nradios, nodes, **params)
 
     def configNodeOnTheFly(self, node):
-        for _ in range(len(node.params['wlan'])):
-            self.create_hwsim(len(Mac80211Hwsim.hwsim_ids))
+        phys = [self.create_hwsim(len(Mac80211Hwsim.hwsim_ids))
+                for _ in range(len(node.params['wlan']))]
+        if PhyIndex.enabled and None not in phys:
+            # the new radios are known by name: no rescan of debugfs
+            wlan_list = [PhyIndex.wlan_of(phy) for phy in phys]
+            if None not in wlan_list:
+                self.assign_iface(node, phys, wlan_list)
+                return
         self.configPhys(node)
 
     def get_phys(self):
@@ -101,7 +112,10 @@ def get_phys(self):
         num = 0
         numokay = False
         self.prefix = ""
-        phys = co(self.get_hwsim_list(), shell=True).decode('utf-8').split("\n")
+        if PhyIndex.enabled:
+            phys = PhyIndex.phy_names()
+        else:
+            phys = co(self.get_hwsim_list(), shell=True).decode('utf-8').split("\n")
 
         while not numokay:
             self.prefix = "mn%05dp%02ds" % (getpid(), num)  # Add PID to mn-devicenames
@@ -114,19 +128,23 @@ def get_phys(self):
         return num
 
     def create_hwsim(self, n):
+        "Creates a radio; returns its phy name, None on failure"
         self.get_phys()
-        p = Popen(["hwsim_mgmt", "-c", "-n", self.prefix + ("%02d" % n)],
-                  stdin=PIPE, stdout=PIPE, stderr=PIPE, bufsize=-1)
-        output, err_out = p.communicate()
+        phy = self.prefix + ("%02d" % n)
+        cmd = ["hwsim_mgmt", "-c", "-n", phy]
+        with StartupProfiler.cmd(cmd):
+            p = Popen(cmd, stdin=PIPE, stdout=PIPE, stderr=PIPE, bufsize=-1)
+            output, err_out = p.communicate()
         if p.returncode == 0:
             m = search(r"ID (\d+)", output.decode())
             debug("Created mac80211_hwsim device with ID %s\n" % m.group(1))
             Mac80211Hwsim.hwsim_ids.append(m.group(1))
-        else:
-            error("\nError on creating mac80211_hwsim device "
-                  "with name {}".format(self.prefix + ("%02d" % n)))
-            error("\nOutput: {}".format(output))
-            error("\nError: {}".format(err_out))
+            return phy
+        error("\nError on creating mac80211_hwsim device "
+              "with name {}".format(phy))
+        error("\nOutput: {}".format(output))
+        error("\nError: {}".format(err_out))
+        return None
 
     def __create_hwsim_mgmt_devices(self, nradios, nodes, **params):
         if 'docker' in params:
@@ -143,7 +161,8 @@ def __create_hwsim_mgmt_devices(self, nradios, nodes, **params):
     @staticmethod
     def get_intf_list(cmd):
         'Gets all phys after starting the wireless module'
-        phy = co(cmd, shell=True).decode('utf-8').split("\n")
+        with StartupProfiler.cmd(cmd):
+            phy = co(cmd, shell=True).decode('utf-8').split("\n")
         phy.pop()
         phy.sort(key=len, reverse=False)
         return phy
@@ -227,18 +246,24 @@ def assign_iface(self, node, phys, wlan_list, id=0, **params):
                 rc = call(['which', 'nmcli'], stdout=f)
                 if pids and rc == 0:
                         sh('nmcli device set {} managed no'.format(wlan_list[0]))
-                        sleep(0.1)
+                        StartupProfiler.sleep(0.1, 'nmcli')
                 if isinstance(node, AP) and not node.inNamespace:
                     self.rename(node, wlan_list[0], node.params['wlan'][wlan])
                 else:
                     if 'docker' not in params:
-                        rfkill = co(
-                            'rfkill list | grep %s | awk \'{print $1}\''
-                            '| tr -d ":"' % phys[0],
-                            shell=True).decode('utf-8').split('\n')
+                        with StartupProfiler.cmd('rfkill list', node.name):
+                            rfkill = co(
+                                'rfkill list | grep %s | awk \'{print $1}\''
+                                '| tr -d ":"' % phys[0],
+                                shell=True).decode('utf-8').split('\n')
                         debug('rfkill unblock {}\n'.format(rfkill[0]))
-                        sh('rfkill unblock {}'.format(rfkill[0]))
-                        sh('iw phy {} set netns {}'.format(phys[id], node.pid))
+                        with StartupProfiler.cmd('rfkill unblock', node.name):
+                            sh('rfkill unblock {}'.format(rfkill[0]))
+                        if PhyIndex.enabled:
+                            PhyIndex.watch(node)
+                        cmd = 'iw phy {} set netns {}'.format(phys[id], node.pid)
+                        with StartupProfiler.cmd(cmd, node.name):
+                            sh(cmd)
                     node.cmd('ip link set {} down'.format(wlan_list[0]))
                     node.cmd('ip link set {} name {}'.format(wlan_list[0], node.params['wlan'][wlan]))
                 wlan_list.pop(0)
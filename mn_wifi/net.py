@@ -3,14 +3,14 @@
     author: Ramon Fontes (ramonrf@dca.fee.unicamp.br)
 """
 
-import socket
 import requests
 import math
+import numpy as np
 
+from datetime import timedelta
 from itertools import chain, groupby
 from threading import Thread as thread
-from time import sleep
-from datetime import datetime, timezone
+from time import sleep, time
 from sys import exit
 
 from FlightRadar24 import FlightRadar24API
@@ -25,19 +25,33 @@
                           waitListening, BaseString, fmtBps)
 from six import string_types
 
+from mn_wifi.capture import Capture
+from mn_wifi.checkpoint import Checkpoint
 from mn_wifi.clean import Cleanup as CleanupWifi
+from mn_wifi.constellation import Constellation
+from mn_wifi.coverage import CoverageRaster
+from mn_wifi.control import ControlServer
 from mn_wifi.aviation import aviationProtocol
 from mn_wifi.energy import Energy, EnergyMonitor
 from mn_wifi.link import IntfWireless, wmediumd, _4address, HostapdConfig, \
     WirelessLink, TCWirelessLink, ITSLink, WifiDirectLink, adhoc, mesh, \
     master, managed, physicalMesh, PhysicalWifiDirectLink, _4addrClient, \
-    _4addrAP, phyAP
+    _4addrAP, phyAP, HostapdGroup
 from mn_wifi.mobility import Tracked as TrackedMob, model as MobModel, \
     Mobility as mob, ConfigMobility, ConfigMobLinks, TimedModel
 from mn_wifi.module import Mac80211Hwsim
+from mn_wifi.netlink import PhyIndex
+from mn_wifi.wpactrl import CtrlPool
 from mn_wifi.node import AP, Station, Car, OVSKernelAP, physicalAP, Aircraft, Satellite
 from mn_wifi.plot import Plot2D, Plot3D, PlotGraph
+from mn_wifi.pool import WarmPool
+from mn_wifi.metrics import Metrics
+from mn_wifi.profiler import StartupProfiler
 from mn_wifi.propagationModels import PropagationModel as ppm
+from mn_wifi.render import Renderer
+from mn_wifi.shard import ShardPool
+from mn_wifi.sinr import SINREngine
+from mn_wifi.vclock import VirtualClock
 from mn_wifi.sixLoWPAN.link import LowPANLink, LoWPAN, wmediumd_802154
 from mn_wifi.sixLoWPAN.net import Mininet_IoT
 from mn_wifi.sixLoWPAN.node import OVSSensor, LowPANNode
@@ -46,7 +60,8 @@
 from mn_wifi.btvirt.node import BTNode
 from mn_wifi.telemetry import parseData, telemetry as run_telemetry
 from mn_wifi.vanet import vanet
-from mn_wifi.wmediumdConnector import error_prob, snr, interference
+from mn_wifi.wmediumdConnector import error_prob, snr, interference, \
+    w_shm, WStarter, w_server, w_cst, wmediumd_mode as w_mode
 from mn_wifi.wwan.link import WWANLink
 from mn_wifi.wwan.net import Mininet_WWAN
 from mn_wifi.btvirt.net import Mininet_btvirt
@@ -68,7 +83,13 @@ def __init__(self, accessPoint=OVSKernelAP, station=Station, aircraft=Aircraft,
                  client_isolation=False, plot=False, plot3d=False, docker=False,
                  container='mininet-wifi', ssh_user='alpha', rec_rssi=False,
                  wwan_module='wwan_hwsim', json_file=None, ac_method=None,
-                 btdevice=BTNode, **kwargs):
+                 btdevice=BTNode, wmediumd_shm=False,
+                 wmediumd_binary_config=False, phy_index=False,
+                 wpa_ctrl=False, handover_stats=False, hostapd_groups=None,
+                 render_process=False, render_fps=20, startup_profile=None,
+                 metrics_file=None, metrics_socket=None, metrics_interval=1,
+                 shards=0, fast_forward=False, idle_pps=20, warm_pool=0,
+                 coverage_res=0, sinr=False, **kwargs):
         """Create Mininet object.
 
            accessPoint: default Access Point class
@@ -105,7 +126,43 @@ def __init__(self, accessPoint=OVSKernelAP, station=Station, aircraft=Aircraft,
            wwan_module: default wwan module
            rec_rssi: sends rssi to mac80211_hwsim by using hwsim_mgmt
            json_file: json file dir - useful for P4
-           ac_method: association control method"""
+           ac_method: association control method
+           wmediumd_shm: share node state with wmediumd through a
+                         memory-mapped table instead of socket updates
+           wmediumd_binary_config: start wmediumd with the compact binary
+                                   config instead of the libconfig one
+           phy_index: track phys and wlans of every namespace through
+                      netlink events instead of rescanning sysfs
+           wpa_ctrl: hand stations over through persistent wpa_supplicant
+                     control interface sessions
+           handover_stats: report handover latency histograms on stop,
+                           per path taken (ctrl_iface, wpa_supplicant,
+                           wpa_cli, iwconfig, iw, pkill)
+           hostapd_groups: run the AP interfaces of a namespace in shared
+                           hostapd processes of up to this many
+                           interfaces (0 for one process)
+           render_process: draw the graph in a separate process fed by
+                           shared memory snapshots
+           render_fps: frame rate cap of the render process
+           startup_profile: file where start() exports the timeline of
+                            the startup phases and external commands
+           metrics_file: file rewritten with the Prometheus metrics
+           metrics_socket: UNIX socket serving the Prometheus metrics
+           metrics_interval: seconds between metrics_file rewrites
+           shards: evaluate the ranges of the stations in this many worker
+                   processes, one vertical strip of the plane each
+           fast_forward: run the mobility loops on a virtual clock that
+                         skips ahead while the wireless network is idle
+           idle_pps: wireless packets per second below which the
+                     network counts as idle
+           warm_pool: namespace shells and radios kept ready for nodes
+                      added after start()
+           coverage_res: resolution (m) of the precomputed RSSI rasters
+                         of static APs, 0 to evaluate the propagation
+                         model on every lookup
+           sinr: keep co-channel SINR between stations and APs and use
+                 it for the AP choice, association control and rate
+                 estimates"""
         self.station = station
         self.aircraft = aircraft
         self.satellite = satellite
@@ -132,6 +189,8 @@ def __init__(self, accessPoint=OVSKernelAP, station=Station, aircraft=Aircraft,
         self.autoAssociation = autoAssociation  # does not include mobility
         self.allAutoAssociation = allAutoAssociation  # includes mobility
         self.draw = False
+        self.control = None
+        self.captures = []
         self.isReplaying = False
         self.reverse = False
         self.alt_module = None
@@ -189,6 +248,25 @@ def __init__(self, accessPoint=OVSKernelAP, station=Station, aircraft=Aircraft,
         self.initial_mediums = []
         self.isEnergyMonitor = False
         self.energyMonitorKwargs = {}
+        w_shm.enabled = wmediumd_shm
+        WStarter.binary_config = wmediumd_binary_config
+        PhyIndex.enabled = phy_index
+        CtrlPool.enabled = wpa_ctrl
+        CtrlPool.measure = handover_stats
+        HostapdGroup.enabled = hostapd_groups is not None
+        HostapdGroup.size = hostapd_groups or 0
+        Renderer.enabled = render_process
+        Renderer.fps = render_fps
+        if startup_profile:
+            StartupProfiler.start(startup_profile)
+        Metrics.start(metrics_file, metrics_socket, metrics_interval)
+        ShardPool.enabled = shards > 0
+        ShardPool.count = shards or 1
+        VirtualClock.enabled = fast_forward
+        VirtualClock.idle_pps = idle_pps
+        WarmPool.size = warm_pool
+        CoverageRaster.start(coverage_res)
+        SINREngine.enabled = sinr
 
         if autoSetPositions and link == wmediumd:
             self.wmediumd_mode = interference
@@ -208,87 +286,138 @@ def __init__(self, accessPoint=OVSKernelAP, station=Station, aircraft=Aircraft,
         Mininet_btvirt.__init__(self, btdevice=btdevice)
         Mininet.__init__(self, link=link, **kwargs)
 
-    def socketServer(self, **kwargs):
-        thread(target=self.start_socket, kwargs=kwargs).start()
-
-    def start_socket(self, ip='127.0.0.1', port=12345):
-        CleanupWifi.socket_port = port
-
-        if ':' in ip:
-            s = socket.socket(socket.AF_INET6, socket.SOCK_STREAM, 0)
-        else:
-            s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-        s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
-        s.bind((ip, port))
-        s.listen(1)
-
-        while True:
-            conn, addr = s.accept()
-            try:
-                thread(target=self.get_socket_data, args=(conn, addr)).start()
-            except:
-                info("Thread did not start.\n")
+    def setPositions(self, positions):
+        """Moves many nodes at once: one batched wmediumd update, one
+        range/handover pass and at most one redraw
+        :param positions: dict of node (or node name) to (x, y, z) or 'x,y,z'"""
+        nodes = [node if not isinstance(node, str) else self.getNodeByName(node)
+                 for node in positions]
+        buf = np.array([pos.split(',') if isinstance(pos, str) else pos
+                        for pos in positions.values()], dtype=float)
+        if buf.shape[1] == 2:
+            buf = np.hstack([buf, np.zeros((len(buf), 1))])
+        wpos = []
+        SINREngine.moved(*nodes)
+        for node, pos in zip(nodes, buf.tolist()):
+            node.position = pos
+            if w_mode.mode == w_cst.INTERFERENCE_MODE and \
+                    not ShardPool.sends(node):
+                wpos += node.get_pos_wmediumd(pos)
+        if wpos:
+            w_server.update_positions(wpos)
+        if self.draw:
+            for node in nodes:
+                node.update_graph()
+            PlotGraph.pause()
+        ConfigMobLinks(nodes)
+
+    def checkpoint(self, filename):
+        """Saves positions, radio settings, associations and tc parameters
+        of the wireless nodes (see mn_wifi/checkpoint.py)"""
+        Checkpoint.capture(self).save(filename)
+
+    def restore(self, filename, prune=False):
+        """Brings the running topology back to a checkpoint, applying only
+        what differs; returns the number of changes per kind
+        prune: also delete the stations and cars added since"""
+        return Checkpoint.load(filename).restore(self, prune=prune)
+
+    def resident(self, filename, ip='127.0.0.1', port=12345):
+        """Saves a checkpoint and keeps the topology loaded until Ctrl-C:
+        later runs restore it through the control API (Checkpoint.attach)
+        instead of building it again"""
+        self.checkpoint(filename)
+        if not self.control:
+            self.socketServer(ip=ip, port=port)
+        info('*** Topology kept loaded on %s:%d, runs restore %s with '
+             'Checkpoint.attach; Ctrl-C to stop\n' % (ip, port, filename))
+        try:
+            while True:
+                sleep(1)
+        except KeyboardInterrupt:
+            pass
+
+    def capture(self, filename, nodes=None, hwsim0=False, **kwargs):
+        """Captures the wireless interfaces of nodes (all wireless nodes by
+        default), plus hwsim0 if asked, into one pcapng file through a
+        single mncap process; stopped with the network
+        :param kwargs: filter, snaplen, block_kb, blocks (see Capture)"""
+        nodes = [node if not isinstance(node, str) else self.getNodeByName(node)
+                 for node in nodes or Checkpoint.wireless_nodes(self)]
+        intfs = [intf for node in nodes for intf in node.wintfs.values()]
+        if hwsim0:
+            intfs.append('hwsim0')
+        cap = Capture(filename, intfs, **kwargs).start()
+        self.captures.append(cap)
+        return cap
 
-    def get_socket_data(self, conn, addr):
-        while True:
-            try:
-                cmd = conn.recv(1024).decode('utf-8')
-                pos = None
-                if 'setPosition' in cmd:
-                    pos = cmd.split('("')[1].split(')"')[0][:-2]
-                data = cmd.split('.')
-                if data[0] == 'set':
-                    node = self.getNodeByName(data[1])
-                    if len(data) < 3:
-                        data = 'usage: set.node.method()'
+    def socketServer(self, **kwargs):
+        """Serves the control API on ip:port (binary frames or the text
+        commands of examples/socket_client.py) from one event loop"""
+        self.control = ControlServer(self, **kwargs)
+        CleanupWifi.socket_port = self.control.sock.getsockname()[1]
+        thread_ = thread(target=self.control.serve)
+        thread_.daemon = True
+        thread_.start()
+
+    def socket_command(self, cmd):
+        "Runs a text command of the control API and returns the reply"
+        try:
+            pos = None
+            if 'setPosition' in cmd:
+                pos = cmd.split('("')[1].split(')"')[0][:-2]
+            data = cmd.split('.')
+            if data[0] == 'set':
+                node = self.getNodeByName(data[1])
+                if len(data) < 3:
+                    data = 'usage: set.node.method()'
+                else:
+                    if data[2] == 'sumo':
+                        mod = __import__('mn_wifi.sumo.function', fromlist=[data[3]])
+                        method_to_call = getattr(mod, data[3])
+                        node = self.getNodeByName(data[1])
+                        node.sumo = method_to_call
+                        node.sumoargs = str(data[4])
+                        data = 'command accepted!'
                     else:
-                        if data[2] == 'sumo':
-                            mod = __import__('mn_wifi.sumo.function', fromlist=[data[3]])
-                            method_to_call = getattr(mod, data[3])
-                            node = self.getNodeByName(data[1])
-                            node.sumo = method_to_call
-                            node.sumoargs = str(data[4])
-                            data = 'command accepted!'
-                        else:
-                            attr = data[2].split('(')
-                            if hasattr(node, attr[0]):
-                                method_to_call = getattr(node, attr[0])
-                                if 'intf' in attr[1]:
-                                    val = attr[1].split(', intf=')
-                                    intf = val[1][:-1]
-                                    val = val[0]
-                                    method_to_call(val, intf=intf)
-                                else:
-                                    val = pos if pos else attr[1].split(')')[0]
-                                    method_to_call(val.replace('"', '').replace("'", ""))
-                                    data = 'command accepted!'
+                        attr = data[2].split('(')
+                        if hasattr(node, attr[0]):
+                            method_to_call = getattr(node, attr[0])
+                            if 'intf' in attr[1]:
+                                val = attr[1].split(', intf=')
+                                intf = val[1][:-1]
+                                val = val[0]
+                                method_to_call(val, intf=intf)
                             else:
-                                data = 'unrecognized method!'
-                elif data[0] == 'get':
-                    node = self.getNodeByName(data[1])
-                    if len(data) < 3:
-                        data = 'usage: get.node.attr'
-                    else:
-                        if 'wintfs' in data[2]:
-                            i = int(data[2][7:-1])
-                            wintfs = getattr(node, 'wintfs')[i]
-                            data = getattr(wintfs, data[3])
+                                val = pos if pos else attr[1].split(')')[0]
+                                method_to_call(val.replace('"', '').replace("'", ""))
+                                data = 'command accepted!'
                         else:
-                            data = getattr(node, data[2])
+                            data = 'unrecognized method!'
+            elif data[0] == 'get':
+                node = self.getNodeByName(data[1])
+                if len(data) < 3:
+                    data = 'usage: get.node.attr'
                 else:
-                    try:
-                        cmd = ''
-                        for d in range(1, len(data)):
-                            cmd = cmd + data[d] + ' '
-                        node = self.getNodeByName(data[0])
-                        node.pexec(cmd)
-                        data = 'command accepted!'
-                    except:
-                        data = 'unrecognized option {}:'.format(data[0])
-                conn.send(str(data).encode('utf-8'))
-                break
-            except:
-                conn.close()
+                    if 'wintfs' in data[2]:
+                        i = int(data[2][7:-1])
+                        wintfs = getattr(node, 'wintfs')[i]
+                        data = getattr(wintfs, data[3])
+                    else:
+                        data = getattr(node, data[2])
+            else:
+                try:
+                    cmd = ''
+                    for d in range(1, len(data)):
+                        cmd = cmd + data[d] + ' '
+                    node = self.getNodeByName(data[0])
+                    node.pexec(cmd)
+                    data = 'command accepted!'
+                except:
+                    data = 'unrecognized option {}:'.format(data[0])
+        except Exception as e:
+            data = 'command failed: {}'.format(e)
+        return data
 
     def waitConnected(self, timeout=None, delay=.5):
         """wait for each switch to connect to a controller,
@@ -310,7 +439,7 @@ def waitConnected(self, timeout=None, delay=.5):
                 return True
             if timeout is not None and time > timeout:
                 break
-            sleep(delay)
+            StartupProfiler.sleep(delay, 'waitConnected')
             time += delay
         warn('Timed out after {} seconds\n'.format(time))
         for switch in remaining:
@@ -334,6 +463,7 @@ def delNode(self, node, nodes=None):
                          (self.aps if node in self.aps else
                           (self.switches if node in self.switches else
                            (self.controllers if node in self.controllers else []))))))))
+        SINREngine.forget(node)
         node.stop(deleteIntfs=True)
         node.terminate()
         nodes.remove(node)
@@ -436,11 +566,17 @@ def init_FlightRadar24API(self, fr_api, bounds, protocol):
                         aviationProtocol.load(airCraft, flight, protocol)
             sleep(compute_interval)
 
-    def configureSatellites(self, tle_file, start_time=None):
+    def configureSatellites(self, tle_file, start_time=None, speedup=1.0,
+                            interval=1):
+        """Moves the satellites along their orbits
+        :param tle_file: TLE file with the catnr of every satellite
+        :param start_time: simulated time to start from, default now
+        :param speedup: simulated seconds per wall clock second
+        :param interval: wall clock seconds between position updates"""
         mob.thread_ = thread(
             name='skyfield',
-            target=self.init_skyfield,
-            args=(tle_file, start_time)
+            target=self.propagate_satellites,
+            args=(tle_file, start_time, speedup, interval)
         )
         mob.thread_.daemon = True
         mob.thread_._keep_alive = True
@@ -458,53 +594,25 @@ def fetch_tle(self, url):
             return line1, line2, name
         raise ValueError("Invalid TLE")
 
-    def init_skyfield(self, tle_file, start_time):
-        from skyfield.api import load, wgs84, utc
-
-        ts = load.timescale()
-        compute_interval = 1
-        sats = load.tle_file(tle_file)
-
-        for satellite in self.satellites:
-            satellite.catnr = satellite.params['catnr']
-            satellite.sat = next((s for s in sats if s.model.satnum == satellite.catnr), None)
-
-        if start_time:
-            start_sim_time = start_time
-            real_start = datetime.now(timezone.utc)
+    def propagate_satellites(self, tle_file, start_time, speedup, interval):
+        sats = Constellation(tle_file, [sat.params['catnr'] for sat in self.satellites])
+        if sats.sats is None:
+            return
+        start_sim_time = start_time or Constellation.now()
+        real_start = VirtualClock.now()
 
         while mob.thread_._keep_alive:
-            if start_time:
-                now_real = datetime.now(timezone.utc)
-                elapsed = now_real - real_start
-                sim_time = start_sim_time + elapsed
-                time = ts.utc(sim_time)
-            else:
-                time = ts.utc(datetime.now(utc))
-            try:
-                for satellite in self.satellites:
-                    try:
-                        if satellite.sat is None:
-                            print(f"Error: Satellite {satellite.catnr} not found!")
-                            exit()
-                        ts = load.timescale()
-                        geocentric = satellite.sat.at(time)
-                        velocity = geocentric.velocity.km_per_s
-                        speed = (velocity[0] ** 2 + velocity[1] ** 2 + velocity[2] ** 2) ** 0.5 * 3600
-                        satellite.speed = speed
-                        subpoint = wgs84.subpoint(geocentric)
-                        lat = subpoint.latitude.degrees
-                        lon = subpoint.longitude.degrees
-                        alt = subpoint.elevation.km
-                        if hasattr(satellite, 'circle'):
-                            dx, dy = self.deg_to_meters(lat, lon)
-                            satellite.setPosition(f"{dx},{dy},{alt:.2f}")
-                    except Exception as e:
-                        print(f"Error with {satellite.name}: {e}")
-            except Exception as e:
-                print("Error:", e)
-
-            sleep(compute_interval)
+            sim_time = start_sim_time + timedelta(
+                seconds=(VirtualClock.now() - real_start) * speedup)
+            dx, dy, alt, speed, ok = sats.propagate(sim_time)
+            positions = {}
+            for satellite, i in zip(self.satellites, sats.index):
+                if i is not None and ok[i]:
+                    satellite.speed = speed[i]
+                    positions[satellite] = dx[i], dy[i], round(alt[i], 2)
+            if positions:
+                self.setPositions(positions)
+            VirtualClock.sleep(interval)
 
     def addWlans(self, node):
         node.params['wlan'] = []
@@ -518,8 +626,12 @@ def addWlans(self, node):
 
         # creates hwsim interfaces on the fly
         if Mac80211Hwsim.hwsim_ids:
-            Mac80211Hwsim(node=node, on_the_fly=True)
+            if WarmPool.running():
+                WarmPool.claim_radios(node)
+            else:
+                Mac80211Hwsim(node=node, on_the_fly=True)
             self.config_runtime_node(node)
+            SINREngine.moved(node)
 
     def addStation(self, name, cls=None, **params):
         """Add Station.
@@ -1008,6 +1120,10 @@ def staticArp(self):
 
     def build(self):
         "Build mininet-wifi."
+        with StartupProfiler.span('build'):
+            self.build_()
+
+    def build_(self):
         if self.topo:
             self.buildFromWirelessTopo(self.topo)
             if self.init_plot or self.init_Plot3D:
@@ -1037,18 +1153,22 @@ def build(self):
             self.configureControlNetwork()
 
         debug('*** Configuring nodes\n')
-        self.configHosts()
+        with StartupProfiler.span('configHosts'):
+            self.configHosts()
         if self.xterms:
             self.startTerms()
         if self.autoStaticArp:
-            self.staticArp()
+            with StartupProfiler.span('staticArp'):
+                self.staticArp()
 
         if not self.mob_check:
-            self.check_if_mob()
+            with StartupProfiler.span('check_if_mob'):
+                self.check_if_mob()
 
         if self.allAutoAssociation:
             if self.autoAssociation and not self.configWiFiDirect:
-                self.auto_association()
+                with StartupProfiler.span('auto_association'):
+                    self.auto_association()
 
         self.built = True
 
@@ -1078,31 +1198,45 @@ def start(self):
         info('*** Starting controller(s)\n')
         for controller in self.controllers:
             info(controller.name + ' ')
-            controller.start()
+            with StartupProfiler.span('controller', node=controller.name):
+                controller.start()
         if self.controllers:
             info('\n')
 
         info('*** Starting L2 nodes\n')
         nodesL2 = self.switches + self.aps + self.apsensors
-        for nodeL2 in nodesL2:
-            info(nodeL2.name + ' ')
-            nodeL2.start(self.controllers)
+        with StartupProfiler.span('start L2 nodes'):
+            for nodeL2 in nodesL2:
+                info(nodeL2.name + ' ')
+                nodeL2.start(self.controllers)
 
         started = {}
         for swclass, switches in groupby(
                 sorted(nodesL2, key=lambda x: str(type(x))), type):
             switches = tuple(switches)
             if hasattr(swclass, 'batchStartup'):
-                success = swclass.batchStartup(switches)
+                with StartupProfiler.span('batchStartup',
+                                          cls=swclass.__name__):
+                    success = swclass.batchStartup(switches)
                 started.update({s: s for s in success})
         if nodesL2:
             info('\n')
         if self.waitConn:
-            self.waitConnected()
+            with StartupProfiler.span('waitConnected'):
+                self.waitConnected()
+        StartupProfiler.export()
+        VirtualClock.start(self.stations + self.aps + self.cars +
+                           self.aircrafts + self.satellites)
+        WarmPool.start(radios=bool(Mac80211Hwsim.hwsim_ids) and
+                       not self.docker)
 
     def stop(self):
         'Stop Mininet-WiFi'
         self.stop_graph_params()
+        if self.control:
+            self.control.stop()
+        for cap in self.captures:
+            cap.stop()
         info('*** Stopping %i controllers\n' % len(self.controllers))
         for controller in self.controllers:
             info(controller.name + ' ')
@@ -1139,6 +1273,7 @@ def stop(self):
             node.terminate()
         info('\n')
         self.closeMininetWiFi()
+        Metrics.stop()
         info('\n*** Done\n')
 
     def ping(self, hosts=None, timeout=None):
@@ -1634,6 +1769,10 @@ def configureWifiNodes(self):
 
     def configureNodes(self):
         "Configure WiFi Nodes"
+        with StartupProfiler.span('configureNodes'):
+            self.configure_nodes()
+
+    def configure_nodes(self):
         params = {}
         if self.docker:
             params['docker'] = self.docker
@@ -1643,8 +1782,9 @@ def configureNodes(self):
 
         nodes, nradios = self.count_ifaces()
         if nodes:
-            Mac80211Hwsim(nodes=nodes, nradios=nradios,
-                          alt_module=self.alt_module, **params)
+            with StartupProfiler.span('Mac80211Hwsim', radios=nradios):
+                Mac80211Hwsim(nodes=nodes, nradios=nradios,
+                              alt_module=self.alt_module, **params)
 
         if self.ifb: Mac80211Hwsim.load_ifb(nradios)
 
@@ -1666,43 +1806,53 @@ def configureNodes(self):
             self.configureWWANLink()
 
         nodes = self.stations + self.cars + self.aircrafts + self.satellites
-        for node in nodes:
-            self.configNode(node)
-        self.createVirtualIfaces(self.stations)
-
-        for ap in self.aps:
-            for wlan in range(len(ap.params['wlan'])):
-                self.configMasterIntf(ap, wlan)
-                intf = ap.wintfs[wlan]
-                if not intf.mac:
-                    intf.mac = intf.getMAC()
-                intf.setMAC(intf.mac)
-            self.configIFB(ap)
+        with StartupProfiler.span('configNode'):
+            for node in nodes:
+                self.configNode(node)
+            self.createVirtualIfaces(self.stations)
+
+        with StartupProfiler.span('configMasterIntf'):
+            for ap in self.aps:
+                for wlan in range(len(ap.params['wlan'])):
+                    self.configMasterIntf(ap, wlan)
+                    intf = ap.wintfs[wlan]
+                    if not intf.mac:
+                        intf.mac = intf.getMAC()
+                    intf.setMAC(intf.mac)
+                self.configIFB(ap)
 
         self.config_range()
         if self.link == wmediumd:
             self.wmediumd_mode()
             if not self.configWiFiDirect and not self.config4addr \
                     and self.wmediumd_mode != error_prob:
-                self.start_wmediumd()
+                with StartupProfiler.span('start_wmediumd'):
+                    self.start_wmediumd()
 
         if self.link == wmediumd_802154:
             self.wmediumd_802154_mode()
             self.start_wmediumd_802154()
 
-        for ap in self.aps:
-            for intf in list(ap.wintfs.values()):
-                HostapdConfig(intf)
-                if self.link == wmediumd and 'vssids' in ap.params:
-                    break
+        start = time()
+        with StartupProfiler.span('hostapd'):
+            for ap in self.aps:
+                for intf in list(ap.wintfs.values()):
+                    HostapdConfig(intf)
+                    if self.link == wmediumd and 'vssids' in ap.params:
+                        break
+            if HostapdGroup.enabled:
+                HostapdGroup.start()
+        if self.aps:
+            HostapdGroup.report(time() - start)
 
         if not self.config4addr and not self.configWiFiDirect:
-            self.config_antenna()
+            with StartupProfiler.span('config_antenna'):
+                self.config_antenna()
 
     @staticmethod
     def wmediumd_workaround(node, value=1):
         # We need to set the position after starting wmediumd
-        sleep(0.15)
+        StartupProfiler.sleep(0.15, 'wmediumd_workaround')
         pos = node.position
         pos_x = float(pos[0]) + value
         pos = (pos_x, pos[1], pos[2])
@@ -1748,7 +1898,7 @@ def auto_association(self):
                     for intf in node.wintfs.values():
                         if isinstance(intf, adhoc):
                             info(node.name + ' ')
-                            sleep(1)
+                            StartupProfiler.sleep(1, 'adhoc')
                     node.pos = (0, 0, 0)
                     if not isinstance(node, AP):
                         ConfigMobLinks(node)
@@ -1759,6 +1909,8 @@ def auto_association(self):
                         self.wmediumd_workaround(node)
                         self.wmediumd_workaround(node, -0.00001)
 
+        # radios configured during the build are not marked one by one
+        SINREngine.rebuild()
         self.restore_links()
 
         for node in nodes:
@@ -1793,17 +1945,28 @@ def setChannelEquation(**params):
         :params bw: bandwidth (mbps)
         :params delay: delay (ms)
         :params latency: latency (ms)
-        :params loss: loss (%)"""
+        :params loss: loss (%)
+        :params step: evaluate the equations at distances rounded to
+            this step (m), from a lookup table
+        :params threshold: relative change of bw/loss/latency below
+            which tc is not updated"""
         IntfWireless.eqBw = params.get('bw', IntfWireless.eqBw)
         IntfWireless.eqDelay = params.get('delay', IntfWireless.eqDelay)
         IntfWireless.eqLatency = params.get('latency', IntfWireless.eqLatency)
         IntfWireless.eqLoss = params.get('loss', IntfWireless.eqLoss)
+        IntfWireless.eqStep = params.get('step', IntfWireless.eqStep)
+        IntfWireless.tcThreshold = params.get('threshold', IntfWireless.tcThreshold)
 
     @staticmethod
     def stop_graph_params():
         "Stop the graph"
         if parseData.thread_:
             parseData.thread_._keep_alive = False
+        if run_telemetry.rec:
+            run_telemetry.rec.close()
+            run_telemetry.rec = None
+        CtrlPool.close()
+        Renderer.stop()
         if mob.thread_:
             mob.thread_._keep_alive = False
         if Energy.thread_:
@@ -1813,6 +1976,12 @@ def stop_graph_params():
             EnergyMonitor.thread_._keep_alive = False
             sleep(1)
         sleep(0.5)
+        # after the mobility threads are out of their ticks
+        ShardPool.stop()
+        VirtualClock.stop()
+        WarmPool.stop()
+        CoverageRaster.stop()
+        SINREngine.stop()
 
     @classmethod
     def closeMininetWiFi(self):
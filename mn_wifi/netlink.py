@@ -0,0 +1,426 @@
+"""
+    Index of wireless phys, interfaces and network namespaces kept current
+    through rtnetlink and nl80211 events, so that lookups never rescan
+    sysfs/debugfs nor spawn processes.
+"""
+
+import ctypes
+import os
+import selectors
+import socket
+import struct
+from threading import Thread as thread, Lock, Condition
+from time import time
+
+from mininet.log import debug
+
+
+NETLINK_ROUTE = 0
+NETLINK_GENERIC = 16
+SOL_NETLINK = 270
+NETLINK_ADD_MEMBERSHIP = 1
+CLONE_NEWNET = 0x40000000
+
+NLM_F_REQUEST = 0x1
+NLM_F_DUMP = 0x300
+NLMSG_ERROR = 0x2
+NLMSG_DONE = 0x3
+
+RTMGRP_LINK = 0x1
+RTM_NEWLINK = 16
+RTM_DELLINK = 17
+IFLA_ADDRESS = 1
+IFLA_IFNAME = 3
+
+GENL_ID_CTRL = 0x10
+CTRL_CMD_GETFAMILY = 3
+CTRL_ATTR_FAMILY_ID = 1
+CTRL_ATTR_FAMILY_NAME = 2
+CTRL_ATTR_MCAST_GROUPS = 7
+CTRL_ATTR_MCAST_GRP_NAME = 1
+CTRL_ATTR_MCAST_GRP_ID = 2
+
+NL80211_CMD_GET_WIPHY = 1
+NL80211_CMD_NEW_WIPHY = 3
+NL80211_CMD_DEL_WIPHY = 4
+NL80211_CMD_GET_INTERFACE = 5
+NL80211_CMD_NEW_INTERFACE = 7
+NL80211_CMD_DEL_INTERFACE = 8
+NL80211_ATTR_WIPHY = 1
+NL80211_ATTR_WIPHY_NAME = 2
+NL80211_ATTR_IFINDEX = 3
+NL80211_ATTR_IFNAME = 4
+
+nlmsghdr = struct.Struct('=IHHII')
+nlattr = struct.Struct('=HH')
+genlmsghdr = struct.Struct('=BBH')
+ifinfomsg = struct.Struct('=BxHiII')
+
+
+def align(n):
+    return (n + 3) & ~3
+
+
+def attr(type_, data):
+    return nlattr.pack(nlattr.size + len(data), type_) + data + \
+        b'\0' * (align(len(data)) - len(data))
+
+
+def parse_attrs(data, off=0):
+    attrs = {}
+    while off + nlattr.size <= len(data):
+        length, type_ = nlattr.unpack_from(data, off)
+        if length < nlattr.size:
+            break
+        attrs[type_ & 0x3fff] = data[off + nlattr.size:off + length]
+        off += align(length)
+    return attrs
+
+
+def parse_msgs(data):
+    off = 0
+    while off + nlmsghdr.size <= len(data):
+        length, type_, flags, seq, _ = nlmsghdr.unpack_from(data, off)
+        if length < nlmsghdr.size:
+            break
+        yield type_, data[off + nlmsghdr.size:off + length]
+        off += align(length)
+
+
+def cstr(data):
+    return data.split(b'\0', 1)[0].decode()
+
+
+def netns_socket(pid, proto, groups=0):
+    """Opens a netlink socket in the network namespace of pid; the
+    namespace is switched in a short-lived thread, so the caller keeps
+    its own"""
+    result = {}
+
+    def open_():
+        try:
+            if pid is not None:
+                libc = ctypes.CDLL(None, use_errno=True)
+                fd = os.open('/proc/%d/ns/net' % pid, os.O_RDONLY)
+                try:
+                    if libc.setns(fd, CLONE_NEWNET) != 0:
+                        raise OSError(ctypes.get_errno(), 'setns failed')
+                finally:
+                    os.close(fd)
+            sock = socket.socket(socket.AF_NETLINK, socket.SOCK_RAW, proto)
+            sock.bind((0, groups))
+            result['sock'] = sock
+        except Exception as e:
+            result['error'] = e
+
+    t = thread(target=open_)
+    t.start()
+    t.join()
+    if 'error' in result:
+        raise result['error']
+    return result['sock']
+
+
+class Namespace(object):
+    "Netlink sockets of a network namespace"
+
+    def __init__(self, pid, node):
+        self.pid = pid
+        self.node = node
+        self.seq = 0
+        self.route = netns_socket(pid, NETLINK_ROUTE, RTMGRP_LINK)
+        self.events = self.genl = None
+        self.nl80211 = None
+        try:
+            self.genl = netns_socket(pid, NETLINK_GENERIC)
+            self.nl80211, groups = self.get_family('nl80211')
+            self.events = netns_socket(pid, NETLINK_GENERIC)
+            if 'config' in groups:
+                self.events.setsockopt(SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+                                       groups['config'])
+        except OSError:
+            debug('nl80211 is not available in the namespace of %s\n' % pid)
+
+    def request(self, sock, type_, flags, payload):
+        "Sends a request and returns the payloads of the replies"
+        self.seq += 1
+        sock.send(nlmsghdr.pack(nlmsghdr.size + len(payload), type_,
+                                NLM_F_REQUEST | flags, self.seq, 0) + payload)
+        replies = []
+        while True:
+            for msg_type, msg in parse_msgs(sock.recv(65536)):
+                if msg_type == NLMSG_DONE:
+                    return replies
+                if msg_type == NLMSG_ERROR:
+                    err, = struct.unpack_from('=i', msg)
+                    if err:
+                        raise OSError(-err, os.strerror(-err))
+                    return replies
+                replies.append(msg)
+            if not flags & NLM_F_DUMP:
+                return replies
+
+    def get_family(self, name):
+        msg = genlmsghdr.pack(CTRL_CMD_GETFAMILY, 1, 0) + \
+            attr(CTRL_ATTR_FAMILY_NAME, name.encode() + b'\0')
+        reply = self.request(self.genl, GENL_ID_CTRL, 0, msg)[0]
+        attrs = parse_attrs(reply, genlmsghdr.size)
+        family, = struct.unpack('=H', attrs[CTRL_ATTR_FAMILY_ID][:2])
+        groups = {}
+        for grp in parse_attrs(attrs.get(CTRL_ATTR_MCAST_GROUPS, b'')).values():
+            grp = parse_attrs(grp)
+            groups[cstr(grp[CTRL_ATTR_MCAST_GRP_NAME])], = \
+                struct.unpack('=I', grp[CTRL_ATTR_MCAST_GRP_ID])
+        return family, groups
+
+    def nl80211_dump(self, cmd, *attrs_):
+        if self.nl80211 is None:
+            return []
+        msg = genlmsghdr.pack(cmd, 0, 0) + b''.join(attrs_)
+        return [parse_attrs(reply, genlmsghdr.size)
+                for reply in self.request(self.genl, self.nl80211,
+                                          NLM_F_DUMP, msg)]
+
+    def get_interface(self, ifindex):
+        "Wiphy of an interface, or None when it is not wireless"
+        if self.nl80211 is None:
+            return None
+        msg = genlmsghdr.pack(NL80211_CMD_GET_INTERFACE, 0, 0) + \
+            attr(NL80211_ATTR_IFINDEX, struct.pack('=I', ifindex))
+        try:
+            reply = self.request(self.genl, self.nl80211, 0, msg)
+        except OSError:
+            return None
+        attrs = parse_attrs(reply[0], genlmsghdr.size) if reply else {}
+        if NL80211_ATTR_WIPHY not in attrs:
+            return None
+        return struct.unpack('=I', attrs[NL80211_ATTR_WIPHY])[0]
+
+    def sockets(self):
+        return [sock for sock in (self.route, self.events) if sock]
+
+    def close(self):
+        for sock in (self.route, self.genl, self.events):
+            if sock:
+                sock.close()
+
+
+class PhyIndex(object):
+    """phy -> wlan -> namespace -> node index
+
+    usage:
+    PhyIndex.watch(None)        # root namespace (APs)
+    PhyIndex.watch(sta1)        # before moving phys into sta1
+    PhyIndex.phys_of(sta1), PhyIndex.ifaces_of(sta1), PhyIndex.phy_of(intf)"""
+
+    enabled = False
+    namespaces = {}   # pid -> Namespace
+    wiphys = {}       # (pid, wiphy idx) -> phy name
+    phys = {}         # phy name -> pid
+    ifaces = {}       # pid -> {ifindex: (ifname, wiphy idx)}
+    by_name = {}      # ifname -> (pid, ifindex)
+    lock = Lock()
+    changed = Condition(lock)  # notified on new wiphys and interfaces
+    selector = None
+    thread_ = None
+
+    @classmethod
+    def watch(cls, node):
+        "Indexes the namespace of node (root namespace when None)"
+        pid = node.pid if node is not None and node.inNamespace else None
+        key = pid or 0
+        if key in cls.namespaces:
+            return
+        if cls.selector is None:
+            cls.selector = selectors.DefaultSelector()
+        ns = Namespace(pid, node)
+        with cls.lock:
+            cls.namespaces[key] = ns
+            cls.ifaces[key] = {}
+        # the sockets are subscribed before dumping, so changes in between
+        # wait in their buffers until the event thread picks them up
+        for attrs in ns.nl80211_dump(NL80211_CMD_GET_WIPHY):
+            cls.new_wiphy(key, attrs)
+        for attrs in ns.nl80211_dump(NL80211_CMD_GET_INTERFACE):
+            cls.new_iface(key, attrs)
+        for sock in ns.sockets():
+            cls.selector.register(sock, selectors.EVENT_READ, ns)
+        if cls.thread_ is None:
+            cls.thread_ = thread(name='phyIndex', target=cls.run)
+            cls.thread_.daemon = True
+            cls.thread_._keep_alive = True
+            cls.thread_.start()
+
+    @classmethod
+    def new_wiphy(cls, key, attrs):
+        if NL80211_ATTR_WIPHY_NAME not in attrs:
+            return
+        idx, = struct.unpack('=I', attrs[NL80211_ATTR_WIPHY])
+        name = cstr(attrs[NL80211_ATTR_WIPHY_NAME])
+        with cls.lock:
+            cls.wiphys[(key, idx)] = name
+            cls.phys[name] = key
+            cls.changed.notify_all()
+
+    @classmethod
+    def del_wiphy(cls, key, attrs):
+        idx, = struct.unpack('=I', attrs[NL80211_ATTR_WIPHY])
+        with cls.lock:
+            name = cls.wiphys.pop((key, idx), None)
+            if name and cls.phys.get(name) == key:
+                del cls.phys[name]
+
+    @classmethod
+    def new_iface(cls, key, attrs):
+        if NL80211_ATTR_IFINDEX not in attrs:
+            return
+        ifindex, = struct.unpack('=I', attrs[NL80211_ATTR_IFINDEX])
+        idx, = struct.unpack('=I', attrs[NL80211_ATTR_WIPHY])
+        cls.set_iface(key, ifindex, cstr(attrs[NL80211_ATTR_IFNAME]), idx)
+
+    @classmethod
+    def set_iface(cls, key, ifindex, ifname, idx):
+        with cls.lock:
+            old = cls.ifaces[key].get(ifindex)
+            if old and cls.by_name.get(old[0]) == (key, ifindex):
+                del cls.by_name[old[0]]
+            cls.ifaces[key][ifindex] = (ifname, idx)
+            cls.by_name[ifname] = (key, ifindex)
+            cls.changed.notify_all()
+
+    @classmethod
+    def del_iface(cls, key, ifindex):
+        with cls.lock:
+            old = cls.ifaces[key].pop(ifindex, None)
+            if old and cls.by_name.get(old[0]) == (key, ifindex):
+                del cls.by_name[old[0]]
+
+    @classmethod
+    def link_event(cls, ns, key, type_, msg):
+        _, _, ifindex, _, _ = ifinfomsg.unpack_from(msg)
+        if type_ == RTM_DELLINK:
+            cls.del_iface(key, ifindex)
+            return
+        attrs = parse_attrs(msg, ifinfomsg.size)
+        if IFLA_IFNAME not in attrs:
+            return
+        ifname = cstr(attrs[IFLA_IFNAME])
+        old = cls.ifaces[key].get(ifindex)
+        if old:
+            # renamed, the wiphy of an interface never changes
+            cls.set_iface(key, ifindex, ifname, old[1])
+        else:
+            # moved into this namespace
+            idx = ns.get_interface(ifindex)
+            if idx is not None:
+                cls.set_iface(key, ifindex, ifname, idx)
+
+    @classmethod
+    def genl_event(cls, key, msg):
+        cmd = genlmsghdr.unpack_from(msg)[0]
+        attrs = parse_attrs(msg, genlmsghdr.size)
+        if cmd == NL80211_CMD_NEW_WIPHY:
+            cls.new_wiphy(key, attrs)
+        elif cmd == NL80211_CMD_DEL_WIPHY:
+            cls.del_wiphy(key, attrs)
+        elif cmd == NL80211_CMD_NEW_INTERFACE:
+            cls.new_iface(key, attrs)
+        elif cmd == NL80211_CMD_DEL_INTERFACE and \
+                NL80211_ATTR_IFINDEX in attrs:
+            cls.del_iface(key, struct.unpack(
+                '=I', attrs[NL80211_ATTR_IFINDEX])[0])
+
+    @classmethod
+    def run(cls):
+        while cls.thread_._keep_alive:
+            for sel_key, _ in cls.selector.select(timeout=0.5):
+                ns = sel_key.data
+                key = ns.pid or 0
+                try:
+                    data = sel_key.fileobj.recv(65536)
+                except OSError:
+                    continue
+                for type_, msg in parse_msgs(data):
+                    if sel_key.fileobj is ns.route:
+                        if type_ in (RTM_NEWLINK, RTM_DELLINK):
+                            cls.link_event(ns, key, type_, msg)
+                    elif type_ == ns.nl80211:
+                        cls.genl_event(key, msg)
+
+    @classmethod
+    def namespace_of(cls, node):
+        return node.pid if node.inNamespace else 0
+
+    @classmethod
+    def entries_of(cls, node):
+        """(ifname, wiphy idx) of node, ordered by wiphy; nodes outside a
+        namespace share the root one, so their own wlans are picked by name"""
+        key = cls.namespace_of(node)
+        with cls.lock:
+            entries = sorted(cls.ifaces.get(key, {}).values(),
+                             key=lambda i: i[1])
+        if not key:
+            wlans = node.params.get('wlan', [])
+            entries = [entry for entry in entries if entry[0] in wlans]
+        return key, entries
+
+    @classmethod
+    def ifaces_of(cls, node):
+        "Wireless interfaces of node"
+        return [name for name, _ in cls.entries_of(node)[1]]
+
+    @classmethod
+    def phys_of(cls, node):
+        "Phys of node, in the order of ifaces_of"
+        key, entries = cls.entries_of(node)
+        return [cls.wiphys.get((key, idx)) for _, idx in entries]
+
+    @classmethod
+    def phy_of(cls, ifname):
+        with cls.lock:
+            ref = cls.by_name.get(ifname)
+            if ref is None:
+                return None
+            return cls.wiphys.get((ref[0], cls.ifaces[ref[0]][ref[1]][1]))
+
+    @classmethod
+    def node_of(cls, ifname):
+        ref = cls.by_name.get(ifname)
+        ns = cls.namespaces.get(ref[0]) if ref else None
+        return ns.node if ns else None
+
+    @classmethod
+    def wlan_of(cls, phy, timeout=2):
+        """Interface of phy in the root namespace, waiting up to timeout
+        seconds for its events; None if it does not show up"""
+        deadline = time() + timeout
+        with cls.lock:
+            while True:
+                idx = [i for (key, i), name in cls.wiphys.items()
+                       if key == 0 and name == phy]
+                names = [ifname for ifname, i in cls.ifaces.get(0, {}).values()
+                         if idx and i == idx[0]]
+                if names:
+                    return names[0]
+                left = deadline - time()
+                if left <= 0:
+                    return None
+                cls.changed.wait(left)
+
+    @classmethod
+    def phy_names(cls):
+        with cls.lock:
+            return list(cls.phys)
+
+    @classmethod
+    def stop(cls):
+        if cls.thread_:
+            cls.thread_._keep_alive = False
+            cls.thread_.join()
+        for ns in cls.namespaces.values():
+            ns.close()
+        if cls.selector:
+            cls.selector.close()
+        cls.namespaces, cls.wiphys, cls.phys = {}, {}, {}
+        cls.ifaces, cls.by_name = {}, {}
+        cls.selector = cls.thread_ = None
@@ -24,7 +24,7 @@
 import math
 import matplotlib.pyplot as plt
 
-from time import sleep
+from time import sleep, time
 from sys import exit
 from os import system as sh, getpid
 
@@ -34,7 +34,12 @@
 from mininet.node import Node, UserSwitch, OVSSwitch, CPULimitedHost
 from mininet.moduledeps import pathCheck
 from mininet.link import Intf
-from mn_wifi.link import WirelessIntf, physicalMesh, ITSLink
+from mn_wifi.link import WirelessIntf, physicalMesh, ITSLink, HostapdGroup
+from mn_wifi.metrics import Metrics
+from mn_wifi.pool import WarmPool
+from mn_wifi.profiler import StartupProfiler
+from mn_wifi.render import Renderer
+from mn_wifi.sinr import SINREngine
 from mn_wifi.wmediumdConnector import w_server, w_pos, w_cst, wmediumd_mode
 
 from re import findall
@@ -85,7 +90,12 @@ def __init__(self, name, inNamespace=True, **params):
 
         # Start command interpreter shell
         self.master, self.slave = None, None  # pylint
-        self.startShell()
+        if not WarmPool.claim_shell(self):
+            start = time()
+            with StartupProfiler.cmd('mnexec', self.name):
+                self.startShell()
+            Metrics.observe('mn_wifi_node_spawns',
+                            'mn_wifi_node_spawn_seconds', start)
         self.mountPrivateDirs()
 
     # File descriptor to node mapping support
@@ -93,6 +103,16 @@ def __init__(self, name, inNamespace=True, **params):
     inToNode = {}  # mapping of input fds to nodes
     outToNode = {}  # mapping of output fds to nodes
 
+    def cmd(self, *args, **kwargs):
+        "Send a command, wait for output, and return it."
+        with StartupProfiler.cmd(args, self.name):
+            return super(Node_wifi, self).cmd(*args, **kwargs)
+
+    def pexec(self, *args, **kwargs):
+        "Execute a command using popen"
+        with StartupProfiler.cmd(args, self.name):
+            return super(Node_wifi, self).pexec(*args, **kwargs)
+
     def get_wlan(self, intf):
         return self.params['wlan'].index(intf)
 
@@ -206,17 +226,23 @@ def set_circle_center(self, x, y):
     def set_circle_radius(self):
         self.circle.set_radius(self.get_max_radius())
 
+    def get_pos_wmediumd(self, pos):
+        "Pos updates of the wmediumd interfaces, empty if pos is unchanged"
+        if self.lastpos == pos:
+            return []
+        self.lastpos = pos
+        return [w_pos(wmIface, [(float(pos[0])+id), float(pos[1]), float(pos[2])])
+                for id, wmIface in enumerate(self.wmIfaces)]
+
     def set_pos_wmediumd(self, pos):
         "Set Position for wmediumd"
-        if self.lastpos != pos:
-            self.lastpos = pos
-            for id, wmIface in enumerate(self.wmIfaces):
-                w_server.update_pos(w_pos(wmIface,
-                    [(float(pos[0])+id), float(pos[1]), float(pos[2])]))
+        for wpos in self.get_pos_wmediumd(pos):
+            w_server.update_pos(wpos)
 
     def setPosition(self, pos):
         "Set Position"
         self.position = [float(x) for x in pos.split(',')]
+        SINREngine.moved(self)
         self.update_graph()
 
         if wmediumd_mode.mode == w_cst.INTERFERENCE_MODE:
@@ -259,12 +285,16 @@ def getxyz(self):
 
     def update_3d(self):
         from mn_wifi.plot import Plot3D
+        if Renderer.shm:
+            return Renderer.update(self)
         self.plt_node.remove()
         self.circle.remove()
         self.plttxt.remove()
         Plot3D.instantiate_attrs(self)
 
     def update_2d(self):
+        if Renderer.shm:
+            return Renderer.update(self)
         x, y, z = self.getxyz()
         self.set_text_pos(x, y)
         self.plt_node.set_data(x, y)
@@ -279,7 +309,9 @@ def get_max_radius(self):
         return max(range_list)
 
     def update_graph(self):
-        if plt.fignum_exists(1):
+        if Renderer.shm:
+            Renderer.update(self)
+        elif plt.fignum_exists(1):
             if hasattr(self.circle, 'set_radius'):
                 self.set_circle_radius()
                 self.updateLine()
@@ -433,12 +465,19 @@ def set_circle_color(self, color):
                     self.circle.set_color(color)
 
     def showNode(self, show=True):
+        if Renderer.shm:
+            # drawn by the render process: no artists in this one
+            Renderer.show(self, show)
+            return
         self.circle.set_visible(show)
         self.plttxt.set_visible(show)
         self.plt_node.set_visible(show)
 
     def stop_(self):
         "Stops hostapd"
+        if HostapdGroup.enabled:
+            for intf in self.wintfs.values():
+                HostapdGroup.remove(intf)
         process = 'mn%d_%s' % (getpid(), self.name)
         sh('pkill -f \'hostapd -B %s\'' % process)
         self.set_circle_color('w')
@@ -446,7 +485,9 @@ def stop_(self):
     def start_(self):
         "Starts hostapd"
         process = 'mn%d_%s' % (getpid(), self.name)
-        sh('hostapd -B %s-wlan1.apconf' % process)
+        if not (HostapdGroup.enabled and HostapdGroup.add(
+                self.wintfs[0], '%s-wlan1.apconf' % process)):
+            sh('hostapd -B %s-wlan1.apconf' % process)
         color = self.get_circle_color()
         self.set_circle_color(color)
 
@@ -7,9 +7,12 @@
 import numpy as np
 import matplotlib.patches as patches
 import matplotlib.pyplot as plt
+from matplotlib.collections import LineCollection
 from mpl_toolkits.mplot3d import Axes3D
 from mininet.log import debug
 
+from mn_wifi.render import Renderer
+
 
 class Plot3D (object):
     ax = None
@@ -216,6 +219,11 @@ def draw(cls):
     def scatter(cls, nodesx, nodesy):
         return plt.scatter(nodesx, nodesy, color='red', marker='s')
 
+    @classmethod
+    def line_collection(cls):
+        "Many lines in one artist, updated with set_segments/set_color"
+        return cls.ax.add_collection(LineCollection([], lw=1))
+
     @classmethod
     def line_txt(cls, x, y, i):
         title = 'Av.%s' % i
@@ -248,6 +256,10 @@ class PlotGraph(object):
 
     def __init__(self, **kwargs):
         warnings.filterwarnings("ignore")
+        if Renderer.enabled:
+            if not Renderer.shm:
+                Renderer.start(**kwargs)
+            return
         self.instantiate_graph(**kwargs)
 
     def instantiate_graph(self, **kwargs):
@@ -259,6 +271,8 @@ def instantiate_graph(self, **kwargs):
 
     @classmethod
     def pause(cls):
+        if Renderer.shm:
+            return
         try:
             plt.pause(0.001)
         except:
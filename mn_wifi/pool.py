@@ -0,0 +1,217 @@
+"""
+    Warm pool for nodes added at runtime. A background thread keeps a
+    number of namespace shells (mnexec -n bash) and mac80211_hwsim radios
+    ready; a node added after start() adopts a spare shell instead of
+    spawning one and takes spare radios instead of creating them, and the
+    thread refills the pool behind it. A radio that has been up for a
+    while also skips the settle time before its wmediumd registration.
+    When the pool runs dry the node falls back to the synchronous path.
+"""
+
+from collections import deque
+from os import listdir, getpid, system as sh
+from re import search
+from subprocess import Popen, PIPE, call, check_output, CalledProcessError, \
+    DEVNULL
+from threading import Thread as thread, Event, Lock
+from time import time
+
+from mininet.log import info, debug, error
+
+from mn_wifi.metrics import Metrics
+from mn_wifi.module import Mac80211Hwsim
+from mn_wifi.netlink import PhyIndex
+from mn_wifi.profiler import StartupProfiler
+
+
+class WarmPool(object):
+
+    size = 0  # spare shells and spare radios kept ready
+    settle = 1.0  # seconds a new radio waits before wmediumd registration
+    shells = deque()  # spare nodes whose shell is adopted
+    radios = deque()  # (phy, wlan, hwsim id, creation time)
+    radios_enabled = False
+    serial = 0
+    serial_lock = Lock()  # the refill thread and claims both name radios
+    nmcli = None  # whether NetworkManager runs and has to be told off
+    hits = {}  # kind -> claims served from the pool
+    misses = {}  # kind -> claims served synchronously
+    latency = {}  # kind -> seconds spent claiming
+    thread_ = None
+    __wake = Event()
+
+    @classmethod
+    def running(cls):
+        return cls.thread_ is not None and cls.thread_._keep_alive
+
+    @classmethod
+    def start(cls, radios=True):
+        "Fills the pool in the background; called once the topology is up"
+        if cls.size <= 0:
+            return
+        cls.radios_enabled = radios
+        cls.thread_ = thread(name='warmPool', target=cls.refill)
+        cls.thread_.daemon = True
+        cls.thread_._keep_alive = True
+        cls.thread_.start()
+        Metrics.source('pool', cls.gauges)
+
+    @classmethod
+    def next_serial(cls):
+        with cls.serial_lock:
+            cls.serial += 1
+            return cls.serial
+
+    @classmethod
+    def refill(cls):
+        from mn_wifi.node import Node_wifi
+        while cls.thread_._keep_alive:
+            cls.__wake.clear()
+            try:
+                while cls.thread_._keep_alive and len(cls.shells) < cls.size:
+                    cls.shells.append(Node_wifi('mnspare%d' % cls.next_serial(),
+                                                spare=True))
+            except Exception as e:
+                error('*** Warm pool: could not start a spare shell: %s\n' % e)
+            try:
+                while cls.thread_._keep_alive and cls.radios_enabled and \
+                        len(cls.radios) < cls.size:
+                    cls.radios.append(cls.create_radio())
+            except Exception as e:
+                error('*** Warm pool: could not create a spare radio, no more '
+                      'radios are pooled: %s\n' % e)
+                cls.radios_enabled = False
+            cls.__wake.wait(1)
+
+    @classmethod
+    def create_radio(cls):
+        "Creates a radio in the root namespace; returns (phy, wlan, id, t)"
+        phy = 'mn%05dw%03d' % (getpid(), cls.next_serial())
+        cmd = ['hwsim_mgmt', '-c', '-n', phy]
+        with StartupProfiler.cmd(cmd):
+            p = Popen(cmd, stdin=PIPE, stdout=PIPE, stderr=PIPE)
+            output, err_out = p.communicate()
+        m = search(r"ID (\d+)", output.decode())
+        if p.returncode != 0 or not m:
+            raise Exception('hwsim_mgmt -c -n %s: %s' % (phy, err_out.decode()))
+        sysfs = '/sys/class/ieee80211/%s' % phy
+        wlan = listdir(sysfs + '/device/net')[0]
+        if cls.networkmanager():
+            # as assign_iface: keep NetworkManager off the spare radio
+            sh('nmcli device set {} managed no'.format(wlan))
+        for entry in listdir(sysfs):
+            if entry.startswith('rfkill'):
+                sh('rfkill unblock %s' % entry[len('rfkill'):])
+        debug('Warm pool: radio %s (%s, ID %s)\n' % (phy, wlan, m.group(1)))
+        return phy, wlan, m.group(1), time()
+
+    @classmethod
+    def networkmanager(cls):
+        "Whether NetworkManager runs and nmcli is there, checked once"
+        if cls.nmcli is None:
+            try:
+                check_output(['pgrep', '-f', 'NetworkManager'])
+                cls.nmcli = call(['which', 'nmcli'], stdout=DEVNULL) == 0
+            except (OSError, CalledProcessError):
+                cls.nmcli = False
+        return cls.nmcli
+
+    @classmethod
+    def count(cls, kind, hit, start):
+        table = cls.hits if hit else cls.misses
+        table[kind] = table.get(kind, 0) + 1
+        cls.latency[kind] = cls.latency.get(kind, 0) + time() - start
+        Metrics.inc('mn_wifi_pool_%s{kind="%s"}'
+                    % ('hits' if hit else 'misses', kind))
+        Metrics.observe('mn_wifi_pool_claims{kind="%s"}' % kind,
+                        'mn_wifi_pool_claim_seconds{kind="%s"}' % kind, start)
+
+    @classmethod
+    def claim_shell(cls, node):
+        """Hands the shell of a spare node over to node; returns False when
+        node has to start its own shell"""
+        if not cls.running() or node.params.get('spare') or \
+                not node.inNamespace:
+            return False
+        start = time()
+        try:
+            spare = cls.shells.popleft()
+        except IndexError:
+            cls.count('shell', False, start)
+            cls.__wake.set()
+            return False
+        for attr in ('shell', 'pid', 'stdin', 'stdout', 'master', 'slave',
+                     'pollOut', 'execed', 'lastPid', 'lastCmd', 'readbuf',
+                     'waiting', 'decoder'):
+            setattr(node, attr, getattr(spare, attr))
+        node.inToNode[node.stdin.fileno()] = node
+        node.outToNode[node.stdout.fileno()] = node
+        cls.count('shell', True, start)
+        cls.__wake.set()
+        return True
+
+    @classmethod
+    def claim_radios(cls, node):
+        """Moves one radio per wlan of node into its namespace, spare ones
+        first, and sets node.settle to what is left of their settle time"""
+        from mn_wifi.node import AP
+        node.settle = 0
+        for name in node.params['wlan']:
+            start = time()
+            try:
+                radio = cls.radios.popleft() if cls.radios_enabled else None
+            except IndexError:
+                radio = None
+            hit = radio is not None
+            if not hit:
+                radio = cls.create_radio()
+            phy, wlan, id, created = radio
+            Mac80211Hwsim.hwsim_ids.append(id)
+            node.settle = max(node.settle, cls.settle - (time() - created))
+            if isinstance(node, AP) and not node.inNamespace:
+                Mac80211Hwsim.rename(node, wlan, name)
+            else:
+                if PhyIndex.enabled:
+                    PhyIndex.watch(node)
+                cmd = 'iw phy {} set netns {}'.format(phy, node.pid)
+                with StartupProfiler.cmd(cmd, node.name):
+                    sh(cmd)
+                node.cmd('ip link set {} down'.format(wlan))
+                node.cmd('ip link set {} name {}'.format(wlan, name))
+            cls.count('radio', hit, start)
+        cls.__wake.set()
+
+    @classmethod
+    def gauges(cls):
+        return {'mn_wifi_pool_spare{kind="shell"}': len(cls.shells),
+                'mn_wifi_pool_spare{kind="radio"}': len(cls.radios)}
+
+    @classmethod
+    def stats(cls):
+        "kind -> (claims, hit rate, mean claim latency in seconds)"
+        stats = {}
+        for kind in set(cls.hits) | set(cls.misses):
+            claims = cls.hits.get(kind, 0) + cls.misses.get(kind, 0)
+            stats[kind] = (claims, float(cls.hits.get(kind, 0)) / claims,
+                           cls.latency.get(kind, 0) / claims)
+        return stats
+
+    @classmethod
+    def stop(cls):
+        if cls.thread_ is None:
+            return
+        cls.thread_._keep_alive = False
+        cls.__wake.set()
+        cls.thread_.join(5)
+        for kind, (claims, rate, mean) in sorted(cls.stats().items()):
+            info('*** Warm pool: %d %s claims, %.0f%% from the pool, '
+                 '%.1fms mean\n' % (claims, kind, rate * 100, mean * 1000))
+        while cls.shells:
+            cls.shells.popleft().terminate()
+        while cls.radios:
+            sh('hwsim_mgmt -x %s >/dev/null 2>&1' % cls.radios.popleft()[0])
+        Metrics.source('pool')
+        cls.thread_ = None
+        cls.radios_enabled = False
+        cls.nmcli = None
+        cls.hits, cls.misses, cls.latency = {}, {}, {}
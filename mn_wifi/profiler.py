@@ -0,0 +1,157 @@
+"""
+Startup profiler: records a span for every startup phase and external
+command and exports them as a Chrome trace / Perfetto JSON timeline,
+together with a summary of the time spent waiting (commands, sleeps)
+versus working (Python).
+"""
+
+import json
+import threading
+from os import getpid
+from time import perf_counter, sleep
+
+from mininet.log import info
+
+
+class _NoSpan(object):
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        return False
+
+
+class _Span(object):
+
+    def __init__(self, name, cat, args):
+        self.name = name
+        self.cat = cat
+        self.args = args
+
+    def __enter__(self):
+        stack = StartupProfiler.stack()
+        self.waiting = self.cat != 'phase' and \
+            not any(span.waiting for span in stack)
+        self.wait = 0.0
+        stack.append(self)
+        self.start = perf_counter()
+        return self
+
+    def __exit__(self, *args):
+        dur = perf_counter() - self.start
+        stack = StartupProfiler.stack()
+        stack.pop()
+        if self.waiting:
+            for span in stack:
+                span.wait += dur
+            StartupProfiler.waited[self.cat] += dur
+        StartupProfiler.record(self, dur, threading.current_thread().ident)
+        return False
+
+
+class StartupProfiler(object):
+    """Spans are either phases (work done in Python), commands (waiting on
+    an external process) or sleeps. The time a phase spends in commands or
+    sleeps is charged once, to every phase open on the same thread"""
+
+    enabled = False
+    path = 'mn-startup-trace.json'
+    events = []
+    phases = []  # (name, wall, wait) of the outermost phases
+    waited = {}
+    origin = 0.0
+    __local = threading.local()
+    __nospan = _NoSpan()
+
+    @classmethod
+    def start(cls, path=None):
+        if path:
+            cls.path = path
+        cls.enabled = True
+        cls.events = []
+        cls.phases = []
+        cls.waited = {'cmd': 0.0, 'sleep': 0.0}
+        cls.origin = perf_counter()
+
+    @classmethod
+    def stack(cls):
+        if not hasattr(cls.__local, 'stack'):
+            cls.__local.stack = []
+        return cls.__local.stack
+
+    @classmethod
+    def span(cls, name, cat='phase', **args):
+        """Context manager timing a phase ('phase'), an external command
+        ('cmd') or a sleep ('sleep')"""
+        if not cls.enabled:
+            return cls.__nospan
+        return _Span(name, cat, args)
+
+    @classmethod
+    def cmd(cls, cmd, node=None):
+        "Span of an external command run on node"
+        if not cls.enabled:
+            return cls.__nospan
+        cmd = ' '.join(str(c) for c in cmd) \
+            if isinstance(cmd, (list, tuple)) else str(cmd)
+        name = cmd.split(' ', 1)[0] if cmd else 'cmd'
+        if node is not None:
+            return _Span(name, 'cmd', {'node': str(node), 'cmd': cmd})
+        return _Span(name, 'cmd', {'cmd': cmd})
+
+    @classmethod
+    def sleep(cls, seconds, name='sleep'):
+        with cls.span(name, 'sleep'):
+            sleep(seconds)
+
+    @classmethod
+    def record(cls, span, dur, tid):
+        cls.events.append({'name': span.name, 'cat': span.cat, 'ph': 'X',
+                           'ts': (span.start - cls.origin) * 1e6,
+                           'dur': dur * 1e6, 'pid': getpid(), 'tid': tid,
+                           'args': span.args})
+        if span.cat == 'phase' and not cls.stack():
+            cls.phases.append((span.name, dur, span.wait))
+
+    @classmethod
+    def summary(cls):
+        total = perf_counter() - cls.origin
+        waited = sum(cls.waited.values())
+        cmds = {}
+        for event in cls.events:
+            if event['cat'] == 'cmd':
+                count, dur = cmds.get(event['name'], (0, 0.0))
+                cmds[event['name']] = (count + 1, dur + event['dur'] / 1e6)
+        return {'total_s': total, 'waiting_s': waited,
+                'working_s': total - waited,
+                'cmd_s': cls.waited['cmd'], 'sleep_s': cls.waited['sleep'],
+                'phases': [{'name': name, 'wall_s': wall, 'waiting_s': wait,
+                            'working_s': wall - wait}
+                           for name, wall, wait in cls.phases],
+                'commands': dict((name, {'count': count, 'seconds': dur})
+                                 for name, (count, dur) in cmds.items())}
+
+    @classmethod
+    def export(cls):
+        "Writes the timeline, logs the summary and stops recording"
+        if not cls.enabled:
+            return
+        cls.enabled = False
+        summary = cls.summary()
+        with open(cls.path, 'w') as f:
+            json.dump({'traceEvents': cls.events, 'displayTimeUnit': 'ms',
+                       'otherData': summary}, f)
+        info('*** Startup took %.2fs: %.2fs working, %.2fs in commands, '
+             '%.2fs sleeping (timeline in %s)\n'
+             % (summary['total_s'], summary['working_s'], summary['cmd_s'],
+                summary['sleep_s'], cls.path))
+        for phase in sorted(summary['phases'], key=lambda p: -p['wall_s'])[:10]:
+            info('    %-20s %8.2fs  (%.2fs waiting)\n'
+                 % (phase['name'], phase['wall_s'], phase['waiting_s']))
+        top = sorted(summary['commands'].items(),
+                     key=lambda item: -item[1]['seconds'])[:10]
+        for name, stats in top:
+            info('    %-20s %8.2fs  %d calls\n'
+                 % (name, stats['seconds'], stats['count']))
+        cls.events = []
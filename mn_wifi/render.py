@@ -0,0 +1,258 @@
+"""
+    Graph drawn by a separate process. Node moves only write to a local
+    table; a publisher thread copies it, at most fps times a second, into
+    the idle half of a double-buffered shared memory snapshot and flips
+    it, so mobility never waits for matplotlib. The render process blits
+    the nodes, their ranges, names and wired links over a cached
+    background at the same capped frame rate; hidden nodes are skipped.
+"""
+
+import json
+import sys
+from multiprocessing import shared_memory, resource_tracker
+from subprocess import Popen, PIPE, TimeoutExpired
+from threading import Thread as thread
+from time import sleep, monotonic
+
+import numpy as np
+from mininet.log import debug
+
+
+SEQ, ACTIVE, CLOSING = 0, 1, 2
+HEADER = 4  # int64 words
+FIELDS = 5  # x, y, z, range, shown
+
+
+def snapshot_arrays(shm, n):
+    "Header and the two position/range buffers laid over shm"
+    header = np.ndarray((HEADER,), dtype=np.int64, buffer=shm.buf)
+    bufs = np.ndarray((2, n, FIELDS), dtype=np.float64, buffer=shm.buf,
+                      offset=HEADER * 8)
+    return header, bufs
+
+
+def read_snapshot(header, bufs, out):
+    """Copies the active buffer into out; returns its sequence number or
+    None when the writer flipped twice meanwhile (the copy may be torn)"""
+    seq = int(header[SEQ])
+    np.copyto(out, bufs[int(header[ACTIVE])])
+    if int(header[SEQ]) - seq > 1:
+        return None
+    return seq
+
+
+class Renderer(object):
+
+    enabled = False
+    fps = 20
+    index = {}
+    table = None
+    dirty = False
+    shm = None
+    header = None
+    bufs = None
+    proc = None
+    thread_ = None
+
+    @classmethod
+    def start(cls, nodes, links=(), min_x=0, min_y=0, min_z=0,
+              max_x=100, max_y=100, max_z=0, **kwargs):
+        cls.index = {node: i for i, node in enumerate(nodes)}
+        cls.table = np.zeros((len(nodes), FIELDS))
+        cls.table[:, 4] = 1
+        for node in nodes:
+            cls.update(node)
+        pairs = []
+        for link in links:
+            if 'wifi' not in str(link) and 'ITS' not in str(link):
+                src, dst = link.intf1.node, link.intf2.node
+                if src in cls.index and dst in cls.index:
+                    pairs.append((cls.index[src], cls.index[dst]))
+
+        cls.shm = shared_memory.SharedMemory(
+            create=True, size=HEADER * 8 + 2 * cls.table.nbytes + 8)
+        cls.header, cls.bufs = snapshot_arrays(cls.shm, len(nodes))
+        cls.header[:] = 0
+        cls.publish()
+
+        # a fresh interpreter: neither a fork of this threaded process nor
+        # a re-run of the topology script
+        cls.proc = Popen([sys.executable, '-m', 'mn_wifi.render'], stdin=PIPE)
+        cls.proc.stdin.write(json.dumps(dict(
+            shm_name=cls.shm.name, n=len(nodes), names=[node.name for node in nodes],
+            colors=[node.get_circle_color() for node in nodes], pairs=pairs,
+            bounds=(min_x, min_y, min_z, max_x, max_y, max_z),
+            fps=cls.fps)).encode())
+        cls.proc.stdin.close()
+
+        cls.thread_ = thread(name='renderFeed', target=cls.feed)
+        cls.thread_.daemon = True
+        cls.thread_._keep_alive = True
+        cls.thread_.start()
+
+    @classmethod
+    def update(cls, node):
+        i = cls.index.get(node)
+        if i is None:
+            return
+        x, y, z = node.getxyz()
+        ranges = [intf.range for intf in node.wintfs.values()]
+        cls.table[i, :4] = x, y, z, max(ranges) if ranges else 0
+        cls.dirty = True
+
+    @classmethod
+    def show(cls, node, show=True):
+        "Shows or hides node (Node_wifi.hide/show)"
+        i = cls.index.get(node)
+        if i is not None:
+            cls.table[i, 4] = show
+            cls.dirty = True
+
+    @classmethod
+    def publish(cls):
+        idle = 1 - int(cls.header[ACTIVE])
+        np.copyto(cls.bufs[idle], cls.table)
+        cls.header[ACTIVE] = idle
+        cls.header[SEQ] += 1
+
+    @classmethod
+    def feed(cls):
+        while cls.thread_._keep_alive:
+            if cls.dirty:
+                cls.dirty = False
+                cls.publish()
+            sleep(1.0 / cls.fps)
+
+    @classmethod
+    def stop(cls):
+        if cls.thread_:
+            cls.thread_._keep_alive = False
+            # a publish() in progress writes through views of the segment
+            cls.thread_.join()
+        if cls.shm:
+            cls.header[CLOSING] = 1
+            if cls.proc:
+                try:
+                    cls.proc.wait(2)
+                except TimeoutExpired:
+                    cls.proc.terminate()
+            del cls.header, cls.bufs
+            cls.shm.close()
+            cls.shm.unlink()
+        cls.shm = cls.proc = cls.thread_ = cls.table = None
+        cls.header = cls.bufs = None
+        cls.index = {}
+
+
+def render(shm_name, n, names, colors, pairs, bounds, fps):
+    "Body of the render process"
+    import matplotlib.pyplot as plt
+    from matplotlib.collections import EllipseCollection, LineCollection
+
+    shm = shared_memory.SharedMemory(name=shm_name)
+    # the main process owns the segment and unlinks it
+    resource_tracker.unregister(shm._name, 'shared_memory')
+    header, bufs = snapshot_arrays(shm, n)
+    snap = np.zeros((n, FIELDS))
+    pairs = np.array(pairs, dtype=int).reshape(-1, 2)
+    min_x, min_y, min_z, max_x, max_y, max_z = bounds
+    plot3d = max_z != 0
+
+    plt.ion()
+    fig = plt.figure(1)
+    plt.title("Mininet-WiFi Graph")
+    if plot3d:
+        from mpl_toolkits.mplot3d.art3d import Line3DCollection
+        ax = fig.add_subplot(111, projection='3d')
+        ax.set_zlim([min_z, max_z])
+        ax.set_zlabel('meters (z)')
+    else:
+        ax = fig.add_subplot(111)
+    ax.set_xlabel('meters')
+    ax.set_ylabel('meters')
+    ax.set_xlim([min_x, max_x])
+    ax.set_ylim([min_y, max_y])
+    ax.grid(True)
+
+    while read_snapshot(header, bufs, snap) is None:
+        pass
+    if plot3d:
+        points = ax.scatter(snap[:, 0], snap[:, 1], snap[:, 2], marker='.',
+                            color='black', animated=True)
+        lines = ax.add_collection(Line3DCollection([], colors='b', animated=True))
+        texts = [ax.text(x, y, z, name, animated=True)
+                 for (x, y, z, _, _), name in zip(snap, names)]
+    else:
+        points = ax.scatter(snap[:, 0], snap[:, 1], marker='.', color='black',
+                            animated=True)
+        lines = ax.add_collection(LineCollection([], colors='b', animated=True))
+        texts = [ax.annotate(name, xy=(x, y), animated=True)
+                 for (x, y, _, _, _), name in zip(snap, names)]
+    circles = None  # range circles, 2D only
+
+    background = [None]
+
+    def grab(event):
+        background[0] = fig.canvas.copy_from_bbox(fig.bbox)
+
+    fig.canvas.mpl_connect('draw_event', grab)
+    plt.show(block=False)
+    fig.canvas.draw()
+
+    ranges = None
+    last = -1
+    while not header[CLOSING] and plt.fignum_exists(1):
+        start = monotonic()
+        seq = read_snapshot(header, bufs, snap)
+        if seq is not None and seq != last:
+            last = seq
+            # hidden nodes, their ranges and links are not drawn
+            shown = snap[:, 4] > 0
+            snap[~shown, :3] = np.nan
+            # artists keep references to what they are given
+            xy = snap[:, :2].copy()
+            for text, visible in zip(texts, shown.tolist()):
+                text.set_visible(visible)
+            if plot3d:
+                points._offsets3d = tuple(snap[:, :3].T.copy())
+                lines.set_segments(np.stack([snap[pairs[:, 0], :3],
+                                             snap[pairs[:, 1], :3]], axis=1))
+                for text, (x, y, z, _, _) in zip(texts, snap):
+                    text.set_position((x, y))
+                    text.set_3d_properties(z)
+            else:
+                if ranges is None or not np.array_equal(ranges, snap[:, 3]):
+                    # sizes of an EllipseCollection are fixed; rebuild it
+                    ranges = snap[:, 3].copy()
+                    if circles is not None:
+                        circles.remove()
+                    circles = EllipseCollection(
+                        2 * ranges, 2 * ranges, np.zeros(n), units='xy',
+                        offsets=xy, facecolors=colors, alpha=0.1, animated=True)
+                    try:
+                        circles.set_offset_transform(ax.transData)
+                    except AttributeError:  # matplotlib < 3.6
+                        circles._transOffset = ax.transData
+                    ax.add_collection(circles)
+                circles.set_offsets(xy)
+                points.set_offsets(xy)
+                lines.set_segments(np.stack([xy[pairs[:, 0]], xy[pairs[:, 1]]],
+                                            axis=1))
+                for text, (x, y, _, _, _) in zip(texts, snap):
+                    text.xyann = (x, y)
+        if background[0] is not None:
+            fig.canvas.restore_region(background[0])
+            for artist in [circles, lines, points] + texts:
+                if artist is not None:
+                    ax.draw_artist(artist)
+            fig.canvas.blit(fig.bbox)
+        fig.canvas.flush_events()
+        sleep(max(0.0, 1.0 / fps - (monotonic() - start)))
+    debug('render process exits\n')
+    del header, bufs
+    shm.close()
+    plt.close('all')
+
+
+if __name__ == '__main__':
+    render(**json.load(sys.stdin))
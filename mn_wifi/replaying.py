@@ -5,30 +5,216 @@
 
 from time import time, sleep
 from threading import Thread as thread
+import mmap
 import random
 import math
+import struct
 
+import numpy as np
 from pylab import cos, sin
 from mininet.log import info
 from mn_wifi.plot import PlotGraph
 from mn_wifi.mobility import Mobility, ConfigMobLinks
 from mn_wifi.node import Station, AP
+from mn_wifi.sinr import SINREngine
 from mn_wifi.frequency import Frequency as Getfreq
+from mn_wifi.vclock import VirtualClock
+
+
+class BinaryTrace(object):
+    """Columnar mobility trace mapped from disk
+
+    layout (little endian):
+        header: magic 'MNTR', u16 version, u16 flags, u32 nnodes,
+                u64 nsamples, 12 bytes reserved
+        index:  nnodes x (32s node name, u64 first sample, u64 count)
+        data:   f64 time[nsamples], f32 x[nsamples], f32 y[nsamples],
+                f32 z[nsamples]
+    the samples of a node are contiguous and sorted by time"""
+
+    MAGIC = b'MNTR'
+    VERSION = 1
+    header = struct.Struct('<4sHHIQ12x')
+    entry = struct.Struct('<32sQQ')
+
+    def __init__(self, filename):
+        self.file_ = open(filename, 'rb')
+        self.mm = mmap.mmap(self.file_.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, _, nnodes, nsamples = \
+            self.header.unpack_from(self.mm, 0)
+        if magic != self.MAGIC or version != self.VERSION:
+            self.close()
+            raise Exception('%s is not a mobility trace' % filename)
+        self.names = []
+        first = np.empty(nnodes, dtype=np.int64)
+        count = np.empty(nnodes, dtype=np.int64)
+        for n in range(nnodes):
+            name, first[n], count[n] = self.entry.unpack_from(
+                self.mm, self.header.size + n * self.entry.size)
+            self.names.append(name.rstrip(b'\0').decode())
+        if nnodes and not count.min():
+            self.close()
+            raise Exception('%s: node %s has no samples'
+                            % (filename, self.names[int(count.argmin())]))
+        off = self.header.size + nnodes * self.entry.size
+        self.time = np.frombuffer(self.mm, np.float64, nsamples, off)
+        off += 8 * nsamples
+        self.x = np.frombuffer(self.mm, np.float32, nsamples, off)
+        self.y = np.frombuffer(self.mm, np.float32, nsamples, off + 4 * nsamples)
+        self.z = np.frombuffer(self.mm, np.float32, nsamples, off + 8 * nsamples)
+        self.first, self.last = first, first + count - 1
+        self.start = float(self.time[first].min()) if nsamples else 0.0
+        self.end = float(self.time[self.last].max()) if nsamples else 0.0
+        self.steps = int(count.max()).bit_length() if nnodes else 0
+
+    def seek(self, t):
+        """Index of the last sample at or before t, per node: a binary
+        search of all nodes at once in the mapped time column, which
+        reads log2(samples) pages per node and copies nothing"""
+        lo, hi = self.first.copy(), self.last + 1
+        for _ in range(self.steps):
+            mid = (lo + hi) // 2
+            open_ = lo < hi
+            before = open_ & (self.time[np.minimum(mid, self.last)] <= t)
+            lo = np.where(before, mid + 1, lo)
+            hi = np.where(open_ & ~before, mid, hi)
+        return np.clip(lo - 1, self.first, self.last)
+
+    def positions(self, t):
+        "Interpolated (nnodes, 3) positions at time t"
+        i = self.seek(t)
+        j = np.minimum(i + 1, self.last)
+        t0, t1 = self.time[i], self.time[j]
+        dt = np.where(t1 > t0, t1 - t0, 1.0)
+        f = np.clip((t - t0) / dt, 0.0, 1.0)
+        pos = np.empty((len(i), 3))
+        for col, arr in enumerate((self.x, self.y, self.z)):
+            a, b = arr[i], arr[j]
+            pos[:, col] = a + (b - a) * f
+        return pos
+
+    def close(self):
+        for attr in ('time', 'x', 'y', 'z'):
+            setattr(self, attr, None)
+        self.mm.close()
+        self.file_.close()
+
+    @classmethod
+    def convert(cls, traces, filename, rate=1.0, timestamp=False):
+        """Converts text traces into a binary trace
+        :param traces: dict of node name to text file; each line holds
+            'x y [z]' or, with timestamp=True, 't x y [z]'; every file
+            needs a sample and every name at most 32 bytes
+        :param filename: output file
+        :param rate: samples per second of traces without timestamps"""
+        names, columns = [], []
+        for name, textfile in traces.items():
+            if len(name.encode()) > 32:
+                raise Exception('%s: traces hold node names of up to 32 '
+                                'bytes' % name)
+            data = np.loadtxt(textfile, ndmin=2, dtype=np.float64)
+            if not len(data):
+                raise Exception('%s: no samples for %s' % (textfile, name))
+            if timestamp:
+                t, data = data[:, 0], data[:, 1:]
+            else:
+                t = np.arange(len(data), dtype=np.float64) / rate
+            z = data[:, 2] if data.shape[1] > 2 else np.zeros(len(data))
+            order = np.argsort(t, kind='stable')
+            columns.append((t[order], data[order, 0], data[order, 1],
+                            z[order]))
+            names.append(name)
+        nsamples = sum(len(c[0]) for c in columns)
+        with open(filename, 'wb') as out:
+            out.write(cls.header.pack(cls.MAGIC, cls.VERSION, 0,
+                                      len(names), nsamples))
+            first = 0
+            for name, c in zip(names, columns):
+                out.write(cls.entry.pack(name.encode(), first, len(c[0])))
+                first += len(c[0])
+            for col, dtype in enumerate(('<f8', '<f4', '<f4', '<f4')):
+                for c in columns:
+                    out.write(np.asarray(c[col], dtype=dtype).tobytes())
 
 
 class ReplayingMobility(Mobility):
 
     timestamp = False
     net = None
-
-    def __init__(self, net, nodes=None):
+    trace = None
+
+    def __init__(self, net, nodes=None, trace=None, interval=0.1,
+                 speedup=1.0):
+        """:param trace: binary trace (see BinaryTrace); nodes are
+            matched by name and moved to their interpolated position
+            every interval seconds of real time
+        :param speedup: trace seconds replayed per second of the
+            (possibly fast-forwarded) virtual clock"""
         self.net = net
-        Mobility.thread_ = thread(name='replayingMobility', target=self.mobility,
+        self.interval = interval
+        self.speedup = speedup
+        if trace:
+            self.trace = BinaryTrace(trace) if isinstance(trace, str) else trace
+            self.seek(self.trace.start)
+            target = self.replay_trace
+        else:
+            target = self.mobility
+        Mobility.thread_ = thread(name='replayingMobility', target=target,
                                   args=(nodes,))
         Mobility.thread_.daemon = True
         Mobility.thread_._keep_alive = True
         Mobility.thread_.start()
 
+    def seek(self, time_):
+        "Jumps to trace time time_"
+        self.virtual_start = time_
+        self.real_start = VirtualClock.now()
+
+    def now(self):
+        return self.virtual_start + \
+            (VirtualClock.now() - self.real_start) * self.speedup
+
+    def replay_trace(self, nodes):
+        if nodes is None:
+            nodes = self.net.stations + self.net.aps
+        byname = dict((node.name, node) for node in nodes)
+        ids, traced = [], []
+        for id, name in enumerate(self.trace.names):
+            if name in byname:
+                ids.append(id)
+                traced.append(byname[name])
+        for node in traced:
+            if isinstance(node, Station) and node not in self.stations:
+                self.stations.append(node)
+            if isinstance(node, AP) and node not in self.aps:
+                self.aps.append(node)
+        ids = np.array(ids, dtype=np.intp)
+
+        if self.net.draw:
+            self.net.isReplaying = False
+            self.net.check_dimension(traced)
+
+        last = None
+        while self.thread_._keep_alive:
+            time_ = self.now()
+            pos = self.trace.positions(time_)[ids]
+            moved = range(len(traced)) if last is None else \
+                np.flatnonzero((pos != last).any(axis=1))
+            nodes_ = [traced[n] for n in moved]
+            self.set_positions(nodes_, pos[moved].tolist())
+            if self.net.draw:
+                for node in nodes_:
+                    node.update_2d()
+            last = pos
+            if nodes_:
+                ConfigMobLinks(nodes_)
+            if self.net.draw:
+                PlotGraph.pause()
+            if time_ >= self.trace.end:
+                break
+            VirtualClock.sleep(self.interval)
+        info("\nReplaying Process Finished!")
+
     def timestamp_(self, node, time_):
         if time_ >= float(node.time[0]):
             pos = node.p[0]
@@ -60,7 +246,7 @@ def mobility(self, nodes):
             self.net.isReplaying = False
             self.net.check_dimension(nodes)
 
-        currentTime = time()
+        self.seek(0)
         for node in nodes:
             if 'speed' not in node.params:
                 node.params['speed'] = 1.0
@@ -72,7 +258,7 @@ def mobility(self, nodes):
         calc_pos = self.timestamp_ if self.timestamp else self.notimestamp_
 
         while self.thread_._keep_alive:
-            time_ = time() - currentTime
+            time_ = self.now()
             if len(nodes) == 0:
                 break
             for node in nodes:
@@ -85,6 +271,14 @@ def mobility(self, nodes):
                         node.update_2d()
             if self.net.draw:
                 PlotGraph.pause()
+            # sleep on the clock until the next sample is due, so idle
+            # stretches are fast-forwarded instead of busy-waited
+            due = [float(node.time[0]) if self.timestamp else node.currentTime
+                   for node in nodes if getattr(node, 'p', None) and
+                   (not self.timestamp or node.time)]
+            wait = (min(due) - self.now()) / self.speedup if due else 0
+            if wait > 0:
+                VirtualClock.sleep(wait)
 
 
 class ReplayingBandwidth(Mobility):
@@ -212,6 +406,7 @@ def set_pos(self, sta, ap, dist, ang):
         x = float('%.2f' % (dist * cos(ang) + int(ap.position[0])))
         y = float('%.2f' % (dist * sin(ang) + int(ap.position[1])))
         sta.position = x, y, 0
+        SINREngine.moved(sta)
         ConfigMobLinks(sta)
         if self.net.draw:
             try:
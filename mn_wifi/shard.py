@@ -0,0 +1,230 @@
+"""
+    Sharded range evaluation. The plane is cut into vertical strips with
+    the same number of stations each, and every strip is served by a
+    worker process: per mobility tick it computes the distances from its
+    stations to the APs within reach of the strip and the APs in range,
+    and sends the position updates of its stations to wmediumd over its
+    own connection. Strip edges follow the stations every tick, so a node
+    crossing a border is simply evaluated by the neighbouring worker on
+    the next tick. The main process only applies the outcome (handover,
+    rssi, tc) for the APs actually in range.
+"""
+
+import json
+import sys
+from multiprocessing import shared_memory, resource_tracker
+from subprocess import Popen, PIPE, TimeoutExpired
+from threading import RLock
+
+import numpy as np
+from mininet.log import debug
+
+from mn_wifi.wmediumdConnector import w_server, w_shm, w_cst, wmediumd_mode
+
+
+ROWS = 1024  # stations per distance block in a worker
+
+
+def shard_arrays(shm, n, m, k, width):
+    """Station positions, AP interfaces (x, y, z, range), strip edges and
+    the in-range AP interfaces (index, distance) of every station"""
+    arrays, offset = [], 0
+    for shape, dtype in (((n, 3), np.float64), ((m, 4), np.float64),
+                         ((k + 1,), np.float64), ((n, width), np.float64),
+                         ((n, width), np.int32)):
+        array = np.ndarray(shape, dtype=dtype, buffer=shm.buf, offset=offset)
+        offset += array.nbytes
+        arrays.append(array)
+    return arrays
+
+
+def shard_size(n, m, k, width):
+    return 8 * (3 * n + 4 * m + k + 1 + n * width) + 4 * n * width + 8
+
+
+class ShardPool(object):
+
+    enabled = False
+    count = 1
+    width = 16  # in-range APs kept per station; doubled when one fills up
+    min_nodes = 128  # shorter node lists are evaluated in the main process
+    lock = RLock()  # one tick at a time; mobility, replays and the API tick
+    key = None
+    nodes = []
+    index = {}
+    ap_intfs = []
+    ap_nodes = []
+    medium = False
+    shm = None
+    procs = []
+    pos = aps = edges = dist = near = None
+
+    @classmethod
+    def ensure(cls, stations, aps, ap_intfs):
+        "(Re)starts the workers when the stations or AP interfaces change"
+        key = (tuple(map(id, stations)), tuple(map(id, ap_intfs)))
+        if key != cls.key:
+            cls.stop_workers()
+            cls.start(stations, aps, ap_intfs)
+            cls.key = key
+
+    @classmethod
+    def start(cls, stations, aps, ap_intfs):
+        cls.nodes = [node for node in stations if node not in aps]
+        cls.index = {node: i for i, node in enumerate(cls.nodes)}
+        cls.ap_intfs = ap_intfs
+        cls.ap_nodes = [ap_intf.node for ap_intf in ap_intfs]
+        n, m, k = len(cls.nodes), len(ap_intfs), cls.count
+        cls.shm = shared_memory.SharedMemory(
+            create=True, size=shard_size(n, m, k, cls.width))
+        cls.pos, cls.aps, cls.edges, cls.dist, cls.near = \
+            shard_arrays(cls.shm, n, m, k, cls.width)
+
+        # with wmediumd_shm the main process already writes positions to
+        # shared memory; otherwise each worker opens its own socket
+        cls.medium = wmediumd_mode.mode == w_cst.INTERFERENCE_MODE and \
+            not w_shm.enabled and w_server.connected
+        macs = [[wmIface.get_mac() for wmIface in getattr(node, 'wmIfaces', [])]
+                for node in cls.nodes] if cls.medium else []
+        uds = w_server.sock.getpeername() if cls.medium else None
+        debug('Starting %d shard workers for %d stations\n' % (k, n))
+        for shard in range(k):
+            # a fresh interpreter: not a fork of this threaded process
+            proc = Popen([sys.executable, '-m', 'mn_wifi.shard'],
+                         stdin=PIPE, stdout=PIPE)
+            proc.stdin.write(json.dumps(dict(
+                shm_name=cls.shm.name, n=n, m=m, k=k, width=cls.width,
+                shard=shard, macs=macs, uds=uds)).encode() + b'\n')
+            proc.stdin.flush()
+            cls.procs.append(proc)
+
+    @classmethod
+    def sends(cls, node):
+        "True when a worker sends the positions of node to wmediumd"
+        return cls.medium and node in cls.index
+
+    @classmethod
+    def grow(cls):
+        "More in-range APs per station from the next tick on"
+        with cls.lock:
+            cls.width *= 2
+            cls.key = None
+
+    @classmethod
+    def tick(cls, stations, aps, ap_intfs):
+        """Runs one evaluation on all workers; returns the station index,
+        the AP interfaces and nodes, and copies of near and dist, which
+        the next tick overwrites"""
+        with cls.lock:
+            cls.ensure(stations, aps, ap_intfs)
+            cls.evaluate()
+            return (cls.index, cls.ap_intfs, cls.ap_nodes,
+                    cls.near.copy(), cls.dist.copy())
+
+    @classmethod
+    def evaluate(cls):
+        cls.pos[:] = [(p[0], p[1], p[2] if len(p) > 2 else 0.0)
+                      for p in (node.position for node in cls.nodes)]
+        cls.aps[:] = [(float(node.position[0]), float(node.position[1]),
+                       float(node.position[2]) if len(node.position) > 2
+                       else 0.0, ap_intf.range)
+                      for node, ap_intf in zip(cls.ap_nodes, cls.ap_intfs)]
+        if len(cls.nodes):
+            cls.edges[:] = np.quantile(cls.pos[:, 0],
+                                       np.linspace(0, 1, cls.count + 1))
+        cls.edges[0], cls.edges[-1] = -np.inf, np.inf
+        for proc in cls.procs:
+            proc.stdin.write(b'\n')
+            proc.stdin.flush()
+        for shard, proc in enumerate(cls.procs):
+            if not proc.stdout.readline():
+                raise Exception('shard worker %d exited with code %s'
+                                % (shard, proc.wait()))
+
+    @classmethod
+    def stop(cls):
+        with cls.lock:
+            cls.stop_workers()
+
+    @classmethod
+    def stop_workers(cls):
+        for proc in cls.procs:
+            try:
+                proc.stdin.close()
+                proc.wait(2)
+            except (OSError, TimeoutExpired):
+                proc.terminate()
+        if cls.shm:
+            cls.pos = cls.aps = cls.edges = cls.dist = cls.near = None
+            cls.shm.close()
+            cls.shm.unlink()
+        cls.shm = cls.key = None
+        cls.procs, cls.nodes, cls.ap_intfs, cls.ap_nodes = [], [], [], []
+        cls.index = {}
+        cls.medium = False
+
+
+def evaluate(pos, aps, lo, hi, width, near, dist):
+    "In-range AP interfaces of the stations in [lo, hi), ordered by index"
+    rows = np.flatnonzero((pos[:, 0] >= lo) & (pos[:, 0] < hi))
+    near[rows] = -1
+    dist[rows] = np.inf
+    if not len(aps) or not len(rows):
+        return rows
+    reach = aps[:, 3].max()
+    cand = np.flatnonzero((aps[:, 0] >= lo - reach) & (aps[:, 0] <= hi + reach))
+    if not len(cand):
+        return rows
+    keep = min(width, len(cand))
+    for block in range(0, len(rows), ROWS):
+        sub = rows[block:block + ROWS]
+        # rounded as Node_wifi.get_distance_to, compared as check_in_range
+        d = np.round(np.sqrt(((pos[sub, None, :] - aps[None, cand, :3]) ** 2)
+                             .sum(axis=2)), 2)
+        d[d > aps[cand, 3]] = np.inf
+        idx = np.argpartition(d, keep - 1, axis=1)[:, :keep] \
+            if keep < len(cand) else np.tile(np.arange(len(cand)), (len(sub), 1))
+        idx.sort(axis=1)
+        sel = np.take_along_axis(d, idx, axis=1)
+        near[sub, :keep] = np.where(np.isfinite(sel), cand[idx], -1)
+        dist[sub, :keep] = sel
+    return rows
+
+
+def work(shm_name, n, m, k, width, shard, macs, uds):
+    "Body of a shard worker: one evaluation per line read from stdin"
+    shm = shared_memory.SharedMemory(name=shm_name)
+    # the main process owns the segment and unlinks it
+    resource_tracker.unregister(shm._name, 'shared_memory')
+    pos, aps, edges, dist, near = shard_arrays(shm, n, m, k, width)
+    refs, sent = None, None
+    if uds:
+        from mn_wifi.wmediumdConnector import WmediumdIntfRef, w_pos
+        w_server.connect(uds)
+        refs = [[WmediumdIntfRef('', '', mac) for mac in node_macs]
+                for node_macs in macs]
+        sent = np.full((n, 3), np.nan)
+
+    while sys.stdin.readline():
+        rows = evaluate(pos, aps, edges[shard], edges[shard + 1], width,
+                        near, dist)
+        if refs is not None:
+            moved = rows[(pos[rows] != sent[rows]).any(axis=1)]
+            sent[moved] = pos[moved]
+            updates = [w_pos(ref, [x + id, y, z])
+                       for row, (x, y, z) in zip(moved, pos[moved].tolist())
+                       for id, ref in enumerate(refs[row])]
+            if updates:
+                w_server.update_positions(updates)
+        sys.stdout.write('\n')
+        sys.stdout.flush()
+
+    debug('shard worker %d exits\n' % shard)
+    if uds:
+        w_server.sock.close()
+    del pos, aps, edges, dist, near
+    shm.close()
+
+
+if __name__ == '__main__':
+    work(**json.loads(sys.stdin.readline()))
@@ -0,0 +1,345 @@
+"""
+    Co-channel SINR. For every channel in use the engine keeps the
+    received power between all interfaces on that channel (mW, transmitter
+    x receiver) and, per receiver, the sum weighted by how often each
+    transmitter is on the air. Each tick only the interfaces that moved or
+    changed txpower/gain are recomputed, as one row (as a transmitter) and
+    one column (as a receiver) of their channel, so the cost is changed
+    interfaces x co-channel interfaces. An interface joining or leaving
+    a channel (association, disconnection, setChannel) adds or drops its
+    row and column the same way. A tick only looks at the interfaces
+    marked by the hooks that move nodes or change their txpower, gain,
+    channel or association (SINREngine.moved/touch), never at all of
+    them. The SINR of a station towards an AP then feeds the AP choice,
+    association control and a rate estimate.
+"""
+
+from threading import Lock
+
+import numpy as np
+
+from mn_wifi.coverage import MODELS, loss
+from mn_wifi.metrics import Metrics
+from mn_wifi.propagationModels import PropagationModel as ppm
+
+
+# 802.11a/g rates (Mbps) and the SINR (dB) they need; other modes scale
+# the rate with their nominal maximum (IntfWireless.getRate)
+RATES = ((4, 6), (5, 9), (7, 12), (9, 18), (12, 24), (16, 36), (20, 48),
+         (21, 54))
+
+
+def dbm_to_mw(dbm):
+    return 10 ** (np.asarray(dbm, dtype=float) / 10)
+
+
+class Channel(object):
+    """Received power between the interfaces of one channel; arrays keep
+    spare capacity so members join and leave without a rebuild"""
+
+    def __init__(self, intfs):
+        self.intfs = list(intfs)
+        self.index = dict((intf, k) for k, intf in enumerate(self.intfs))
+        n = self.n = len(self.intfs)
+        self.allocate(max(n, 8))
+        self.state = [None] * n
+        for k, intf in enumerate(self.intfs):
+            self.load(k, intf)
+        for k in range(n):
+            self.power[k, :n] = self.received(k, np.arange(n), row=True)
+        np.fill_diagonal(self.power, 0)
+        self.interference[:n] = self.act[:n] @ self.power[:n, :n]
+        self.refreshes = 0
+
+    def allocate(self, cap):
+        "(Re)sizes the arrays to cap interfaces, keeping the first n"
+        n = self.n if hasattr(self, 'power') else 0
+        arrays = dict(pos=np.zeros((cap, 3)),
+                      tx=np.zeros(cap),  # txpower + gain, dBm
+                      rx=np.zeros(cap),  # gain, dB
+                      act=np.zeros(cap),  # share of time on the air
+                      interference=np.zeros(cap),  # mW, per receiver
+                      power=np.zeros((cap, cap)))  # mW, [transmitter, receiver]
+        for name, array in arrays.items():
+            if n:
+                old = getattr(self, name)
+                array[(slice(0, n),) * array.ndim] = \
+                    old[(slice(0, n),) * array.ndim]
+            setattr(self, name, array)
+
+    @staticmethod
+    def state_of(intf):
+        return (tuple(intf.node.position[:3]), intf.txpower,
+                intf.antennaGain, SINREngine.activity(intf))
+
+    def load(self, k, intf):
+        state = self.state_of(intf)
+        self.state[k] = state
+        self.pos[k] = [float(v) for v in state[0]] + [0.0] * (3 - len(state[0]))
+        self.tx[k] = float(intf.txpower) + float(intf.antennaGain)
+        self.rx[k] = float(intf.antennaGain)
+        self.act[k] = state[3]
+
+    def received(self, k, others, row):
+        """mW from k to others (row) or from others to k"""
+        dist = np.round(np.sqrt(((self.pos[others] - self.pos[k]) ** 2)
+                                .sum(axis=1)), 2)
+        intf = self.intfs[k]
+        if ppm.model in MODELS:
+            lost = loss(intf.freq, intf.freq, dist)
+            rssi = (self.tx[k] + self.rx[others] if row
+                    else self.tx[others] + self.rx[k]) - lost
+        else:
+            rssi = [ppm(self.intfs[o], intf, d).rssi if row
+                    else ppm(intf, self.intfs[o], d).rssi
+                    for o, d in zip(others, dist.tolist())]
+        return dbm_to_mw(rssi)
+
+    def place(self, k):
+        """Computes what interface k sends and receives and adds its
+        share to the interference of the others"""
+        n = self.n
+        others = np.arange(n)
+        row = self.received(k, others, row=True)
+        col = self.received(k, others, row=False)
+        row[k] = col[k] = 0
+        self.power[k, :n] = row
+        self.power[:n, k] = col
+        self.interference[:n] += self.act[k] * row
+        self.interference[k] = self.act[:n] @ col
+
+    def refresh(self, k):
+        "Recomputes what interface k sends and receives"
+        n = self.n
+        self.interference[:n] -= self.act[k] * self.power[k, :n]
+        self.load(k, self.intfs[k])
+        self.place(k)
+        self.settle()
+
+    def add(self, intf):
+        "intf joins the channel"
+        if self.n == len(self.act):
+            self.allocate(2 * self.n)
+        k = self.n
+        self.n += 1
+        self.intfs.append(intf)
+        self.index[intf] = k
+        self.state.append(None)
+        self.load(k, intf)
+        self.place(k)
+        self.settle()
+
+    def remove(self, intf):
+        "intf leaves the channel; the last member takes its place"
+        k = self.index.pop(intf)
+        n = self.n
+        last = n - 1
+        self.interference[:n] -= self.act[k] * self.power[k, :n]
+        if k != last:
+            moved = self.intfs[last]
+            self.power[k, :n] = self.power[last, :n]
+            self.power[:n, k] = self.power[:n, last]
+            self.power[k, k] = 0
+            for array in (self.pos, self.tx, self.rx, self.act,
+                          self.interference):
+                array[k] = array[last]
+            self.intfs[k], self.state[k] = moved, self.state[last]
+            self.index[moved] = k
+        self.intfs.pop()
+        self.state.pop()
+        self.n = last
+        self.settle()
+
+    def settle(self):
+        self.refreshes += 1
+        if self.refreshes > 4 * self.n:
+            # drop the rounding the increments pile up
+            n = self.n
+            self.interference[:n] = self.act[:n] @ self.power[:n, :n]
+            self.refreshes = 0
+
+    def column(self, intf):
+        "mW from every interface of the channel to intf, not a member"
+        n = self.n
+        pos = [float(v) for v in intf.node.position[:3]]
+        dist = np.round(np.sqrt(((self.pos[:n] - pos) ** 2).sum(axis=1)), 2)
+        if ppm.model in MODELS:
+            freq = self.intfs[0].freq
+            rssi = self.tx[:n] + float(intf.antennaGain) - \
+                loss(freq, freq, dist)
+        else:
+            rssi = [ppm(intf, self.intfs[o], d).rssi
+                    for o, d in zip(range(n), dist.tolist())]
+        return dbm_to_mw(rssi)
+
+    def sinr(self, intf, ap_intf):
+        "SINR (dB) of intf receiving ap_intf, a member of this channel"
+        t = self.index[ap_intf]
+        r = self.index.get(intf)
+        if r is not None:
+            signal = self.power[t, r]
+            noise = self.interference[r] - self.act[t] * signal
+        else:
+            col = self.column(intf)
+            signal = col[t]
+            noise = self.act[:self.n] @ col - self.act[t] * signal
+        noise += dbm_to_mw(ppm.noise_th)
+        return 10 * np.log10(max(signal, 1e-30) / noise)
+
+
+class SINREngine(object):
+
+    enabled = False
+    ap_activity = 1.0  # APs count as always on the air
+    sta_activity = 0.0  # stations, unless intf.activity is set
+    channels = {}  # channel -> Channel
+    member = {}  # intf -> channel it belongs to
+    dirty = set()  # interfaces changed since the last update
+    gone = set()  # interfaces of deleted nodes
+    lock = Lock()
+    built = False
+    refreshed = 0  # interfaces recomputed
+    rebuilt = 0  # channels rebuilt
+
+    @classmethod
+    def touch(cls, *intfs):
+        "Marks interfaces whose txpower, gain, channel or association changed"
+        if cls.enabled:
+            with cls.lock:
+                cls.dirty.update(intfs)
+
+    @classmethod
+    def moved(cls, *nodes):
+        "Marks the interfaces of nodes that moved"
+        if cls.enabled:
+            with cls.lock:
+                for node in nodes:
+                    cls.dirty.update(getattr(node, 'wintfs', {}).values())
+
+    @classmethod
+    def forget(cls, *nodes):
+        "Drops the interfaces of deleted nodes at the next update"
+        if cls.enabled:
+            with cls.lock:
+                for node in nodes:
+                    intfs = getattr(node, 'wintfs', {}).values()
+                    cls.dirty.update(intfs)
+                    cls.gone.update(intfs)
+
+    @staticmethod
+    def channel_of(intf):
+        "Channel intf is on the air on, None when it is not"
+        if not hasattr(intf.node, 'position'):
+            return None
+        try:
+            chan = int(intf.channel)
+        except (TypeError, ValueError):
+            return None
+        return chan if chan > 0 else None  # 0: disconnected
+
+    @classmethod
+    def activity(cls, intf):
+        from mn_wifi.link import master
+        value = getattr(intf, 'activity', None)
+        if value is not None:
+            return float(value)
+        return cls.ap_activity if isinstance(intf, master) else cls.sta_activity
+
+    @classmethod
+    def build(cls, *groups):
+        "Channels from scratch, for the interfaces of groups of nodes"
+        members = {}
+        for nodes in groups:
+            for node in nodes:
+                for intf in getattr(node, 'wintfs', {}).values():
+                    chan = cls.channel_of(intf)
+                    if chan is not None:
+                        members.setdefault(chan, {})[intf] = None
+        cls.channels = dict((chan, Channel(list(intfs)))
+                            for chan, intfs in members.items())
+        cls.member = dict((intf, chan) for chan, intfs in members.items()
+                          for intf in intfs)
+        cls.rebuilt += len(cls.channels)
+        cls.built = True
+
+    @classmethod
+    def rebuild(cls):
+        "Builds the channels from scratch at the next update"
+        cls.built = False
+
+    @classmethod
+    def update(cls, *groups):
+        """Brings the channels up to date with the marked interfaces; the
+        first call builds them from the interfaces of groups of nodes"""
+        with cls.lock:
+            dirty, cls.dirty = cls.dirty, set()
+            gone, cls.gone = cls.gone, set()
+        if not cls.built:
+            cls.build(*groups)
+            return
+        refreshed = 0
+        for intf in dirty:
+            chan = None if intf in gone else cls.channel_of(intf)
+            old = cls.member.get(intf)
+            if old is not None and old != chan:
+                # a station changes channel on every association and
+                # disconnection: one row and column each, not a rebuild
+                table = cls.channels[old]
+                table.remove(intf)
+                del cls.member[intf]
+                if not table.n:
+                    del cls.channels[old]
+                refreshed += 1
+            if chan is None:
+                continue
+            table = cls.channels.get(chan)
+            if table is None:
+                cls.channels[chan] = Channel([intf])
+                cls.rebuilt += 1
+            elif intf not in table.index:
+                table.add(intf)
+            else:
+                k = table.index[intf]
+                if table.state[k] == Channel.state_of(intf):
+                    continue
+                table.refresh(k)
+            cls.member[intf] = chan
+            refreshed += 1
+        cls.refreshed += refreshed
+        Metrics.inc('mn_wifi_sinr_refreshes', refreshed)
+
+    @classmethod
+    def sinr(cls, intf, ap_intf):
+        "SINR (dB) of intf towards ap_intf, None if ap_intf is unknown"
+        try:
+            table = cls.channels.get(int(ap_intf.channel))
+        except (TypeError, ValueError):
+            return None
+        if table is None or ap_intf not in table.index:
+            return None
+        return float(table.sinr(intf, ap_intf))
+
+    @classmethod
+    def best(cls, intf, aps):
+        "aps ordered by the best SINR of their interfaces, highest first"
+        def score(ap):
+            values = [cls.sinr(intf, ap_intf) for ap_intf in ap.wintfs.values()]
+            values = [v for v in values if v is not None]
+            return max(values) if values else -np.inf
+        return sorted(aps, key=score, reverse=True)
+
+    @staticmethod
+    def rate(intf, sinr):
+        "Estimated PHY rate (Mbps) at sinr"
+        best = 0
+        for need, rate in RATES:
+            if sinr >= need:
+                best = rate
+        nominal = intf.getRate() or 54
+        return best * nominal / 54.0
+
+    @classmethod
+    def stop(cls):
+        cls.channels, cls.member, cls.dirty, cls.gone = {}, {}, set(), set()
+        cls.built = False
+        cls.refreshed = cls.rebuilt = 0
@@ -4,8 +4,12 @@
 
 from mininet.log import info
 from mn_wifi.mobility import Mobility
+from mn_wifi.shard import ShardPool
+from mn_wifi.sinr import SINREngine
+from mn_wifi.sumo.subscription import VehicleStream
 from mn_wifi.sumo.sumolib.sumolib import checkBinary
 from mn_wifi.sumo.traci import main as traci, _vehicle
+from mn_wifi.wmediumdConnector import w_server
 
 
 class sumo(Mobility):
@@ -64,20 +68,24 @@ def start(self, cars, config_file, clients, port,
         vehCmds = _vehicle.VehicleDomain()
         vehCmds._connection = traci.getConnection(label="default")
         self.set_mob_started()
+        stream = VehicleStream(vehCmds._connection, vehCmds.getIDList())
         while True:
-            traci.simulationStep()
-            for vehID1 in vehCmds.getIDList():
-                x1 = vehCmds.getPosition(vehID1)[0]
-                y1 = vehCmds.getPosition(vehID1)[1]
-
+            wpos = []
+            for vehID1 in stream.step():
                 vehID = int(vehID1.replace('.0',''))
                 if vehID < len(cars):
-                    cars[vehID].position = x1, y1, 0
-                    cars[vehID].set_pos_wmediumd(cars[vehID].position)
-
-                    if hasattr(cars[vehID], 'sumo'):
-                        if cars[vehID].sumo:
-                            args = [cars[vehID].sumoargs]
-                            cars[vehID].sumo(vehID, vehCmds, *args)
-                            del cars[vehID].sumo
-
+                    x1, y1, speed = stream.vehicles[vehID1]
+                    car = cars[vehID]
+                    car.position = x1, y1, 0
+                    car.speed = speed * 3.6  # km/h
+                    if not ShardPool.sends(car):
+                        wpos += car.get_pos_wmediumd(car.position)
+                    SINREngine.moved(car)
+
+                    if hasattr(car, 'sumo'):
+                        if car.sumo:
+                            args = [car.sumoargs]
+                            car.sumo(vehID, vehCmds, *args)
+                            del car.sumo
+            if wpos:
+                w_server.update_positions(wpos)
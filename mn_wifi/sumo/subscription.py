@@ -0,0 +1,188 @@
+"""
+    Vehicle positions and speeds through TraCI variable subscriptions:
+    one message per simulation step carries the subscriptions of the
+    vehicles that just departed and the step itself, and its response
+    carries the values of every vehicle. The response is read into a
+    reusable buffer and decoded in place.
+"""
+
+import struct
+
+from mn_wifi.sumo.traci import constants as tc
+from mn_wifi.sumo.traci.exceptions import TraCIException, FatalTraCIError
+
+
+i32 = struct.Struct('!i')
+u8 = struct.Struct('!B')
+f64 = struct.Struct('!d')
+pos2d = struct.Struct('!dd')
+cmd_hdr = struct.Struct('!BB')
+long_cmd_hdr = struct.Struct('!BiB')
+sub_hdr = struct.Struct('!dd')
+
+VEHICLE_VARS = (tc.VAR_POSITION, tc.VAR_SPEED)
+SIM_VARS = (tc.VAR_DEPARTED_VEHICLES_IDS, tc.VAR_ARRIVED_VEHICLES_IDS)
+
+# sizes of the fixed size values that may show up in other subscriptions
+FIXED = {tc.TYPE_UBYTE: 1, tc.TYPE_BYTE: 1, tc.TYPE_INTEGER: 4,
+         tc.TYPE_DOUBLE: 8, tc.POSITION_2D: 16, tc.POSITION_3D: 24,
+         tc.POSITION_LON_LAT: 16, tc.POSITION_LON_LAT_ALT: 24,
+         tc.TYPE_COLOR: 4}
+
+
+def command(cmd_id, content):
+    size = len(content) + 2
+    if size <= 255:
+        return cmd_hdr.pack(size, cmd_id) + content
+    return long_cmd_hdr.pack(0, size + 4, cmd_id) + content
+
+
+def subscribe(cmd_id, obj_id, var_ids):
+    obj_id = obj_id.encode('latin1')
+    return command(cmd_id, sub_hdr.pack(tc.INVALID_DOUBLE_VALUE,
+                                        tc.INVALID_DOUBLE_VALUE) +
+                   i32.pack(len(obj_id)) + obj_id +
+                   u8.pack(len(var_ids)) + bytes(var_ids))
+
+
+class VehicleStream(object):
+    """Keeps self.vehicles, vehicle id to [x, y, speed], up to date.
+    Uses the socket of an established traci connection, which must not
+    be used by anybody else while step() runs"""
+
+    def __init__(self, conn, vehicles=()):
+        self.sock = conn._socket
+        self.buf = bytearray(1 << 16)
+        self.vehicles = {}
+        self.departed = []
+        self.arrived = []
+        self.step_cmd = command(tc.CMD_SIMSTEP, f64.pack(0.))
+        self.exchange(subscribe(tc.CMD_SUBSCRIBE_SIM_VARIABLE, '', SIM_VARS) +
+                      self.subscriptions(vehicles), [])
+
+    def subscriptions(self, vehicles):
+        return b''.join(subscribe(tc.CMD_SUBSCRIBE_VEHICLE_VARIABLE,
+                                  veh, VEHICLE_VARS) for veh in vehicles)
+
+    def step(self):
+        "Runs one simulation step; returns the ids that changed"
+        msg = self.subscriptions(self.departed) + self.step_cmd
+        self.departed = []
+        self.arrived = []
+        return self.exchange(msg, [])
+
+    def exchange(self, msg, changed):
+        self.sock.sendall(i32.pack(len(msg) + 4) + msg)
+        view = self.recv()
+        off, end = 0, len(view)
+        while off < end:
+            cmd_id, off = self.status(view, off)
+            if cmd_id == tc.CMD_SIMSTEP:
+                n, = i32.unpack_from(view, off)
+                off += 4
+                for _ in range(n):
+                    off = self.read_subscription(view, off, changed)
+            else:
+                off = self.read_subscription(view, off, changed)
+        view.release()
+        for veh in self.arrived:
+            self.vehicles.pop(veh, None)
+        return changed
+
+    def recv(self):
+        "Reads one message into self.buf, without its length"
+        self.recv_into(0, 4)
+        length = i32.unpack_from(self.buf)[0] - 4
+        if len(self.buf) < length:
+            self.buf = bytearray(max(length, 2 * len(self.buf)))
+        self.recv_into(0, length)
+        return memoryview(self.buf)[:length]
+
+    def recv_into(self, off, end):
+        view = memoryview(self.buf)
+        while off < end:
+            n = self.sock.recv_into(view[off:end])
+            if not n:
+                raise FatalTraCIError('connection closed by SUMO')
+            off += n
+        view.release()
+
+    @staticmethod
+    def string(view, off):
+        n, = i32.unpack_from(view, off)
+        off += 4
+        return bytes(view[off:off + n]).decode('latin1'), off + n
+
+    @staticmethod
+    def length(view, off):
+        "Skips the length prefix of a command or response"
+        if view[off]:
+            return off + 1
+        return off + 5
+
+    def status(self, view, off):
+        off = self.length(view, off)
+        cmd_id, result = view[off], view[off + 1]
+        err, off = self.string(view, off + 2)
+        if result != tc.RTYPE_OK:
+            raise TraCIException(cmd_id, result, err)
+        return cmd_id, off
+
+    def read_subscription(self, view, off, changed):
+        off = self.length(view, off)
+        response = view[off]
+        obj_id, off = self.string(view, off + 1)
+        nvars = view[off]
+        off += 1
+        values = None
+        if response == tc.RESPONSE_SUBSCRIBE_VEHICLE_VARIABLE:
+            values = self.vehicles.get(obj_id)
+            if values is None:
+                values = self.vehicles[obj_id] = [0., 0., 0.]
+            changed.append(obj_id)
+        for _ in range(nvars):
+            var, status, vtype = view[off], view[off + 1], view[off + 2]
+            off += 3
+            if status:
+                err, off = self.string(view, off)
+                raise TraCIException(response, status, err)
+            if values is not None and var == tc.VAR_POSITION:
+                values[0], values[1] = pos2d.unpack_from(view, off)
+                off += 16
+            elif values is not None and var == tc.VAR_SPEED:
+                values[2], = f64.unpack_from(view, off)
+                off += 8
+            elif response == tc.RESPONSE_SUBSCRIBE_SIM_VARIABLE and \
+                    var in SIM_VARS:
+                ids, off = self.string_list(view, off)
+                if var == tc.VAR_DEPARTED_VEHICLES_IDS:
+                    self.departed = ids
+                else:
+                    self.arrived = ids
+            else:
+                off = self.skip(view, off, vtype)
+        return off
+
+    def string_list(self, view, off):
+        n, = i32.unpack_from(view, off)
+        off += 4
+        ids = []
+        for _ in range(n):
+            obj_id, off = self.string(view, off)
+            ids.append(obj_id)
+        return ids, off
+
+    def skip(self, view, off, vtype):
+        "Skips a value of a subscription this stream did not make"
+        if vtype in FIXED:
+            return off + FIXED[vtype]
+        if vtype == tc.TYPE_STRING:
+            return self.string(view, off)[1]
+        if vtype == tc.TYPE_STRINGLIST:
+            return self.string_list(view, off)[1]
+        if vtype == tc.TYPE_DOUBLELIST:
+            return off + 4 + 8 * i32.unpack_from(view, off)[0]
+        if vtype == tc.TYPE_POLYGON:
+            n = view[off]
+            return off + 1 + 16 * n
+        raise FatalTraCIError('cannot skip subscribed value of type %02x' % vtype)
@@ -7,11 +7,16 @@
    * single=True - opens a single window and put all nodes together
    * data_type - refer to statistics dir at /sys/class/ieee80211/{}/device/net/{}/statistics/{}
             - other data_types: rssi - gets the rssi value
+   * record - also records tx/rx bytes and packets, rssi and position of all
+            wireless interfaces into this file (see recorder)
+   * record_interval - sampling interval of the recording (s)
 """
 
 import time
 import warnings
 import math
+import struct
+import zlib
 from PIL import Image
 from subprocess import check_output as co, PIPE
 import numpy as np
@@ -22,9 +27,12 @@
 
 from matplotlib import style
 from os import path, system as sh
-from threading import Thread as thread
+from threading import Thread as thread, local
+from queue import SimpleQueue, Empty
 from datetime import date
+from mn_wifi.metrics import Metrics
 from mn_wifi.node import AP, Aircraft, Satellite
+from mn_wifi.netlink import PhyIndex
 
 
 today = date.today()
@@ -45,6 +53,7 @@ def plot_background_image(image, axes):
 class telemetry(object):
     tx = {}
     nodes = []
+    rec = None
 
     def __init__(self, **kwargs):
         warnings.filterwarnings("ignore")
@@ -54,7 +63,10 @@ def __init__(self, **kwargs):
         parseData.thread_.start()
 
     def start(self, nodes=None, data_type='tx_packets', single=False,
-              min_x=0, min_y=0, max_x=100, max_y=100, image=None, **kwargs):
+              min_x=0, min_y=0, max_x=100, max_y=100, image=None,
+              record=None, record_interval=0.1, **kwargs):
+        if record:
+            telemetry.rec = recorder(record, nodes, interval=record_interval)
         ax = 'axes'
         arr = ''
         for node in nodes:
@@ -124,6 +136,14 @@ def get_ifaces(cls, nodes, inNamespaceNodes, phys):
 
     @classmethod
     def get_phys(cls, nodes, inNamespaceNodes):
+        if PhyIndex.enabled:
+            phys = [PhyIndex.phys_of(node) for node in nodes]
+            # a node without indexed phys (no radio, or its events have
+            # not arrived yet) takes the sysfs lookup below
+            if all(phy and phy[0] for phy in phys):
+                phys = [phy[0] for phy in phys]
+                ifaces = dict((node, PhyIndex.ifaces_of(node)) for node in nodes)
+                return phys, ifaces
         cmd = 'ls {}'.format(parseData.ieee80211_dir)
         isAP = False
         phys = []
@@ -164,9 +184,14 @@ def get_rssi(node, iface):
     return rssi
 
 
+def append_sample(filename, x, y):
+    with open(filename, 'a') as f:
+        f.write('{},{}\n'.format(x, y))
+
+
 def get_values_from_statistics(tx_bytes, time, node, filename):
     tx = telemetry.calc(float(tx_bytes[0]), node)
-    sh(parseData.echo_cmd.format(time, tx, filename.format(node)))
+    append_sample(filename.format(node), time, tx)
 
 
 class parseData(object):
@@ -189,7 +214,6 @@ class parseData(object):
     ieee80211_dir = '/sys/class/ieee80211'
     net_dir = '/{}/device/net'
     stats_dir = '/{}/statistics/{}'
-    echo_cmd = 'echo \'{},{}\' >> {}'
 
     def __init__(self, nodes, axes, single, data_type, fig, image, **kwargs):
         self.icon = kwargs.get("icon", None)
@@ -331,7 +355,7 @@ def animate(self, i):
                     if node.name not in names:
                         names.append(node.name)
                     x, y, z = get_position(node)
-                    sh(self.echo_cmd.format(x, y, self.filename.format(node)))
+                    append_sample(self.filename.format(node), x, y)
 
                     x = node.position[0]
                     y = node.position[1]
@@ -345,7 +369,7 @@ def animate(self, i):
                     names.append(self.ifaces[node][wlan])
                     nodes_x[node], nodes_y[node] = [], []
                     rssi = get_rssi(node, self.ifaces[node][wlan])
-                    sh(self.echo_cmd.format(time_, rssi, self.filename.format(node)))
+                    append_sample(self.filename.format(node), time_, rssi)
                     graph_data = open('{}'.format(self.filename.format(node)), 'r').read()
                     lines = graph_data.split('\n')
                     for line in lines:
@@ -418,3 +442,235 @@ def close(self, event):
         self.thread_._keep_alive = False
         self.thread_._is_running = False
         plt.cla()
+
+
+class sample_block(object):
+    "Samples of a single producer"
+
+    def __init__(self, size, dtype):
+        self.data = np.zeros(size, dtype)
+        self.n = 0
+
+
+class recorder(object):
+    """Records timestamped samples of wireless interfaces into a
+    compressed columnar file, without spawning processes.
+
+    Every producer thread appends to its own preallocated block, so
+    add() takes no lock; full blocks are handed over to a writer thread
+    and recycled. Memory is bounded by max_blocks: when every block is
+    waiting to be written, samples are dropped and counted in drops.
+
+    usage:
+    rec = recorder('run.mntl', nodes, interval=0.1)
+    ...
+    rec.close()
+    cols, names = recorder.load('run.mntl')"""
+
+    MAGIC = b'MNTL'
+    VERSION = 1
+    DATA, NAME = 0, 1
+    header = struct.Struct('<4sHH')
+    column = struct.Struct('<16s4s')
+    block = struct.Struct('<BII')
+    dtype = np.dtype([('time', '<f8'), ('id', '<u4'),
+                      ('tx_bytes', '<u8'), ('rx_bytes', '<u8'),
+                      ('tx_packets', '<u8'), ('rx_packets', '<u8'),
+                      ('rssi', '<f4'),
+                      ('x', '<f4'), ('y', '<f4'), ('z', '<f4')])
+    proc_dir = '/proc/{}/net/{}'
+
+    def __init__(self, filename, nodes=None, interval=0.1, block_size=8192,
+                 max_blocks=64, level=1):
+        """:param nodes: nodes sampled by the internal sampler thread;
+            with None samples are only taken through add()
+        :param interval: sampling interval (s)
+        :param block_size: samples per block
+        :param max_blocks: upper bound of blocks in memory
+        :param level: zlib compression level"""
+        self.file_ = open(filename, 'wb')
+        self.file_.write(self.header.pack(self.MAGIC, self.VERSION,
+                                          len(self.dtype.names)))
+        for name in self.dtype.names:
+            self.file_.write(self.column.pack(
+                name.encode(), self.dtype[name].str.encode()))
+        self.block_size = block_size
+        self.max_blocks = max_blocks
+        self.level = level
+        self.interval = interval
+        self.ids = {}
+        self.drops = 0
+        self.written = 0
+        self.allocated = 0
+        self.local = local()
+        self.blocks = []  # blocks owned by producers
+        self.free = SimpleQueue()
+        self.full = SimpleQueue()
+        self.keep_alive = True
+        self.writer = thread(target=self.write_blocks, daemon=True)
+        self.writer.start()
+        Metrics.source('telemetry', self.metrics)
+        self.sampler = None
+        if nodes:
+            for node in nodes:
+                for intf in node.wintfs.values():
+                    self.register(intf.name)
+            self.sampler = thread(target=self.sample, args=(nodes,),
+                                  daemon=True)
+            self.sampler.start()
+
+    def register(self, name):
+        "Returns the id of an interface, recording its name once"
+        if name not in self.ids:
+            self.ids[name] = len(self.ids)
+            self.full.put((self.NAME, self.ids[name], name))
+        return self.ids[name]
+
+    def get_block(self):
+        try:
+            return self.free.get_nowait()
+        except Empty:
+            if self.allocated < self.max_blocks:
+                self.allocated += 1
+                return sample_block(self.block_size, self.dtype)
+            return None
+
+    def add(self, id, tx_bytes=0, rx_bytes=0, tx_packets=0, rx_packets=0,
+            rssi=0, position=(0, 0, 0), time_=None):
+        block = getattr(self.local, 'block', None)
+        if block is None:
+            block = self.local.block = self.get_block()
+            if block is None:
+                self.drops += 1
+                return
+            self.blocks.append(block)
+        block.data[block.n] = (time.time() if time_ is None else time_, id,
+                               tx_bytes, rx_bytes, tx_packets, rx_packets,
+                               rssi, position[0], position[1], position[2])
+        block.n += 1
+        if block.n == self.block_size:
+            self.flush()
+
+    def flush(self):
+        "Hands the block of the calling thread over to the writer"
+        block = getattr(self.local, 'block', None)
+        if block is not None:
+            self.local.block = None
+            self.blocks.remove(block)
+            if block.n:
+                self.full.put((self.DATA, block))
+            else:
+                self.free.put(block)
+
+    def write_blocks(self):
+        while True:
+            item = self.full.get()
+            if item is None:
+                break
+            if item[0] == self.NAME:
+                payload = struct.pack('<I', item[1]) + item[2].encode()
+                self.file_.write(self.block.pack(self.NAME, 0, len(payload)))
+                self.file_.write(payload)
+                continue
+            block = item[1]
+            chunks = []
+            for name in self.dtype.names:
+                chunk = zlib.compress(block.data[name][:block.n].tobytes(),
+                                      self.level)
+                chunks.append(struct.pack('<I', len(chunk)) + chunk)
+            payload = b''.join(chunks)
+            self.file_.write(self.block.pack(self.DATA, block.n, len(payload)))
+            self.file_.write(payload)
+            self.written += block.n
+            block.n = 0
+            self.free.put(block)
+
+    @classmethod
+    def read_counters(cls, pid, file_):
+        "Parses /proc/<pid>/net/{dev,wireless} into a dict per interface"
+        values = {}
+        try:
+            with open(cls.proc_dir.format(pid, file_)) as f:
+                lines = f.readlines()[2:]
+        except (IOError, OSError):
+            return values
+        for line in lines:
+            name, _, fields = line.partition(':')
+            values[name.strip()] = fields.split()
+        return values
+
+    def sample(self, nodes):
+        while self.keep_alive:
+            begin = time.time()
+            for node in nodes:
+                dev = self.read_counters(node.pid, 'dev')
+                wireless = self.read_counters(node.pid, 'wireless')
+                position = getattr(node, 'position', (0, 0, 0))
+                for intf in node.wintfs.values():
+                    stats = dev.get(intf.name)
+                    if not stats:
+                        continue
+                    rssi = 0
+                    if intf.name in wireless:
+                        rssi = float(wireless[intf.name][2].rstrip('.'))
+                    self.add(self.ids[intf.name],
+                             tx_bytes=int(stats[8]), rx_bytes=int(stats[0]),
+                             tx_packets=int(stats[9]), rx_packets=int(stats[1]),
+                             rssi=rssi, position=position, time_=begin)
+            time.sleep(max(0, self.interval - (time.time() - begin)))
+        self.flush()
+
+    def metrics(self):
+        return {'mn_wifi_telemetry_samples': self.written,
+                'mn_wifi_telemetry_drops': self.drops}
+
+    def close(self):
+        "Stops sampling and writes the pending samples"
+        Metrics.source('telemetry')
+        self.keep_alive = False
+        if self.sampler:
+            self.sampler.join()
+        for block in list(self.blocks):
+            self.blocks.remove(block)
+            if block.n:
+                self.full.put((self.DATA, block))
+        self.full.put(None)
+        self.writer.join()
+        self.file_.close()
+
+    @classmethod
+    def load(cls, filename):
+        """Reads a recording
+        :returns: dict of column arrays and dict of interface names by id"""
+        with open(filename, 'rb') as f:
+            data = f.read()
+        magic, version, ncols = cls.header.unpack_from(data, 0)
+        if magic != cls.MAGIC or version != cls.VERSION:
+            raise Exception('%s is not a telemetry recording' % filename)
+        off = cls.header.size
+        fields = []
+        for _ in range(ncols):
+            name, dtype = cls.column.unpack_from(data, off)
+            fields.append((name.rstrip(b'\0').decode(),
+                           dtype.rstrip(b'\0').decode()))
+            off += cls.column.size
+        chunks = dict((name, []) for name, _ in fields)
+        names = {}
+        while off < len(data):
+            type_, n, size = cls.block.unpack_from(data, off)
+            off += cls.block.size
+            end = off + size
+            if type_ == cls.NAME:
+                id, = struct.unpack_from('<I', data, off)
+                names[id] = data[off + 4:end].decode()
+            else:
+                for name, dtype in fields:
+                    clen, = struct.unpack_from('<I', data, off)
+                    off += 4
+                    chunks[name].append(np.frombuffer(
+                        zlib.decompress(data[off:off + clen]), dtype))
+                    off += clen
+            off = end
+        cols = dict((name, np.concatenate(chunks[name]) if chunks[name]
+                     else np.zeros(0, dtype)) for name, dtype in fields)
+        return cols, names
@@ -0,0 +1,556 @@
+#!/usr/bin/env python
+
+"""Package: mininet-wifi
+   Scale benchmarks for synthetic topologies of growing size: the time of
+   each phase of Mininet_wifi.build(), the per-tick cost of
+   Mobility.config_links, set_tc updates/s and w_server updates/s.
+
+   wmediumd is replaced by a stand-in server on a UNIX socket that
+   acknowledges every request. With --dry-run (the default when not root
+   or when mac80211_hwsim cannot be loaded) no kernel state is touched:
+   node shells, hwsim radios and shell commands are stubbed, commands are
+   only counted and sleeps are only added up, so the figures are the
+   Python side of every phase.
+
+   usage: mn_wifi/test/bench_scale.py [-s 10x1,100x10] [-t ticks]
+                                      [-u updates] [-o results.json]
+   The results file is described in doc/scale_benchmark.md"""
+
+import json
+import os
+import platform
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import zlib
+from argparse import ArgumentParser
+from threading import Thread
+from time import sleep, time, strftime
+
+import numpy as np
+
+from mininet.log import setLogLevel, info
+from mininet.net import Mininet
+from mininet.node import Node
+
+import mn_wifi.wmediumdConnector as wmd_module
+from mn_wifi.link import wmediumd, HostapdConfig
+from mn_wifi.mobility import Mobility
+from mn_wifi.module import Mac80211Hwsim
+from mn_wifi.net import Mininet_wifi, VERSION
+from mn_wifi.shard import ShardPool
+from mn_wifi.wmediumdConnector import interference, w_server, w_pos, \
+    w_txpower, w_cst, WmediumdIntfRef
+
+
+SIZES = '10x1,100x10,1000x100,5000x500'
+
+# request type: (request format, response type, extra response format)
+REQUESTS = {
+    w_cst.WSERVER_SNR_UPDATE_REQUEST_TYPE:
+        ('6s6si', w_cst.WSERVER_SNR_UPDATE_RESPONSE_TYPE, ''),
+    w_cst.WSERVER_DEL_BY_MAC_REQUEST_TYPE:
+        ('6s', w_cst.WSERVER_DEL_BY_MAC_RESPONSE_TYPE, ''),
+    w_cst.WSERVER_DEL_BY_ID_REQUEST_TYPE:
+        ('i', w_cst.WSERVER_DEL_BY_ID_RESPONSE_TYPE, ''),
+    w_cst.WSERVER_ADD_REQUEST_TYPE:
+        ('6s', w_cst.WSERVER_ADD_RESPONSE_TYPE, 'i'),
+    w_cst.WSERVER_ERRPROB_UPDATE_REQUEST_TYPE:
+        ('6s6si', w_cst.WSERVER_ERRPROB_UPDATE_RESPONSE_TYPE, ''),
+    w_cst.WSERVER_SPECPROB_UPDATE_REQUEST_TYPE:
+        ('6s6s144i', w_cst.WSERVER_SPECPROB_UPDATE_RESPONSE_TYPE, ''),
+    w_cst.WSERVER_POS_UPDATE_REQUEST_TYPE:
+        ('6sfff', w_cst.WSERVER_POS_UPDATE_RESPONSE_TYPE, ''),
+    w_cst.WSERVER_TXPOWER_UPDATE_REQUEST_TYPE:
+        ('6si', w_cst.WSERVER_TXPOWER_UPDATE_RESPONSE_TYPE, ''),
+    w_cst.WSERVER_GAIN_UPDATE_REQUEST_TYPE:
+        ('6si', w_cst.WSERVER_GAIN_UPDATE_RESPONSE_TYPE, ''),
+    w_cst.WSERVER_HEIGHT_UPDATE_REQUEST_TYPE:
+        ('6si', w_cst.WSERVER_HEIGHT_UPDATE_RESPONSE_TYPE, ''),
+    w_cst.WSERVER_GAUSSIAN_RANDOM_UPDATE_REQUEST_TYPE:
+        ('6sf', w_cst.WSERVER_GAUSSIAN_RANDOM_UPDATE_RESPONSE_TYPE, ''),
+    w_cst.WSERVER_MEDIUM_UPDATE_REQUEST_TYPE:
+        ('6si', w_cst.WSERVER_MEDIUM_UPDATE_RESPONSE_TYPE, ''),
+}
+
+
+class MockWmediumd(object):
+    """Stand-in wmediumd server: answers every request of the socket
+    protocol with WUPDATE_SUCCESS, in order, so pipelined batches work"""
+
+    def __init__(self):
+        self.path = tempfile.mktemp(prefix='mn_wmd_mock_', suffix='.sock')
+        self.requests = 0
+        self.next_id = 0
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.bind(self.path)
+        self.sock.listen(4)
+        thread = Thread(target=self.serve)
+        thread.daemon = True
+        thread.start()
+
+    def serve(self):
+        while True:
+            try:
+                conn, _ = self.sock.accept()
+            except OSError:
+                return
+            thread = Thread(target=self.handle, args=(conn,))
+            thread.daemon = True
+            thread.start()
+
+    def handle(self, conn):
+        buf = b''
+        while True:
+            data = conn.recv(65536)
+            if not data:
+                break
+            buf += data
+            out = []
+            while buf:
+                if buf[0] == w_cst.WSERVER_SHUTDOWN_REQUEST_TYPE:
+                    conn.close()
+                    return
+                fmt, resp_type, extra = REQUESTS[buf[0]]
+                size = 1 + struct.calcsize('!' + fmt)
+                if len(buf) < size:
+                    break
+                request, buf = buf[:size], buf[size:]
+                if resp_type == w_cst.WSERVER_SPECPROB_UPDATE_RESPONSE_TYPE:
+                    request = request[:13]
+                out.append(bytes([resp_type]) + request)
+                if extra:
+                    out.append(struct.pack('!i', self.next_id))
+                    self.next_id += 1
+                out.append(bytes([w_cst.WUPDATE_SUCCESS]))
+                self.requests += 1
+            if out:
+                conn.sendall(b''.join(out))
+        conn.close()
+
+    def install(self):
+        "Makes WStarter and w_server use this server instead of wmediumd"
+        self.saved = (w_server.__dict__['connect'], wmd_module.subprocess)
+        connect, path = self.saved[0].__func__, self.path
+        w_server.connect = classmethod(
+            lambda cls, uds_address=None: connect(cls, path))
+        wmd_module.subprocess = stand_in_subprocess
+
+    def close(self):
+        w_server.connect, wmd_module.subprocess = self.saved
+        self.sock.close()
+        try:
+            os.remove(self.path)
+        except OSError:
+            pass
+
+
+class PhaseTimer(object):
+    """Wraps functions so that every call adds its duration to a phase;
+    nested phases are inclusive. Commands and sleeps are charged to every
+    phase that is running when they happen"""
+
+    def __init__(self):
+        self.saved = []
+        self.stack = []
+        self.phases = {}
+
+    def phase(self, name):
+        return self.phases.setdefault(
+            name, {'seconds': 0.0, 'calls': 0, 'cmds': 0, 'sleep': 0.0})
+
+    def wrap(self, name, owner, attr):
+        func = owner.__dict__[attr]
+        self.saved.append((owner, attr, func))
+        timer = self
+
+        def timed(*args, **kwargs):
+            stats = timer.phase(name)
+            timer.stack.append(stats)
+            start = time()
+            try:
+                return func(*args, **kwargs)
+            finally:
+                stats['seconds'] += time() - start
+                stats['calls'] += 1
+                timer.stack.pop()
+        setattr(owner, attr, timed)
+
+    def charge(self, key, value):
+        for stats in self.stack:
+            stats[key] += value
+
+    def reset(self):
+        phases, self.phases = self.phases, {}
+        return phases
+
+    def restore(self):
+        for owner, attr, func in reversed(self.saved):
+            setattr(owner, attr, func)
+        self.saved = []
+
+
+class FakePopen(object):
+    pid = 0
+    returncode = 0
+    stdin = stdout = stderr = None
+
+    def __init__(self, *args, **kwargs):
+        pass
+
+    def communicate(self, *args, **kwargs):
+        return b'', b''
+
+    def poll(self):
+        return 0
+
+    def wait(self, *args, **kwargs):
+        return 0
+
+
+class stand_in_subprocess(object):
+    "What WStarter needs of subprocess to believe it started wmediumd"
+    PIPE = subprocess.PIPE
+    STDOUT = subprocess.STDOUT
+    Popen = FakePopen
+
+    @staticmethod
+    def call(*args, **kwargs):
+        return 0
+
+
+class Commands(object):
+    """Counts the shell commands and sleeps of mn_wifi and, in dry-run,
+    answers them without touching the system"""
+
+    def __init__(self, timer, dry_run):
+        self.timer = timer
+        self.dry_run = dry_run
+        self.saved = []
+        self.count = 0
+        self.next_pid = 1 << 22
+
+    def patch(self, owner, attr, value):
+        self.saved.append((owner, attr, vars(owner)[attr]))
+        setattr(owner, attr, value)
+
+    def install(self):
+        for attr in ('cmd', 'pexec', 'popen'):
+            self.patch(Node, attr, self.counted(vars(Node)[attr], attr))
+        for name, mod in list(sys.modules.items()):
+            if not name.startswith('mn_wifi') or mod is None:
+                continue
+            if vars(mod).get('sleep') is sleep:
+                self.patch(mod, 'sleep', self.sleep)
+            if vars(mod).get('sh') is os.system:
+                self.patch(mod, 'sh', self.system)
+        if not self.dry_run:
+            return
+        commands = self
+
+        def startShell(node, *args, **kwargs):
+            node.pid = commands.next_pid
+            commands.next_pid += 1
+        self.patch(Node, 'startShell', startShell)
+        self.patch(Node, 'checkSetup', classmethod(lambda cls: None))
+        self.patch(Node, 'sendCmd', lambda node, *args, **kwargs: None)
+        self.patch(Node, 'waitOutput', lambda node, *args, **kwargs: '')
+        self.patch(Mininet, 'inited', True)
+        self.patch(Mac80211Hwsim, 'start', lambda hwsim, *args, **kwargs:
+                   commands.system('modprobe mac80211_hwsim'))
+
+    def restore(self):
+        for owner, attr, func in reversed(self.saved):
+            setattr(owner, attr, func)
+        self.saved = []
+
+    def counted(self, func, kind):
+        commands = self
+
+        def run(node, *args, **kwargs):
+            commands.count += 1
+            commands.timer.charge('cmds', 1)
+            if not commands.dry_run:
+                return func(node, *args, **kwargs)
+            return commands.answer(kind, ' '.join(str(a) for a in args))
+        return run
+
+    def answer(self, kind, cmd):
+        out = ''
+        if cmd.startswith('ip addr show') or cmd.startswith('ip link show'):
+            # a stable mac per interface name for IntfWireless.getMAC
+            mac = zlib.crc32(cmd.encode()) | 1 << 32
+            out = 'link/ether 02:%s' % ':'.join(
+                '%02x' % ((mac >> s) & 0xff) for s in (32, 24, 16, 8, 0))
+        if kind == 'pexec':
+            return out, '', 0
+        if kind == 'popen':
+            return FakePopen()
+        return out
+
+    def system(self, cmd):
+        self.count += 1
+        self.timer.charge('cmds', 1)
+        if not self.dry_run:
+            return os.system(cmd)
+        return 0
+
+    def sleep(self, seconds):
+        self.timer.charge('sleep', seconds)
+        if not self.dry_run:
+            sleep(seconds)
+
+
+def can_load_hwsim():
+    if os.geteuid() != 0:
+        return False
+    with open(os.devnull, 'w') as null:
+        return subprocess.call(['modinfo', 'mac80211_hwsim'],
+                               stdout=null, stderr=null) == 0
+
+
+def wrap_phases(timer):
+    "Phases of Mininet_wifi.build() and configureNodes() worth telling apart"
+    timer.wrap('build', Mininet_wifi, 'build')
+    timer.wrap('configureNodes', Mininet_wifi, 'configureNodes')
+    timer.wrap('hwsim', Mac80211Hwsim, 'start')
+    timer.wrap('configNode', Mininet_wifi, 'configNode')
+    timer.wrap('configMasterIntf', Mininet_wifi, 'configMasterIntf')
+    timer.wrap('config_range', Mininet_wifi, 'config_range')
+    timer.wrap('start_wmediumd', Mininet_wifi, 'start_wmediumd')
+    timer.wrap('hostapd', HostapdConfig, '__init__')
+    timer.wrap('config_antenna', Mininet_wifi, 'config_antenna')
+    timer.wrap('configHosts', Mininet_wifi, 'configHosts')
+    timer.wrap('check_if_mob', Mininet_wifi, 'check_if_mob')
+    timer.wrap('auto_association', Mininet_wifi, 'auto_association')
+    timer.wrap('config_links', Mobility, 'config_links')
+
+
+def topology(nstations, naps, rng):
+    """Stations spread at random over a square with one AP every 100m
+    of a grid covering it"""
+    grid = int(np.ceil(np.sqrt(naps)))
+    side = 100.0 * grid
+    net = Mininet_wifi(link=wmediumd, wmediumd_mode=interference,
+                       autoSetMacs=True)
+    start = time()
+    for n, (x, y) in enumerate(rng.uniform(0, side, (nstations, 2))):
+        net.addStation('sta%d' % (n + 1), position='%.2f,%.2f,0' % (x, y))
+    for n in range(naps):
+        x, y = 50.0 + 100.0 * (n % grid), 50.0 + 100.0 * (n // grid)
+        net.addAccessPoint('ap%d' % (n + 1), ssid='bench-ssid',
+                           channel=str(1 + 5 * (n % 3)),
+                           position='%.2f,%.2f,0' % (x, y))
+    add_nodes = time() - start
+    return net, side, add_nodes
+
+
+def bench_ticks(net, rng, side, ticks):
+    "Moves every station a few meters per tick, the way a mobility model does"
+    nodes = net.stations
+    coords = np.array([node.position[:2] for node in nodes], dtype=float)
+    samples = []
+    for _ in range(ticks):
+        coords = np.clip(coords + rng.uniform(-5, 5, coords.shape), 0, side)
+        moves = dict((node, (x, y, 0.0))
+                     for node, (x, y) in zip(nodes, coords.tolist()))
+        start = time()
+        net.setPositions(moves)
+        samples.append(time() - start)
+    return samples
+
+
+def bench_shards(net, rng, side, ticks, shards):
+    """Mean tick with the ranges evaluated by 1..N shard workers, and the
+    scaling efficiency relative to the smallest count"""
+    result = {}
+    for count in shards:
+        ShardPool.enabled, ShardPool.count = True, count
+        try:
+            bench_ticks(net, rng, side, 1)  # starts the workers
+            samples = bench_ticks(net, rng, side, ticks)
+        finally:
+            ShardPool.stop()
+            ShardPool.enabled = False
+        result[count] = {'mean_s': sum(samples) / len(samples),
+                         'p99_s': percentile(samples, 0.99)}
+    base = min(result)
+    for count, stats in result.items():
+        stats['speedup'] = result[base]['mean_s'] / stats['mean_s']
+        stats['efficiency'] = stats['speedup'] * base / count
+    return result
+
+
+def bench_tc(net, updates):
+    intfs = [intf for node in net.stations for intf in node.wintfs.values()]
+    start = time()
+    for n in range(updates):
+        intf = intfs[n % len(intfs)]
+        intf.set_tc(intf.name, bw=10 + n % 40, loss=n % 5, latency=n % 20)
+    return updates / (time() - start)
+
+
+def bench_wmediumd(mock, nstations, updates):
+    """Position updates one round trip at a time and pipelined in batches
+    of every station, and txpower updates, against the stand-in server"""
+    refs = [WmediumdIntfRef('sta%d' % n, 'sta%d-wlan0' % n,
+                            '02:01:%02x:%02x:%02x:00' % (
+                                (n >> 16) & 0xff, (n >> 8) & 0xff, n & 0xff))
+            for n in range(nstations)]
+    result = {}
+    w_server.connect(mock.path)
+    try:
+        start = time()
+        for n in range(updates):
+            w_server.send_pos_update(w_pos(refs[n % nstations],
+                                           [float(n % 100), 1.0, 0.0]))
+        result['pos_per_s'] = updates / (time() - start)
+
+        start = time()
+        sent = 0
+        while sent < updates:
+            batch = [w_pos(ref, [float(sent % 100), 2.0, 0.0])
+                     for ref in refs[:updates - sent]]
+            w_server.update_positions(batch)
+            sent += len(batch)
+        result['pos_batched_per_s'] = updates / (time() - start)
+
+        start = time()
+        for n in range(updates):
+            w_server.send_txpower_update(w_txpower(refs[n % nstations], 14))
+        result['txpower_per_s'] = updates / (time() - start)
+    finally:
+        w_server.sock.close()
+        w_server.connected = False
+    return result
+
+
+def teardown(net, dry_run):
+    if not dry_run:
+        net.stop()
+        return
+    net.stop_graph_params()
+    Mobility.aps, Mobility.stations, Mobility.mobileNodes = [], [], []
+    Mac80211Hwsim.reset()
+    w_server.disconnect()
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p))]
+
+
+def run_size(args, nstations, naps, mock, commands, timer):
+    rng = np.random.RandomState(args.seed)
+    net, side, add_nodes = topology(nstations, naps, rng)
+    try:
+        timer.reset()
+        cmds = commands.count
+        net.configureNodes()
+        net.build()
+        phases = timer.reset()
+        phases['add_nodes'] = {'seconds': add_nodes, 'calls': 1,
+                               'cmds': 0, 'sleep': 0.0}
+        build_cmds = commands.count - cmds
+
+        samples = bench_ticks(net, rng, side, args.ticks)
+        tick_phases = timer.reset()
+        links = tick_phases.get('config_links', {})
+        tick = {'ticks': args.ticks,
+                'mean_s': sum(samples) / len(samples),
+                'p99_s': percentile(samples, 0.99),
+                'config_links_s': links.get('seconds', 0.0) / args.ticks,
+                'cmds_per_tick': links.get('cmds', 0) / float(args.ticks)}
+        shards = bench_shards(net, rng, side, args.ticks, args.shards) \
+            if args.shards else {}
+        timer.reset()
+        tc = bench_tc(net, args.updates)
+    finally:
+        teardown(net, args.dry_run)
+    return {'stations': nstations, 'aps': naps, 'phases': phases,
+            'build_cmds': build_cmds, 'tick': tick, 'shards': shards,
+            'tc_updates_per_s': tc,
+            'wmediumd': bench_wmediumd(mock, nstations, args.updates)}
+
+
+def report(result):
+    print('*** %d stations, %d aps' % (result['stations'], result['aps']))
+    for name, stats in sorted(result['phases'].items(),
+                              key=lambda item: -item[1]['seconds']):
+        print('    %-18s %10.3fs  calls=%-6d cmds=%-7d sleep=%.1fs'
+              % (name, stats['seconds'], stats['calls'], stats['cmds'],
+                 stats['sleep']))
+    tick = result['tick']
+    print('    tick mean %.2fms p99 %.2fms (config_links %.2fms, %.1f cmds)'
+          % (tick['mean_s'] * 1e3, tick['p99_s'] * 1e3,
+             tick['config_links_s'] * 1e3, tick['cmds_per_tick']))
+    for count, stats in sorted(result['shards'].items()):
+        print('    %2d shards: tick mean %.2fms p99 %.2fms, speedup %.2f, '
+              'efficiency %.0f%%' % (count, stats['mean_s'] * 1e3,
+                                     stats['p99_s'] * 1e3, stats['speedup'],
+                                     stats['efficiency'] * 100))
+    wmd = result['wmediumd']
+    print('    set_tc %.0f/s, wmediumd pos %.0f/s (batched %.0f/s), '
+          'txpower %.0f/s' % (result['tc_updates_per_s'], wmd['pos_per_s'],
+                              wmd['pos_batched_per_s'], wmd['txpower_per_s']))
+
+
+def main():
+    parser = ArgumentParser(description='mininet-wifi scale benchmarks')
+    parser.add_argument('-s', '--sizes', default=SIZES,
+                        help='comma separated <stations>x<aps> '
+                             '(default %s)' % SIZES)
+    parser.add_argument('-t', '--ticks', type=int, default=20,
+                        help='mobility ticks per size')
+    parser.add_argument('-u', '--updates', type=int, default=5000,
+                        help='tc and wmediumd updates per size')
+    parser.add_argument('-o', '--output', default='bench_scale.json')
+    parser.add_argument('--shards', default='',
+                        help='comma separated shard worker counts to time '
+                             'the mobility ticks with, e.g. 1,2,4,8')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--dry-run', action='store_true', default=None,
+                        help='stub kernel-touching steps')
+    parser.add_argument('-v', '--verbose', action='store_true')
+    args = parser.parse_args()
+    setLogLevel('info' if args.verbose else 'warning')
+
+    if args.dry_run is None:
+        args.dry_run = not can_load_hwsim()
+        if args.dry_run:
+            print('*** mac80211_hwsim unavailable, running in dry-run mode')
+    sizes = [tuple(int(n) for n in size.split('x'))
+             for size in args.sizes.split(',')]
+    args.shards = [int(n) for n in args.shards.split(',') if n]
+
+    mock = MockWmediumd()
+    mock.install()
+    timer = PhaseTimer()
+    commands = Commands(timer, args.dry_run)
+    commands.install()
+    wrap_phases(timer)
+    results = []
+    try:
+        for nstations, naps in sizes:
+            info('*** Benchmarking %d stations, %d aps\n' % (nstations, naps))
+            results.append(run_size(args, nstations, naps, mock,
+                                    commands, timer))
+            report(results[-1])
+    finally:
+        timer.restore()
+        commands.restore()
+        mock.close()
+
+    with open(args.output, 'w') as f:
+        json.dump({'version': VERSION, 'python': platform.python_version(),
+                   'date': strftime('%Y-%m-%dT%H:%M:%S'),
+                   'dry_run': args.dry_run, 'ticks': args.ticks,
+                   'updates': args.updates, 'results': results},
+                  f, indent=1, sort_keys=True)
+    print('*** Results written to %s' % args.output)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,61 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test the LLF/SSF decisions of AssociationEngine."""
+
+import unittest
+
+import numpy as np
+from mininet.log import setLogLevel
+
+from mn_wifi.associationControl import AssociationEngine
+
+nan, inf = np.nan, np.inf
+
+
+class testAssociationEngine(unittest.TestCase):
+    "AssociationEngine.decide on small matrices"
+
+    def decide(self, ac, rssi, current, load, cap=None):
+        load = np.array(load)
+        cap = np.full(len(load), inf) if cap is None else np.array(cap, float)
+        return AssociationEngine.decide(ac, np.array(rssi, float),
+                                        np.array(current), load, cap).tolist()
+
+    def testSSFMovesToStrongerAP(self):
+        "ssf: a station moves to the strongest AP in range"
+        self.assertEqual(self.decide('ssf', [[-70, -50]], [0], [1, 0]), [1])
+
+    def testSSFHysteresis(self):
+        "ssf: a gain within the hysteresis keeps the station where it is"
+        self.assertEqual(self.decide('ssf', [[-50, -49.95]], [0], [1, 0]),
+                         [0])
+
+    def testOutOfRangeIgnored(self):
+        "an AP out of range (nan) is never chosen"
+        self.assertEqual(self.decide('ssf', [[-70, nan]], [0], [1, 0]), [0])
+
+    def testNotAssociatedUntouched(self):
+        "stations that are not associated are left to the handover"
+        self.assertEqual(self.decide('ssf', [[-70, -50]], [-1], [0, 0]),
+                         [-1])
+
+    def testLLFBalances(self):
+        "llf: stations leave the loaded AP, at most up to the mean load"
+        decision = self.decide('llf', [[-50, -60]] * 4, [0, 0, 0, 0], [4, 0])
+        self.assertEqual(decision.count(1), 2)
+
+    def testCapacity(self):
+        "the admission cap of the target AP bounds the moves"
+        decision = self.decide('ssf', [[-70, -50]] * 3, [0, 0, 0], [3, 0],
+                               cap=[inf, 1])
+        self.assertEqual(decision.count(1), 1)
+
+    def testUnknownPolicy(self):
+        "any other policy keeps every station"
+        self.assertEqual(self.decide('none', [[-70, -50]], [0], [1, 0]), [0])
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
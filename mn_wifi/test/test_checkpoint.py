@@ -0,0 +1,64 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test the save/load round trip of topology checkpoints."""
+
+import os
+import tempfile
+import unittest
+
+from mininet.log import setLogLevel
+
+from mn_wifi.checkpoint import Checkpoint, STATION, AP
+
+
+class testCheckpoint(unittest.TestCase):
+    "Checkpoint.save followed by Checkpoint.load"
+
+    def setUp(self):
+        fd, self.filename = tempfile.mkstemp(suffix='.ckpt')
+        os.close(fd)
+
+    def tearDown(self):
+        os.remove(self.filename)
+
+    def intf(self, **params):
+        intf = dict(node=0, name='sta1-wlan0', mac='02:00:00:00:00:00',
+                    phy=0, txpower=14, gain=5, channel=1, medium=0,
+                    range=40.5, assoc=-1, tc=None)
+        intf.update(params)
+        return intf
+
+    def testRoundTrip(self):
+        "every field comes back as saved"
+        nodes = [('sta1', [1.5, 2.0, 0.0], STATION),
+                 ('ap1', [10.0, 20.0, 3.0], AP),
+                 ('sta2', None, STATION)]
+        intfs = [self.intf(assoc=1, tc=(11.5, 0.5, 3.0)),
+                 self.intf(node=1, name='ap1-wlan1', mac='02:00:00:00:01:00',
+                           phy=1, txpower=20, channel=36, medium=2),
+                 self.intf(node=2, name='sta2-wlan0', mac='', phy=-1)]
+        Checkpoint(nodes, intfs).save(self.filename)
+        loaded = Checkpoint.load(self.filename)
+        self.assertEqual(loaded.nodes, nodes)
+        self.assertEqual(loaded.intfs, intfs)
+
+    def testLongName(self):
+        "names that do not fit are refused, and nothing is written"
+        os.remove(self.filename)
+        intfs = [self.intf(name='s' * 33)]
+        checkpoint = Checkpoint([('sta1', None, STATION)], intfs)
+        self.assertRaises(Exception, checkpoint.save, self.filename)
+        self.assertFalse(os.path.exists(self.filename))
+        open(self.filename, 'w').close()
+
+    def testNotACheckpoint(self):
+        "other files are refused"
+        with open(self.filename, 'wb') as f:
+            f.write(b'\0' * 64)
+        self.assertRaises(Exception, Checkpoint.load, self.filename)
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
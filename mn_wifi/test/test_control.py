@@ -0,0 +1,142 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test the framing, ordering and scheduling of the control API."""
+
+import socket
+import threading
+import time
+import unittest
+
+from mininet.log import setLogLevel
+
+from mn_wifi.control import ControlServer, ControlClient, encode_request, \
+    encode_positions, GET, CMD
+
+
+class Node(object):
+
+    def __init__(self, name):
+        self.name = name
+        self.position = (0, 0, 0)
+
+    def pexec(self, cmd):
+        time.sleep(float(cmd))
+        return 'slept %s' % cmd
+
+
+class Net(object):
+    "Records how many requests change it at the same time"
+
+    def __init__(self):
+        self.nodes = dict((n, Node(n)) for n in ('sta1', 'sta2'))
+        self.active = self.overlaps = 0
+        self.lock = threading.Lock()
+
+    def getNodeByName(self, name):
+        return self.nodes[name]
+
+    def setPositions(self, positions):
+        with self.lock:
+            self.active += 1
+            self.overlaps += self.active > 1
+        time.sleep(0.02)
+        for name, pos in positions.items():
+            self.nodes[name].position = pos
+        with self.lock:
+            self.active -= 1
+
+    def socket_command(self, cmd):
+        return 'ok:' + cmd
+
+
+class testControlServer(unittest.TestCase):
+    "ControlServer with a stand-in topology"
+
+    def setUp(self):
+        self.net = Net()
+        self.server = ControlServer(self.net, port=0)
+        self.port = self.server.sock.getsockname()[1]
+        self.thread = threading.Thread(target=self.server.serve, daemon=True)
+        self.thread.start()
+        self.socks = []
+
+    def tearDown(self):
+        for sock in self.socks:
+            sock.close()
+        self.server.stop()
+        self.thread.join(2)
+
+    def client(self):
+        client = ControlClient(port=self.port)
+        self.socks.append(client.sock)
+        return client
+
+    def text(self):
+        sock = socket.create_connection(('127.0.0.1', self.port))
+        sock.settimeout(5)
+        self.socks.append(sock)
+        return sock
+
+    def recv(self, sock, size):
+        data = b''
+        while len(data) < size:
+            data += sock.recv(4096)
+        return data
+
+    def testTextFraming(self):
+        "text commands are split on newlines, however the bytes arrive"
+        sock = self.text()
+        sock.sendall(b'get.st')
+        time.sleep(0.05)
+        sock.sendall(b'a1.position\nget.sta2.a\r\nget.')
+        time.sleep(self.server.text_idle * 2)
+        sock.sendall(b'x\n')
+        expected = b'ok:get.sta1.position\nok:get.sta2.a\nok:get.x\n'
+        self.assertEqual(self.recv(sock, len(expected)), expected)
+
+    def testTextWithoutNewline(self):
+        "a command without newline runs once the client goes quiet"
+        sock = self.text()
+        sock.sendall(b'set.sta1.setPosition("1,2,0")')
+        self.assertEqual(sock.recv(1024), b'ok:set.sta1.setPosition("1,2,0")')
+
+    def testOrder(self):
+        "pipelined requests of one connection are answered in order"
+        client = self.client()
+        client.send(encode_request(CMD, client.next_id(), 'sta1', '0.2') +
+                    encode_positions(client.next_id(), {'sta1': (5, 5, 5)}) +
+                    encode_request(GET, client.next_id(), 'sta1', 'position'))
+        self.assertEqual([client.recv_reply() for _ in range(3)],
+                         [(1, 0, 'slept 0.2'), (2, 0, '1'),
+                          (3, 0, '(5.0, 5.0, 5.0)')])
+
+    def testSlowCommand(self):
+        "a slow shell command does not hold up the other clients"
+        slow, fast = self.client(), self.client()
+        thread = threading.Thread(target=slow.cmd, args=('sta1', '1.0'))
+        start = time.time()
+        thread.start()
+        time.sleep(0.05)
+        fast.set_positions({'sta2': (1, 2, 3)})
+        self.assertLess(time.time() - start, 0.5)
+        self.assertEqual(fast.get('sta2', 'position'), '(1.0, 2.0, 3.0)')
+        thread.join()
+
+    def testStateChangesSerialized(self):
+        "position updates of different clients never run together"
+        clients = [self.client() for _ in range(4)]
+        threads = [threading.Thread(
+            target=lambda c: [c.set_positions({'sta1': (k, 0, 0)})
+                              for k in range(5)], args=(c,))
+            for c in clients]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual(self.net.overlaps, 0)
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test the precomputed RSSI rasters against the propagation models."""
+
+import math
+import random
+import unittest
+
+from mininet.log import setLogLevel
+
+from mn_wifi.coverage import CoverageRaster, MODELS
+from mn_wifi.propagationModels import PropagationModel as ppm
+
+
+class Node(object):
+
+    def __init__(self, position):
+        self.position = position
+
+
+class Intf(object):
+
+    def __init__(self, position, gain=5):
+        self.node = Node(position)
+        self.txpower = 14
+        self.antennaGain = gain
+        self.antennaHeight = 1
+        self.freq = 2.412
+        self.range = 60
+
+
+class testCoverageRaster(unittest.TestCase):
+    "CoverageRaster.rssi against PropagationModel"
+
+    def setUp(self):
+        self.model = ppm.model
+        self.ap = Intf([50.0, 50.0, 0.0])
+        self.sta = Intf([0.0, 0.0, 0.0], gain=3)
+        CoverageRaster.start(0.5)
+
+    def tearDown(self):
+        CoverageRaster.stop()
+        CoverageRaster.enabled = False
+        ppm.model = self.model
+
+    def place(self, r, a):
+        self.sta.node.position = [50 + r * math.cos(a),
+                                  50 + r * math.sin(a), 0.0]
+
+    def testErrorBound(self):
+        "interpolated values stay within the 1 dB truncation of the models"
+        rand = random.Random(9)
+        for model in MODELS:
+            ppm.model = model
+            errors = []
+            for _ in range(1000):
+                self.place(rand.uniform(0, 60), rand.uniform(0, 2 * math.pi))
+                dist = round(math.dist(self.sta.node.position,
+                                       self.ap.node.position), 2)
+                exact = float(ppm(self.sta, self.ap, dist).rssi)
+                value = CoverageRaster.rssi(self.sta, self.ap)
+                if value is not None:
+                    errors.append(abs(exact - value))
+            self.assertGreater(len(errors), 900, model)
+            self.assertLess(max(errors), 1.0, model)
+            self.assertLess(sum(errors) / len(errors), 0.25, model)
+
+    def testRebuild(self):
+        "a txpower change rebuilds the raster of that AP"
+        self.place(20, 1)
+        CoverageRaster.rssi(self.sta, self.ap)
+        builds = CoverageRaster.builds
+        CoverageRaster.rssi(self.sta, self.ap)
+        self.assertEqual(CoverageRaster.builds, builds)
+        self.ap.txpower = 20
+        dist = round(math.dist(self.sta.node.position,
+                               self.ap.node.position), 2)
+        value = CoverageRaster.rssi(self.sta, self.ap)
+        self.assertEqual(CoverageRaster.builds, builds + 1)
+        self.assertLess(abs(value - ppm(self.sta, self.ap, dist).rssi), 1.0)
+
+    def testMobileAP(self):
+        "an AP that keeps moving falls back to the model"
+        self.place(20, 1)
+        for k in range(3):
+            self.ap.node.position = [50.0 + k, 50.0, 0.0]
+            CoverageRaster.rssi(self.sta, self.ap)
+        self.assertIn(self.ap.node, CoverageRaster.mobile)
+        self.assertIsNone(CoverageRaster.rssi(self.sta, self.ap))
+
+    def testOtherModels(self):
+        "models the rasters do not cover are left to the model"
+        ppm.model = 'twoRayGround'
+        self.place(20, 1)
+        self.assertIsNone(CoverageRaster.rssi(self.sta, self.ap))
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
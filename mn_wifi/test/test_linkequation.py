@@ -0,0 +1,59 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test the compiled channel equations of LinkEquation."""
+
+import unittest
+
+import numpy as np
+from mininet.log import setLogLevel
+
+from mn_wifi.link import LinkEquation, IntfWireless
+
+
+class testLinkEquation(unittest.TestCase):
+    "LinkEquation against the expressions it compiles"
+
+    def setUp(self):
+        LinkEquation.tables = {}
+
+    def testExact(self):
+        "without a step the expression is evaluated as written"
+        for dist in (0, 1.5, 37.25, 1000):
+            self.assertAlmostEqual(
+                LinkEquation.value(IntfWireless.eqDelay, dist),
+                (dist / 10) + 1)
+            self.assertAlmostEqual(
+                LinkEquation.value('custombw' + IntfWireless.eqBw, dist, 0,
+                                   54), 54 * (1.01 ** -dist))
+
+    def testBatch(self):
+        "batch gives the scalar values for an array of distances"
+        dists = np.array([0, 2.5, 10, 99])
+        values = LinkEquation.batch(IntfWireless.eqLoss, dists)
+        self.assertEqual(values.tolist(),
+                         [LinkEquation.value(IntfWireless.eqLoss, d)
+                          for d in dists])
+
+    def testScalarOnlyExpression(self):
+        "expressions that do not take arrays are vectorized"
+        values = LinkEquation.batch('int(dist) * 2', [4, 9])
+        self.assertEqual(values.tolist(), [8, 18])
+
+    def testLookup(self):
+        "a step rounds the distance to a multiple of it"
+        value = LinkEquation.value(IntfWireless.eqLatency, 12.34, 0.1)
+        self.assertAlmostEqual(value, (12.3 / 10) / 2)
+
+    def testLookupBounded(self):
+        "far distances are evaluated instead of growing the table"
+        dist = LinkEquation.max_table * 0.1 * 10
+        value = LinkEquation.value(IntfWireless.eqDelay, dist, 0.1)
+        self.assertAlmostEqual(value, (dist / 10) + 1)
+        self.assertTrue(all(len(table) <= LinkEquation.max_table
+                            for table in LinkEquation.tables.values()))
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
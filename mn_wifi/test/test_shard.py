@@ -0,0 +1,137 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test sharded range evaluation against a brute force search."""
+
+import threading
+import unittest
+
+import numpy as np
+from mininet.log import setLogLevel
+
+from mn_wifi.shard import ShardPool, evaluate
+
+
+class Node(object):
+
+    def __init__(self, position):
+        self.position = position
+
+
+class Intf(object):
+
+    def __init__(self, node, range_):
+        self.node = node
+        self.range = range_
+
+
+def in_range(pos, aps):
+    "AP indexes in range of every station, as Mobility.check_in_range"
+    d = np.round(np.sqrt(((pos[:, None, :] - aps[None, :, :3]) ** 2)
+                         .sum(axis=2)), 2)
+    return [list(np.flatnonzero(row <= aps[:, 3])) for row in d]
+
+
+class testEvaluate(unittest.TestCase):
+    "evaluate() over strips of the plane"
+
+    def setUp(self):
+        rand = np.random.RandomState(3)
+        self.pos = np.hstack([rand.uniform(0, 500, (400, 2)),
+                              np.zeros((400, 1))])
+        self.aps = np.hstack([rand.uniform(0, 500, (60, 2)),
+                              np.zeros((60, 1)), rand.uniform(20, 90, (60, 1))])
+
+    def run_strips(self, edges, width):
+        n = len(self.pos)
+        near = np.full((n, width), -2, dtype=np.int32)
+        dist = np.zeros((n, width))
+        rows = [evaluate(self.pos, self.aps, lo, hi, width, near, dist)
+                for lo, hi in zip(edges[:-1], edges[1:])]
+        return np.concatenate(rows), near, dist
+
+    def testBruteForce(self):
+        "every station gets exactly the APs in range, with their distance"
+        width = 64
+        rows, near, dist = self.run_strips([-np.inf, 120, 250, 400, np.inf],
+                                           width)
+        self.assertEqual(sorted(rows), list(range(len(self.pos))))
+        for row, expected in enumerate(in_range(self.pos, self.aps)):
+            found = near[row] >= 0
+            got = list(near[row][found])
+            self.assertEqual(got, expected)
+            d = np.sqrt(((self.pos[row] - self.aps[got, :3]) ** 2).sum(1))
+            np.testing.assert_allclose(dist[row][found], d, atol=0.01)
+
+    def testWidth(self):
+        "a full row means there may be more APs in range than kept"
+        width = 2
+        _, near, _ = self.run_strips([-np.inf, np.inf], width)
+        for row, expected in enumerate(in_range(self.pos, self.aps)):
+            got = [j for j in near[row] if j >= 0]
+            if len(expected) < width:
+                self.assertEqual(got, expected)
+            else:
+                self.assertEqual(len(got), width)
+                self.assertTrue(set(got) <= set(expected))
+
+
+class testShardPool(unittest.TestCase):
+    "ShardPool.tick with worker processes"
+
+    def setUp(self):
+        rand = np.random.RandomState(5)
+        self.rand = rand
+        self.stations = [Node(list(rand.uniform(0, 300, 2)) + [0.0])
+                         for _ in range(300)]
+        self.aps = [Node(list(rand.uniform(0, 300, 2)) + [0.0])
+                    for _ in range(20)]
+        self.ap_intfs = [Intf(ap, rand.uniform(30, 60)) for ap in self.aps]
+        ShardPool.count = 3
+
+    def tearDown(self):
+        ShardPool.stop()
+        ShardPool.count = 1
+
+    def check(self, index, near):
+        pos = np.array([node.position for node in self.stations])
+        aps = np.array([ap.position + [intf.range]
+                        for ap, intf in zip(self.aps, self.ap_intfs)])
+        for node, expected in zip(self.stations, in_range(pos, aps)):
+            got = [j for j in near[index[node]] if j >= 0]
+            self.assertEqual(got, expected)
+
+    def testTick(self):
+        "workers follow the stations as they move across strips"
+        for _ in range(3):
+            for node in self.stations:
+                node.position[0] = float(self.rand.uniform(0, 300))
+            index, _, _, near, _ = ShardPool.tick(self.stations, self.aps,
+                                                  self.ap_intfs)
+            self.check(index, near)
+
+    def testConcurrentTicks(self):
+        "ticks from several threads each see a complete evaluation"
+        results, errors = [], []
+
+        def tick():
+            try:
+                for _ in range(5):
+                    results.append(ShardPool.tick(self.stations, self.aps,
+                                                  self.ap_intfs))
+            except Exception as e:  # pylint: disable=broad-except
+                errors.append(e)
+        threads = [threading.Thread(target=tick) for _ in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join(60)
+        self.assertEqual(errors, [])
+        self.assertEqual(len(results), 20)
+        for index, _, _, near, _ in results:
+            self.check(index, near)
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
@@ -0,0 +1,172 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test that the incremental updates of SINR channels, and of the engine
+   that keeps them, match channels built from scratch."""
+
+import unittest
+
+import numpy as np
+from mininet.log import setLogLevel
+
+from mn_wifi.sinr import Channel, SINREngine
+
+
+class Node(object):
+
+    def __init__(self, position):
+        self.position = position
+        self.wintfs = {}
+
+
+class Intf(object):
+
+    def __init__(self, position, txpower=14, gain=5, activity=0.2,
+                 channel=1):
+        self.node = Node(position)
+        self.node.wintfs[0] = self
+        self.channel = channel
+        self.txpower = txpower
+        self.antennaGain = gain
+        self.activity = activity
+        self.freq = 2.412
+
+
+class testChannel(unittest.TestCase):
+    "Channel.refresh/add/remove against a fresh Channel"
+
+    def setUp(self):
+        rand = np.random.RandomState(7)
+        self.intfs = [Intf(list(rand.uniform(0, 100, 2)) + [0])
+                      for _ in range(12)]
+
+    def assertSame(self, channel):
+        "channel holds what a channel built from its members would"
+        fresh = Channel(channel.intfs)
+        n = channel.n
+        self.assertEqual(n, fresh.n)
+        for name in ('pos', 'tx', 'rx', 'act', 'interference'):
+            np.testing.assert_allclose(getattr(channel, name)[:n],
+                                       getattr(fresh, name)[:n], rtol=1e-9)
+        np.testing.assert_allclose(channel.power[:n, :n],
+                                   fresh.power[:n, :n], rtol=1e-9)
+
+    def testRefresh(self):
+        "moving an interface or changing its txpower updates its row/column"
+        channel = Channel(self.intfs)
+        self.intfs[3].node.position = [50, 50, 0]
+        channel.refresh(3)
+        self.intfs[8].txpower = 20
+        channel.refresh(8)
+        self.assertSame(channel)
+
+    def testAdd(self):
+        "joining grows the arrays past their spare capacity"
+        channel = Channel(self.intfs[:2])
+        for intf in self.intfs[2:]:
+            channel.add(intf)
+        self.assertEqual(channel.intfs, self.intfs)
+        self.assertSame(channel)
+
+    def testRemove(self):
+        "the last member takes the place of the one that leaves"
+        channel = Channel(self.intfs)
+        for k in (0, 5, 9):
+            channel.remove(self.intfs[k])
+        self.assertEqual(sorted(map(id, channel.intfs)),
+                         sorted(id(intf) for k, intf in enumerate(self.intfs)
+                                if k not in (0, 5, 9)))
+        for k, intf in enumerate(channel.intfs):
+            self.assertEqual(channel.index[intf], k)
+        self.assertSame(channel)
+
+    def testMixed(self):
+        "many refreshes, joins and leaves stay in step with a rebuild"
+        channel = Channel(self.intfs[:6])
+        rand = np.random.RandomState(11)
+        for step in range(60):
+            intf = self.intfs[rand.randint(len(self.intfs))]
+            if intf not in channel.index:
+                channel.add(intf)
+            elif step % 3 and channel.n > 1:
+                channel.remove(intf)
+            else:
+                intf.node.position = list(rand.uniform(0, 100, 2)) + [0]
+                channel.refresh(channel.index[intf])
+        self.assertSame(channel)
+
+
+class testSINREngine(unittest.TestCase):
+    "SINREngine.update on the marked interfaces only"
+
+    def setUp(self):
+        rand = np.random.RandomState(13)
+        self.rand = rand
+        self.intfs = [Intf(list(rand.uniform(0, 100, 2)) + [0],
+                           channel=int(rand.choice([1, 6, 11])))
+                      for _ in range(30)]
+        self.nodes = [intf.node for intf in self.intfs]
+        SINREngine.stop()
+        SINREngine.enabled = True
+        SINREngine.update(self.nodes)
+
+    def tearDown(self):
+        SINREngine.stop()
+        SINREngine.enabled = False
+
+    def assertSame(self):
+        "the engine holds the channels a build from scratch would"
+        channels = SINREngine.channels
+        for chan, table in channels.items():
+            self.assertEqual(set(table.intfs),
+                             set(intf for intf in self.intfs
+                                 if intf.node in self.nodes and
+                                 intf.channel == chan))
+            fresh = Channel(table.intfs)
+            n = table.n
+            np.testing.assert_allclose(table.power[:n, :n],
+                                       fresh.power[:n, :n], rtol=1e-9)
+            np.testing.assert_allclose(table.interference[:n],
+                                       fresh.interference[:n], rtol=1e-9)
+        self.assertEqual(set(channels),
+                         set(intf.channel for intf in self.intfs
+                             if intf.node in self.nodes and intf.channel))
+
+    def testMarkedOnly(self):
+        "unmarked changes are not looked at, marked ones are applied"
+        before = SINREngine.refreshed
+        self.intfs[0].node.position = [1, 1, 0]
+        SINREngine.update(self.nodes)
+        self.assertEqual(SINREngine.refreshed, before)
+        SINREngine.moved(self.intfs[0].node, self.intfs[1].node)
+        SINREngine.update(self.nodes)
+        self.assertEqual(SINREngine.refreshed, before + 1)
+        self.assertSame()
+
+    def testHooks(self):
+        "moves, radio changes, channel hops and deleted nodes"
+        for step in range(80):
+            intf = self.intfs[self.rand.randint(len(self.intfs))]
+            if intf.node not in self.nodes:
+                continue
+            action = step % 4
+            if action == 0:
+                intf.node.position = list(self.rand.uniform(0, 100, 2)) + [0]
+                SINREngine.moved(intf.node)
+            elif action == 1:
+                intf.txpower = int(self.rand.randint(5, 20))
+                SINREngine.touch(intf)
+            elif action == 2:
+                # associate (other channel) or disconnect (channel 0)
+                intf.channel = int(self.rand.choice([0, 1, 6, 11, 36]))
+                SINREngine.touch(intf)
+            elif step % 20 == 3:
+                self.nodes.remove(intf.node)
+                SINREngine.forget(intf.node)
+            SINREngine.update(self.nodes)
+        self.assertSame()
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
@@ -0,0 +1,81 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test the conversion, seeking and interpolation of binary mobility
+   traces."""
+
+import os
+import shutil
+import tempfile
+import unittest
+
+import numpy as np
+from mininet.log import setLogLevel
+
+from mn_wifi.replaying import BinaryTrace
+
+
+class testBinaryTrace(unittest.TestCase):
+    "BinaryTrace.convert round trip"
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.samples = {'sta1': [(0, 0, 0, 0), (10, 10, 0, 0), (20, 10, 10, 5)],
+                        'sta2': [(5, 1, 1, 0), (6, 2, 2, 0)]}
+        traces = {}
+        for name, rows in self.samples.items():
+            traces[name] = os.path.join(self.dir, name + '.dat')
+            np.savetxt(traces[name], rows)
+        self.filename = os.path.join(self.dir, 'trace.bin')
+        BinaryTrace.convert(traces, self.filename, timestamp=True)
+        self.trace = BinaryTrace(self.filename)
+
+    def tearDown(self):
+        self.trace.close()
+        shutil.rmtree(self.dir)
+
+    def testHeader(self):
+        "names, time span and samples survive the conversion"
+        self.assertEqual(self.trace.names, ['sta1', 'sta2'])
+        self.assertEqual((self.trace.start, self.trace.end), (0.0, 20.0))
+        self.assertEqual(self.trace.time.tolist(), [0, 10, 20, 5, 6])
+        self.assertEqual(self.trace.x.tolist(), [0, 10, 10, 1, 2])
+
+    def testSeek(self):
+        "seek returns the last sample at or before t, per node"
+        for t, expected in ((-1, [0, 3]), (0, [0, 3]), (5.5, [0, 3]),
+                            (10, [1, 4]), (19.9, [1, 4]), (100, [2, 4])):
+            self.assertEqual(self.trace.seek(t).tolist(), expected)
+
+    def testPositions(self):
+        "positions interpolate between samples and hold at the ends"
+        pos = self.trace.positions(15)
+        self.assertEqual(pos[0].tolist(), [10, 5, 2.5])
+        self.assertEqual(pos[1].tolist(), [2, 2, 0])
+        self.assertEqual(self.trace.positions(0)[1].tolist(), [1, 1, 0])
+
+    def testEmptyTrace(self):
+        "a node without samples is refused"
+        empty = os.path.join(self.dir, 'empty.dat')
+        open(empty, 'w').close()
+        traces = {'sta1': empty}
+        self.assertRaises(Exception, BinaryTrace.convert, traces,
+                          os.path.join(self.dir, 'empty.bin'))
+
+    def testLongName(self):
+        "names that do not fit in the index are refused"
+        traces = {'s' * 33: os.path.join(self.dir, 'sta1.dat')}
+        self.assertRaises(Exception, BinaryTrace.convert, traces,
+                          os.path.join(self.dir, 'long.bin'))
+
+    def testNotATrace(self):
+        "other files are refused"
+        other = os.path.join(self.dir, 'other.bin')
+        with open(other, 'wb') as f:
+            f.write(b'\0' * 64)
+        self.assertRaises(Exception, BinaryTrace, other)
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
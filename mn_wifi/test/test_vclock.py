@@ -0,0 +1,82 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test the fast-forward of the virtual clock."""
+
+import threading
+import time
+import unittest
+
+from mininet.log import setLogLevel
+
+from mn_wifi.vclock import VirtualClock
+
+
+class testVirtualClock(unittest.TestCase):
+    "VirtualClock.sleep with sleeping loops and a link engine"
+
+    def setUp(self):
+        VirtualClock.stop()
+        VirtualClock.enabled = True
+        self.running = True
+        self.passes = 0
+        self.thread = threading.Thread(target=self.engine, daemon=True)
+
+    def tearDown(self):
+        self.running = False
+        if self.thread.is_alive():
+            self.thread.join()
+        VirtualClock.stop()
+        VirtualClock.enabled = False
+
+    def engine(self):
+        "Stand-in for the config_links thread"
+        while self.running:
+            seq = VirtualClock.begin()
+            time.sleep(0.001)
+            self.passes += 1
+            VirtualClock.end(seq)
+
+    def loops(self, *loops):
+        "Runs (interval, count) sleeping loops; returns real seconds"
+        threads = [threading.Thread(
+            target=lambda dt, n: [VirtualClock.sleep(dt) for _ in range(n)],
+            args=loop) for loop in loops]
+        start = time.monotonic()
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join(30)
+        return time.monotonic() - start
+
+    def testDisabled(self):
+        "without fast-forward a sleep takes real time"
+        VirtualClock.enabled = False
+        self.assertGreaterEqual(self.loops((0.2, 1)), 0.19)
+
+    def testJump(self):
+        "idle loops jump to the earliest wake-up"
+        VirtualClock.paced = True
+        self.thread.start()
+        start = VirtualClock.now()
+        real = self.loops((1.0, 20), (0.5, 40))
+        self.assertLess(real, 5)
+        self.assertGreaterEqual(VirtualClock.now() - start, 20)
+        self.assertGreater(VirtualClock.speedup(), 4)
+
+    def testPaced(self):
+        "no jump before the link engine finishes a pass after the sleep"
+        VirtualClock.paced = True
+        self.assertGreaterEqual(self.loops((0.3, 1)), 0.29)
+        self.assertEqual(VirtualClock.skipped, 0)
+
+    def testTraffic(self):
+        "traffic brings the clock back to real time"
+        VirtualClock.traffic = True
+        self.assertGreaterEqual(self.loops((0.2, 2)), 0.39)
+        self.assertEqual(VirtualClock.skipped, 0)
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test the request/response handling of the wmediumd server socket."""
+
+import socket
+import struct
+import threading
+import unittest
+
+from mininet.log import setLogLevel
+
+from mn_wifi.wmediumdConnector import w_server, w_pos, w_cst
+
+
+class Intf(object):
+
+    def __init__(self, n):
+        self.mac = '02:00:00:%02x:%02x:%02x' % (n >> 16, (n >> 8) & 255,
+                                                n & 255)
+
+    def get_mac(self):
+        return self.mac
+
+
+class Medium(threading.Thread):
+    "Answers each position update before it reads the next one"
+
+    request = struct.Struct('!B6sfff')
+    response = struct.Struct('!BB6sfffB')
+
+    def __init__(self, sock):
+        threading.Thread.__init__(self, daemon=True)
+        self.sock = sock
+        self.count = 0
+
+    def run(self):
+        while True:
+            data = b''
+            while len(data) < self.request.size:
+                chunk = self.sock.recv(self.request.size - len(data))
+                if not chunk:
+                    return
+                data += chunk
+            _, mac, x, y, z = self.request.unpack(data)
+            self.count += 1
+            self.sock.sendall(self.response.pack(
+                w_cst.WSERVER_POS_UPDATE_RESPONSE_TYPE,
+                w_cst.WSERVER_POS_UPDATE_REQUEST_TYPE, mac, x, y, z,
+                w_cst.WUPDATE_SUCCESS))
+
+
+class testServerSocket(unittest.TestCase):
+    "w_server against a medium that answers in order"
+
+    def setUp(self):
+        self.sock, theirs = socket.socketpair()
+        self.medium = Medium(theirs)
+        self.medium.start()
+        self.saved = w_server.sock
+        w_server.sock = self.sock
+
+    def tearDown(self):
+        w_server.sock = self.saved
+        self.sock.close()
+        self.medium.join(2)
+        self.medium.sock.close()
+
+    def testLargeBatch(self):
+        "a batch larger than both socket buffers does not deadlock"
+        positions = [w_pos(Intf(n), [n, n, 0]) for n in range(20000)]
+        done = threading.Thread(target=w_server.update_positions,
+                                args=(positions,), daemon=True)
+        done.start()
+        done.join(30)
+        self.assertFalse(done.is_alive())
+        self.assertEqual(self.medium.count, len(positions))
+
+    def testConcurrentRequests(self):
+        "single updates and batches from several threads keep their replies"
+        errors = []
+
+        def move(n):
+            try:
+                for k in range(200):
+                    if k % 2:
+                        w_server.update_positions(
+                            [w_pos(Intf(n), [k, 0, 0])] * 3)
+                    elif w_server.send_pos_update(
+                            w_pos(Intf(n), [k, 0, 0])) != \
+                            w_cst.WUPDATE_SUCCESS:
+                        errors.append(n)
+            except Exception as e:  # pylint: disable=broad-except
+                errors.append(e)
+        threads = [threading.Thread(target=move, args=(n,))
+                   for n in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join(30)
+        self.assertEqual(errors, [])
+        self.assertEqual(self.medium.count, 4 * (100 + 100 * 3))
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
@@ -0,0 +1,105 @@
+#!/usr/bin/env python
+
+"""Package: mininet
+   Test the ctrl_iface sessions of CtrlPool against fake daemons."""
+
+import os
+import shutil
+import socket
+import tempfile
+import threading
+import time
+import unittest
+
+from mininet.log import setLogLevel
+
+from mn_wifi.wpactrl import CtrlPool
+
+
+class Daemon(threading.Thread):
+    "Answers each request after delay seconds, with an event first"
+
+    def __init__(self, path, delay=0.0):
+        threading.Thread.__init__(self, daemon=True)
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+        self.sock.bind(path)
+        self.delay = delay
+        self.active = self.overlaps = 0
+
+    def run(self):
+        while True:
+            try:
+                data, peer = self.sock.recvfrom(4096)
+            except OSError:
+                return
+            self.active += 1
+            self.overlaps += self.active > 1
+            time.sleep(self.delay)
+            self.active -= 1
+            try:
+                self.sock.sendto(b'<3>CTRL-EVENT-SCAN-STARTED', peer)
+                self.sock.sendto(b'OK ' + data + b'\n', peer)
+            except OSError:
+                pass
+
+
+class testCtrlPool(unittest.TestCase):
+    "CtrlPool.request from several threads"
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.daemons = {}
+        for name, delay in (('slow', 0.5), ('fast', 0.0)):
+            path = os.path.join(self.dir, name)
+            self.daemons[name] = Daemon(path, delay)
+            self.daemons[name].start()
+
+    def tearDown(self):
+        CtrlPool.close()
+        for daemon in self.daemons.values():
+            daemon.sock.close()
+        shutil.rmtree(self.dir)
+
+    def path(self, name):
+        return os.path.join(self.dir, name)
+
+    def testReply(self):
+        "events are skipped and the reply returned"
+        self.assertEqual(CtrlPool.request(self.path('fast'), 'PING'),
+                         'OK PING')
+
+    def testUnreachable(self):
+        "a daemon that is not running gives None"
+        self.assertIsNone(CtrlPool.request(self.path('none'), 'PING'))
+
+    def testSessionsIndependent(self):
+        "a slow session does not hold up requests to another one"
+        slow = threading.Thread(target=CtrlPool.request,
+                                args=(self.path('slow'), 'REASSOCIATE'))
+        slow.start()
+        time.sleep(0.05)
+        start = time.time()
+        for _ in range(5):
+            CtrlPool.request(self.path('fast'), 'PING')
+        self.assertLess(time.time() - start, 0.3)
+        slow.join()
+
+    def testSessionSerialized(self):
+        "requests of one session do not interleave"
+        self.daemons['slow'].delay = 0.05
+        replies = []
+        threads = [threading.Thread(
+            target=lambda n: replies.append(
+                CtrlPool.request(self.path('slow'), 'CMD%d' % n)), args=(n,))
+            for n in range(6)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual(sorted(replies), ['OK CMD%d' % n for n in range(6)])
+        self.assertEqual(self.daemons['slow'].overlaps, 0)
+
+
+if __name__ == '__main__':
+    setLogLevel('warning')
+    unittest.main()
@@ -11,17 +11,18 @@
 
 from sys import exit
 from math import atan2
-from random import randint
 from time import sleep
 from threading import Thread as thread
 from random import randrange
-from pylab import ginput as ginp, cos, sin, np
+from pylab import ginput as ginp, np
 
 from mininet.log import info
 
 from mn_wifi.mobility import Mobility
-from mn_wifi.node import AP
 from mn_wifi.plot import PlotGraph, Plot2D
+from mn_wifi.sinr import SINREngine
+from mn_wifi.vclock import VirtualClock
+from mn_wifi.wmediumdConnector import w_server
 
 
 try:
@@ -30,11 +31,97 @@
     pass
 
 
+class RoadGrid(object):
+    """Moves every car along its road at once and finds, through a grid of
+    cells as wide as the largest range, which nodes each car is in range of.
+    Cars ride from one end of a road to the other and then enter the next
+    road; reverse cars ride the roads backwards"""
+
+    SHIFT = 1 << 32  # packs a cell (cx, cy) into one int64
+
+    def __init__(self, roads, road, reverse, speeds, ranges, fixed):
+        """roads: list of (xs, ys) road points, as from get_line
+        road: initial road of each car
+        reverse: True for the cars riding backwards
+        speeds: (n, 2) speed bounds of each car
+        ranges: range of the cars followed by those of the fixed nodes
+        fixed: (m, 2) positions of the fixed nodes"""
+        self.start = np.array([(xs[0], ys[0]) for xs, ys in roads], dtype=float)
+        self.end = np.array([(xs[-1], ys[-1]) for xs, ys in roads], dtype=float)
+        self.lo = np.array([(min(xs), min(ys)) for xs, ys in roads], dtype=float)
+        self.hi = np.array([(max(xs), max(ys)) for xs, ys in roads], dtype=float)
+        diff = self.end - self.start
+        self.angle = np.arctan2(diff[:, 1], diff[:, 0])
+        self.nroads = len(roads)
+        self.road = np.asarray(road, dtype=int)
+        self.reverse = np.asarray(reverse, dtype=bool)
+        self.speeds = np.asarray(speeds, dtype=float).reshape(-1, 2)
+        self.ranges = np.asarray(ranges, dtype=float)
+        self.fixed = np.asarray(fixed, dtype=float).reshape(-1, 2)
+        self.pos = self.entry(self.road)
+
+    def entry(self, road):
+        "Where cars enter road"
+        return np.where(self.reverse[:, None], self.end[road], self.start[road])
+
+    def next_road(self):
+        ahead = np.where(self.road + 1 < self.nroads - 1, self.road + 1, 0)
+        behind = np.where(self.road - 1 >= 1, self.road - 1, self.nroads - 1)
+        return np.where(self.reverse, behind, ahead)
+
+    def step(self, dt):
+        "Advances all cars by dt seconds; returns the cars that changed road"
+        vel = np.round(np.random.uniform(self.speeds[:, 0], self.speeds[:, 1]))
+        heading = self.angle[self.road] + np.pi * self.reverse
+        new = self.pos + (vel * dt)[:, None] * \
+            np.column_stack([np.cos(heading), np.sin(heading)])
+        # the tolerance keeps sin(pi) from throwing reverse cars off flat roads
+        out = ((new < self.lo[self.road] - 1e-6) |
+               (new > self.hi[self.road] + 1e-6)).any(axis=1)
+        self.road = np.where(out, self.next_road(), self.road)
+        self.pos = np.where(out[:, None], self.entry(self.road), new)
+        return out
+
+    def neighbors(self):
+        """Pairs (car, node) where the car is in range of the node; nodes
+        index the cars followed by the fixed nodes"""
+        ncars = len(self.pos)
+        nodes = np.vstack([self.pos, self.fixed])
+        cell = self.ranges.max() if len(self.ranges) else 0
+        if cell <= 0:
+            return np.empty(0, dtype=int), np.empty(0, dtype=int)
+        keys = np.floor(nodes / cell).astype(np.int64)
+        code = keys[:, 0] * self.SHIFT + keys[:, 1]
+        order = np.argsort(code, kind='stable')
+        codes = code[order]
+        src, dst = [], []
+        for dx in (-1, 0, 1):
+            for dy in (-1, 0, 1):
+                target = code[:ncars] + dx * self.SHIFT + dy
+                first = np.searchsorted(codes, target, 'left')
+                counts = np.searchsorted(codes, target, 'right') - first
+                total = counts.sum()
+                if not total:
+                    continue
+                offset = np.arange(total) - np.repeat(np.cumsum(counts) - counts, counts)
+                src.append(np.repeat(np.arange(ncars), counts))
+                dst.append(order[np.repeat(first, counts) + offset])
+        if not src:
+            return np.empty(0, dtype=int), np.empty(0, dtype=int)
+        src, dst = np.concatenate(src), np.concatenate(dst)
+        d2 = ((nodes[dst] - self.pos[src]) ** 2).sum(axis=1)
+        keep = (d2 <= self.ranges[dst] ** 2) & (src != dst)
+        return src[keep], dst[keep]
+
+
 class vanet(Mobility):
 
     # variables
     scatter = 0
-    com_lines = []
+    com_lines = None
+    grid = None
+    neighbors = None  # (car, node) pairs in range, as of the last tick
+    redraw = 1  # ticks between redraws, 0 to only draw the roads
     all_points = []
     roads = []
     points = []
@@ -63,17 +150,23 @@ def start(self, cars, **kwargs):
         Plot2D(**kwargs)
 
         self.display_grid(**kwargs)
-        self.display_cars(cars)
+        self.display_cars(cars, aps)
         self.set_wifi_params()
         self.set_mob_started()
+        tick = 0
         while self.thread_._keep_alive:
-            [self.scatter, self.com_lines] = \
-                self.simulate_car_movement(cars, aps, self.scatter,
-                                           self.com_lines)
-            sleep(0.0001)
+            tick += 1
+            self.simulate_car_movement(
+                cars, aps, draw=self.redraw and tick % self.redraw == 0)
+            if VirtualClock.enabled:
+                # a grid step is time_per_iteration of virtual time
+                VirtualClock.sleep(self.time_per_iteration)
+            else:
+                sleep(0.0001)
 
     def set_wifi_params(self):
         from threading import Thread as thread
+        VirtualClock.paced = True
         thread = thread(name='wifiParameters', target=self.parameters)
         thread.start()
 
@@ -157,13 +250,7 @@ def display_grid(self, links, roads, **kwargs):
         sleep(1)
         Plot2D.create_line(links)
 
-    def display_cars(self, cars):
-        car_lines = []
-        
-        for _ in range(len(cars)):
-            n = randint(0, len(self.roads)-1)
-            car_lines.append(self.roads[n])
-
+    def display_cars(self, cars, aps):
         for n in range(len(self.roads)-1):
             road = self.roads[n]
             line_data = road.get_data()
@@ -176,45 +263,22 @@ def display_cars(self, cars):
 
             Plot2D.line_txt(locX, locY, n + 1)
 
-        # temporal variable to hold values of cars
-        points = [[], []]
-
-        # get X cars in the graph
-        i = 0
-        for car in cars:
-            i += 1
-            random_index = randrange(len(car_lines))
-            car.currentRoad = int(random_index)
-            car_line = car_lines[random_index]
-            point = car_line.get_xydata()[0]  # first point in the graph
-
-            # calculate the angle
-            line_data = car_line.get_data()
-            ang = self.calculateAngle(line_data)
-
-            car.prop = self.carProp(point, ang, x_min, x_max, y_min, y_max)
-
-            # for the even cars shift angle to negative
-            # so that it goes in opposite direction from car1
+        # for the even cars go in opposite direction from car1
+        for i, car in enumerate(cars, 1):
             car.i = i
-            if i % 2 == 0:
-                ang = ang + math.pi
-                # for this car get the last point as positions
-                point = car_line.get_xydata()[-1]
-
-            x_min, x_max = self.lineX(line_data)
-            y_min, y_max = self.lineY(line_data)
-
-            car.initial = self.carPoint(point)
-
-            # add scatter
-            points[0].append(point[0])
-            points[1].append(point[1])
-
+            car.currentRoad = randrange(len(self.roads))
             self.speed(car)  # Get Speed
 
+        roads = [(self.interX[n], self.interY[n]) for n in range(len(self.roads))]
+        self.grid = RoadGrid(
+            roads, [car.currentRoad for car in cars],
+            [car.i % 2 == 0 for car in cars], [car.speed for car in cars],
+            [node.wintfs[0].range for node in cars + aps],
+            [ap.prop[:2] for ap in aps])
+
         # plot cars
-        self.scatter = Plot2D.scatter(points[0], points[1])
+        self.scatter = Plot2D.scatter(self.grid.pos[:, 0], self.grid.pos[:, 1])
+        self.com_lines = Plot2D.line_collection()
 
     def lineX(self, line_data):
         "get the minimum and maximums of the line"
@@ -238,55 +302,6 @@ def calculateAngle(self, line_data):
         ang = atan2(ydiff, xdiff)
         return ang
 
-    def carProp(self, point, ang, x_min, x_max, y_min, y_max):
-
-        return [point[0], point[1], ang, x_min, x_max, y_min, y_max]
-
-    def carPoint(self, point):
-        return [point[0], point[1]]
-
-    def line_prop(self, line, car):
-        line_data = line.get_data()  # Get the x and y values of the points in the line
-        ang = self.calculateAngle(line_data)  # Get angle
-        point = list(line.get_xydata()[0])  # first point in the graph
-
-        if car.i % 2 == 0:
-            ang = ang + math.pi
-            point = list(line.get_xydata()[-1])  # for this car get the last point as positions
-
-        x_min, x_max = self.lineX(line_data)
-        y_min, y_max = self.lineY(line_data)
-
-        car.prop = self.carProp(point, ang, x_min, x_max, y_min, y_max)
-        car.initial = self.carPoint(point)
-
-    def repeat (self, car):
-        # Check if it is the last mile
-        lastRoad = True
-
-        if car.i % 2 == 0:
-            for n in range(len(self.roads)-1, 0, -1):
-                if n < car.currentRoad:
-                    car.currentRoad = n
-                    # get properties of each line in a path
-                    self.line_prop(self.roads[car.currentRoad], car)
-                    lastRoad = False
-                    break
-            if lastRoad:
-                car.currentRoad = len(self.roads) - 1
-                self.line_prop(self.roads[car.currentRoad], car)
-        else:
-            for n in range(len(self.roads)-1):
-                if n > car.currentRoad:
-                    car.currentRoad = n
-                    # get properties of each line in a path
-                    self.line_prop(self.roads[car.currentRoad], car)
-                    lastRoad = False
-                    break
-            if lastRoad:
-                car.currentRoad = 0
-                self.line_prop(self.roads[car.currentRoad], car)
-
     def findIntersection(self):
         # have to work on
         list1 = [list(a) for a in zip(self.interX[0], self.interY[0])]
@@ -300,72 +315,37 @@ def findIntersection(self):
         (element,) = first_set.intersection(secnd_set)
         info(element[0])
 
-    def simulate_car_movement(self, cars, aps, scatter,
-                              com_lines):
-        # temporal variables
-        points = [[], []]
-        scatter.remove()
-
-        nodes = cars + aps
-
-        while com_lines:
-            com_lines[0].remove()
-            del com_lines[0]
-
+    def simulate_car_movement(self, cars, aps, draw=True):
         while self.pause_simulation:
             pass
 
-        # iterate over each car
-        for car in cars:
-            # get all the properties of the car
-            vel = round(np.random.uniform(car.speed[0], car.speed[1]))
-            pos_x = car.prop[0]
-            pos_y = car.prop[1]
-
+        grid = self.grid
+        grid.step(self.time_per_iteration)
+        wpos = []
+        for car, road, (pos_x, pos_y) in zip(cars, grid.road.tolist(),
+                                             grid.pos.tolist()):
+            car.currentRoad = road
             car.position = pos_x, pos_y, 0
-            car.set_pos_wmediumd(car.position)
-            angle = car.prop[2]
-
-            # calculate new position of the car
-            pos_x = pos_x + vel * cos(angle) * self.time_per_iteration
-            pos_y = pos_y + vel * sin(angle) * self.time_per_iteration
-
-            if (pos_x < car.prop[3] or pos_x > car.prop[4]) \
-                or (pos_y < car.prop[5] or pos_y > car.prop[6]):
-                self.repeat(car)
-                points[0].append(car.initial[0])
-                points[1].append(car.initial[1])
-            else:
-                car.prop[0] = pos_x
-                car.prop[1] = pos_y
-                points[0].append(pos_x)
-                points[1].append(pos_y)
-
-                for node in nodes:
-                    if nodes == car:
-                        continue
-
-                    # compute to see if vehicle is in range
-                    inside = math.pow((node.prop[0] - pos_x), 2) + \
-                             math.pow((node.prop[1] - pos_y), 2)
-                    if inside <= math.pow(node.wintfs[0].range, 2):
-                        if isinstance(node, AP):
-                            color = 'black'
-                        else:
-                            color = 'r'
-                        line = Plot2D.line2d([pos_x, node.prop[0]],
-                                             [pos_y, node.prop[1]],
-                                             color=color)
-                        com_lines.append(line)
-                        Plot2D.line(line)
-
-            car.update_2d()
-
-        PlotGraph.pause()
+            wpos += car.get_pos_wmediumd(car.position)
+        if wpos:
+            w_server.update_positions(wpos)
+        SINREngine.moved(*cars)
+        # every tick, drawn or not; drawing only reads them
+        self.neighbors = grid.neighbors()
+
+        if draw:
+            self.draw_movement(cars, aps)
         if not self.thread_._keep_alive:
             exit()
 
-        scatter = Plot2D.scatter(points[0], points[1])
+    def draw_movement(self, cars, aps):
+        "Cars, and a line from each car to every node it is in range of"
+        src, dst = self.neighbors
+        nodes = np.vstack([self.grid.pos, self.grid.fixed])
+        self.com_lines.set_segments(np.stack([self.grid.pos[src], nodes[dst]], axis=1))
+        self.com_lines.set_color(np.where(dst >= len(cars), 'black', 'r'))
+        self.scatter.set_offsets(self.grid.pos)
+        for car in cars:
+            car.update_2d()
+        PlotGraph.pause()
         Plot2D.draw()
-
-        return [scatter, com_lines]
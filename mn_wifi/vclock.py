@@ -0,0 +1,171 @@
+"""
+    Virtual clock shared by the mobility loops (TimedModel, the trace
+    replayer, vanet and the satellites). With fast-forward on and no
+    traffic on the wireless interfaces, a sleep on the clock does not
+    wait: once every loop using the clock is asleep and the link engine
+    has gone through the last moves, the clock jumps to the earliest
+    wake-up. When traffic flows it runs in real time again.
+"""
+
+import os
+from threading import Thread as thread, Condition, current_thread
+from time import monotonic, sleep
+
+from mininet.log import info
+
+from mn_wifi.metrics import Metrics
+
+
+class VirtualClock(object):
+
+    enabled = False  # fast-forward while idle
+    traffic = False
+    idle_pps = 20  # wireless packets/s below which the network is idle
+    interval = 1.0  # seconds between traffic samples
+    skipped = 0.0  # virtual seconds jumped over
+    origin = None
+    sleepers = {}  # thread -> virtual wake-up time
+    users = set()  # threads that slept on the clock
+    started = 0  # link engine passes started
+    done = 0  # last link engine pass finished
+    settled = 0  # pass that must be finished before the next jump
+    paced = False  # a link engine thread runs config_links
+    watched = []  # (/proc/<pid>/net/dev, interface names) per namespace
+    thread_ = None
+    __cond = Condition()
+
+    @classmethod
+    def now(cls):
+        "Virtual time in seconds (monotonic, plus the jumps)"
+        return monotonic() + cls.skipped
+
+    @classmethod
+    def fast(cls):
+        return cls.enabled and not cls.traffic
+
+    @classmethod
+    def sleep(cls, seconds):
+        if not cls.enabled:
+            sleep(seconds)
+            return
+        me = current_thread()
+        with cls.__cond:
+            if cls.origin is None:
+                cls.origin = monotonic()
+            deadline = cls.now() + seconds
+            cls.sleepers[me] = deadline
+            cls.users.add(me)
+            cls.settled = cls.started
+            try:
+                while True:
+                    now = cls.now()
+                    if now >= deadline:
+                        break
+                    if cls.fast() and cls.all_asleep() and \
+                            (not cls.paced or cls.done > cls.settled):
+                        cls.skipped += min(cls.sleepers.values()) - now
+                        cls.settled = cls.started
+                        cls.__cond.notify_all()
+                        continue
+                    cls.__cond.wait(min(deadline - now, 0.05))
+            finally:
+                del cls.sleepers[me]
+
+    @classmethod
+    def all_asleep(cls):
+        "Whether no other live thread that ever slept on the clock runs"
+        cls.users = set(t for t in cls.users if t.is_alive())
+        return len(cls.sleepers) == len(cls.users)
+
+    @classmethod
+    def begin(cls):
+        "A link engine pass starts; returns its number"
+        cls.started += 1
+        return cls.started
+
+    @classmethod
+    def end(cls, seq):
+        "A link engine pass finished"
+        if cls.enabled:
+            with cls.__cond:
+                cls.done = max(cls.done, seq)
+                cls.__cond.notify_all()
+
+    @classmethod
+    def speedup(cls):
+        if cls.origin is None:
+            return 1.0
+        real = monotonic() - cls.origin
+        return (real + cls.skipped) / real if real > 0 else 1.0
+
+    @classmethod
+    def start(cls, nodes):
+        "Watches the packet counters of the wireless interfaces of nodes"
+        if not cls.enabled:
+            return
+        namespaces = {}
+        for node in nodes:
+            pid = getattr(node, 'pid', None)
+            names = [intf.name for intf in getattr(node, 'wintfs', {}).values()]
+            if not pid or not names:
+                continue
+            try:
+                ns = os.readlink('/proc/%d/ns/net' % pid)
+            except OSError:
+                continue
+            namespaces.setdefault(ns, ('/proc/%d/net/dev' % pid, set()))[1] \
+                .update(names)
+        cls.watched = list(namespaces.values())
+        cls.thread_ = thread(name='virtualClock', target=cls.watch)
+        cls.thread_.daemon = True
+        cls.thread_._keep_alive = True
+        cls.thread_.start()
+
+    @classmethod
+    def packets(cls):
+        "rx + tx packets of the watched interfaces"
+        total = 0
+        for path, names in cls.watched:
+            try:
+                with open(path) as f:
+                    lines = f.readlines()[2:]
+            except IOError:
+                continue
+            for line in lines:
+                name, _, stats = line.partition(':')
+                if name.strip() in names:
+                    fields = stats.split()
+                    total += int(fields[1]) + int(fields[9])
+        return total
+
+    @classmethod
+    def watch(cls):
+        last = cls.packets()
+        while cls.thread_._keep_alive:
+            sleep(cls.interval)
+            packets = cls.packets()
+            traffic = packets - last > cls.idle_pps * cls.interval
+            last = packets
+            if traffic != cls.traffic:
+                cls.traffic = traffic
+                info('*** Virtual clock: %s (%.1fx so far)\n'
+                     % ('traffic, back to real time' if traffic
+                        else 'idle, fast-forwarding', cls.speedup()))
+                with cls.__cond:
+                    cls.__cond.notify_all()
+            Metrics.set('mn_wifi_virtual_time_speedup', cls.speedup())
+
+    @classmethod
+    def stop(cls):
+        if cls.thread_:
+            cls.thread_._keep_alive = False
+        if cls.enabled and cls.origin is not None:
+            info('*** Virtual clock: %.0fs simulated in %.0fs real time '
+                 '(%.1fx)\n' % (monotonic() - cls.origin + cls.skipped,
+                                monotonic() - cls.origin, cls.speedup()))
+        cls.thread_ = cls.origin = None
+        cls.skipped = 0.0
+        cls.started = cls.done = cls.settled = 0
+        cls.traffic = cls.paced = False
+        cls.watched = []
+        cls.users = set()
@@ -4,16 +4,21 @@
             Ramon Fontes (ramonrf@dca.fee.unicamp.br)"""
 
 import ctypes
+import mmap
 import os
 import socket
 import struct
 import subprocess
 import tempfile
+from array import array
 from sys import version_info as py_version_info
-from time import sleep
+from threading import Lock
+from time import monotonic_ns
 
 import pkg_resources
 from mininet.log import info, debug
+from mn_wifi.metrics import Metrics
+from mn_wifi.profiler import StartupProfiler
 
 
 class wmediumd_mode(object):
@@ -89,6 +94,7 @@ def __init__(self):
     WUPDATE_WRONG_MODE = 3
 
     SOCKET_PATH = '/var/run/wmediumd.sock'
+    SHM_PATH = '/dev/shm/mn_wmd_state'
     LOG_PREFIX = 'wmediumd:'
 
 
@@ -98,72 +104,64 @@ class WmediumdException(Exception):
 
 class set_interference(object):
 
-    configstr = ''
-
     def __init__(self, **kwargs):
         self.interference(**kwargs)
 
-    def interference(self, configstr, ppm, pos, txpowers,
+    def interference(self, cfg, ppm, pos, txpowers,
                      fading_cof, noise_th, isnodeaps, **kwargs):
-        configstr += '\tenable_interference = true;'
-        configstr += '\n};\nmodel:\n{\n'
-        configstr += '\ttype = "path_loss";\n\tpositions = ('
-        first_pos = True
+        "Writes the interference model section into the cfg file"
+        write = cfg.write
+        write('\tenable_interference = true;')
+        write('\n};\nmodel:\n{\n')
+        write('\ttype = "path_loss";\n\tpositions = (')
+        sep = ''
         for mappedpos in pos:
-            posX = float(mappedpos.sta_pos[0])
-            posY = float(mappedpos.sta_pos[1])
-            posZ = float(mappedpos.sta_pos[2])
-            if first_pos:
-                first_pos = False
-            else:
-                configstr += ','
-            configstr += '\n\t\t(%.1f, %.1f, %.1f)' % (
-                posX, posY, posZ)
-        configstr += '\n\t);\n\tfading_coefficient = %d;' % fading_cof
-        configstr += '\n\tnoise_threshold = %d;' % noise_th
-        configstr += '\n\tisnodeaps = ('
-        first_isnodeap = True
+            write('%s\n\t\t(%.1f, %.1f, %.1f)' % (
+                sep, float(mappedpos.sta_pos[0]),
+                float(mappedpos.sta_pos[1]), float(mappedpos.sta_pos[2])))
+            sep = ','
+        write('\n\t);\n\tfading_coefficient = %d;' % fading_cof)
+        write('\n\tnoise_threshold = %d;' % noise_th)
+        write('\n\tisnodeaps = (')
+        sep = ''
         for isnodeap in isnodeaps:
-            if first_isnodeap:
-                configstr += '%s' % isnodeap
-                first_isnodeap = False
-            else:
-                configstr += ', %s' % isnodeap
-        configstr += ');\n\ttx_powers = ('
-        first_txpower = True
+            write('%s%s' % (sep, isnodeap))
+            sep = ', '
+        write(');\n\ttx_powers = (')
+        sep = ''
         for mappedtxpower in txpowers:
-            txpower = mappedtxpower.sta_txpower
-            if first_txpower:
-                configstr += '%s' % txpower
-                first_txpower = False
-            else:
-                configstr += ', %s' % txpower
+            write('%s%s' % (sep, mappedtxpower.sta_txpower))
+            sep = ', '
         if ppm.model == 'ITU':
-            configstr += ');\n\tmodel_name = "itu";\n\tnFLOORS = %d;' \
-                         '\n\tlF = %d;\n\tpL = %d;\n};' % \
-                         (ppm.nFloors, ppm.lF, ppm.pL)
+            write(');\n\tmodel_name = "itu";\n\tnFLOORS = %d;'
+                  '\n\tlF = %d;\n\tpL = %d;\n};' %
+                  (ppm.nFloors, ppm.lF, ppm.pL))
         elif ppm.model == 'logDistance':
-            configstr += ');\n\tmodel_name = "log_distance";' \
-                         '\n\tpath_loss_exp = %.1f;\n\txg = 0.0;\n};' \
-                         % ppm.exp
+            write(');\n\tmodel_name = "log_distance";'
+                  '\n\tpath_loss_exp = %.1f;\n\txg = 0.0;\n};' % ppm.exp)
         elif ppm.model == 'twoRayGround':
-            configstr += ');\n\tmodel_name = "two_ray_ground";' \
-                         '\n\tsL = %d;\n};' % ppm.sL
+            write(');\n\tmodel_name = "two_ray_ground";'
+                  '\n\tsL = %d;\n};' % ppm.sL)
         elif ppm.model == 'logNormalShadowing':
-            configstr += ');\n\tmodel_name = "log_normal_shadowing";' \
-                         '\n\tpath_loss_exp = %.1f;\n\tsL = %d;\n};' \
-                         % (ppm.exp, ppm.sL)
+            write(');\n\tmodel_name = "log_normal_shadowing";'
+                  '\n\tpath_loss_exp = %.1f;\n\tsL = %d;\n};'
+                  % (ppm.exp, ppm.sL))
         else:
-            configstr += ');\n\tmodel_name = "free_space";\n\tsL = %d;\n};' \
-                         % ppm.sL
-        self.configstr = configstr
-        return self.configstr
+            write(');\n\tmodel_name = "free_space";\n\tsL = %d;\n};'
+                  % ppm.sL)
 
 
 class WStarter(object):
 
     wmd_logfile = None
     wmd_config_name = None
+    binary_config = False  # requires a wmediumd that understands -b
+
+    __bin_header_struct = struct.Struct('=4sHBBIIIII')
+    __bin_model_struct = struct.Struct('=Biifiiii')
+    __bin_link_struct = struct.Struct('=IIf')
+    __bin_models = {'friis': 0, 'logDistance': 1, 'ITU': 2,
+                    'twoRayGround': 3, 'logNormalShadowing': 4}
 
     def __init__(self, **kwargs):
         self.default_auto_errprob = 1.0
@@ -175,6 +173,84 @@ def __init__(self, **kwargs):
 
         self.start(**kwargs)
 
+    def write_config(self, cfg, mappedintf, mappedlinks, **kwargs):
+        "Writes the libconfig file read by wmediumd -c"
+        write = cfg.write
+        write('ifaces:\n{\n\tids = [\n')
+        sep = ''
+        for intfref in kwargs['intfrefs']:
+            write('%s\t\t"%s"' % (sep, intfref.get_mac()))
+            sep = ', \n'
+        write('\n\t];\n')
+        if "mediums" in kwargs and kwargs['mediums']:
+            write('\tmedium_array = ' + str(kwargs['mediums']).replace("[","(").replace("]",")") + ';\n')
+        if wmediumd_mode.mode is w_cst.INTERFERENCE_MODE:
+            set_interference(cfg=cfg, **kwargs)
+            return
+        write('};\nmodel:\n{\n\ttype = "')
+        if wmediumd_mode.mode == w_cst.ERRPROB_MODE:
+            write('prob')
+        else:
+            write('snr')
+        write('";\n\tdefault_prob = 1.0;\n\tlinks = (')
+        sep = ''
+        for mappedlink in mappedlinks.values():
+            id1 = mappedintf[mappedlink.sta1intf.id()]
+            id2 = mappedintf[mappedlink.sta2intf.id()]
+            if wmediumd_mode.mode == w_cst.ERRPROB_MODE:
+                write('%s\n\t\t(%d, %d, %f)' % (sep, id1, id2,
+                                                 mappedlink.errprob))
+            else:
+                write('%s\n\t\t(%d, %d, %d)' % (sep, id1, id2,
+                                                 mappedlink.snr))
+            sep = ','
+        write('\n\t);\n};')
+
+    def write_binary_config(self, cfg, mappedintf, mappedlinks, **kwargs):
+        """Writes the same content as write_config in the compact layout
+        described in doc/wmediumd_binary_config.md"""
+        intfrefs = kwargs['intfrefs']
+        mediums = kwargs.get('mediums') or []
+        interference = wmediumd_mode.mode is w_cst.INTERFERENCE_MODE
+        pos = kwargs['pos'] if interference else []
+        txpowers = kwargs['txpowers'] if interference else []
+        links = [] if interference else list(mappedlinks.values())
+
+        write = cfg.write
+        write(self.__bin_header_struct.pack(
+            b'MNWC', 1, wmediumd_mode.mode, 1 if interference else 0,
+            len(intfrefs), len(pos), len(txpowers), len(links),
+            len(mediums)))
+        macs = bytearray()
+        for intfref in intfrefs:
+            macs += bytes.fromhex(intfref.get_mac().replace(':', ''))
+        write(macs)
+        if interference:
+            ppm = kwargs['ppm']
+            write(array('B', [int(x) for x in kwargs['isnodeaps']]).tobytes())
+            coords = array('f')
+            for mappedpos in pos:
+                coords.extend((float(mappedpos.sta_pos[0]),
+                               float(mappedpos.sta_pos[1]),
+                               float(mappedpos.sta_pos[2])))
+            write(coords.tobytes())
+            write(array('i', [int(t.sta_txpower)
+                              for t in txpowers]).tobytes())
+            write(self.__bin_model_struct.pack(
+                self.__bin_models.get(ppm.model, 0), kwargs['fading_cof'],
+                kwargs['noise_th'], ppm.exp, int(ppm.sL), int(ppm.nFloors),
+                int(ppm.lF), int(ppm.pL)))
+        for mappedlink in links:
+            if wmediumd_mode.mode == w_cst.ERRPROB_MODE:
+                value = mappedlink.errprob
+            else:
+                value = mappedlink.snr
+            write(self.__bin_link_struct.pack(
+                mappedintf[mappedlink.sta1intf.id()],
+                mappedintf[mappedlink.sta2intf.id()], value))
+        for medium in mediums:
+            write(array('I', [len(medium)] + list(medium)).tobytes())
+
     def start(self, **kwargs):
         """Start the wmediumd daemon"""
 
@@ -188,8 +264,12 @@ def start(self, **kwargs):
                              stderr=subprocess.PIPE)
         if wm == 0:
             self.is_initialized = True
+            if w_shm.enabled:
+                w_shm.open(len(kwargs['intfrefs']))
             self.initialize(**kwargs)
             w_server.connect()
+            if w_shm.enabled:
+                w_shm.populate(**kwargs)
         else:
             info('*** Wmediumd is being used, but it is not installed.\n' \
                  '*** Please install Wmediumd with sudo util/install.sh -l.\n')
@@ -217,103 +297,46 @@ def initialize(self, **kwargs):
         if wmediumd_mode.mode != w_cst.INTERFERENCE_MODE:
             # Map all links using the interface id and check for missing
             # interfaces in the  intfrefs list
+            managed = set(intfref.get_station_name()
+                          for intfref in kwargs['intfrefs'])
             for link in kwargs['links']:
                 link_id = link.sta1intf.id() + '/' + link.sta2intf.id()
                 mappedlinks[link_id] = link
-                found1 = False
-                found2 = False
-                for intfref in kwargs['intfrefs']:
-                    if link.sta1intf.get_station_name() == \
-                            intfref.get_station_name():
-                        if link.sta1intf.get_station_name() == \
-                                intfref.get_station_name():
-                            found1 = True
-                    if link.sta2intf.get_station_name() == \
-                            intfref.get_station_name():
-                        if link.sta2intf.get_station_name() == \
-                                intfref.get_station_name():
-                            found2 = True
-                if not found1:
+                if link.sta1intf.get_station_name() not in managed:
                     raise WmediumdException('%s is not part of the managed '
                                             'interfaces'
                                             % link.sta1intf.id())
-                    pass
-                if not found2:
+                if link.sta2intf.get_station_name() not in managed:
                     raise WmediumdException('%s is not part of the managed '
                                             'interfaces'
                                             % link.sta2intf.id())
 
-        if wmediumd_mode.mode is not w_cst.SPECPROB_MODE:
-            """if wmediumd_mode.mode is not w_cst.INTERFERENCE_MODE:
-                for intfref1 in kwargs['intfrefs']:
-                    for intfref2 in kwargs['intfrefs']:
-                        if intfref1 is not intfref2:
-                            link_id = intfref1.id() + '/' + \
-                                      intfref2.id()
-                            if wmediumd_mode.mode == \
-                                    w_cst.ERRPROB_MODE:
-                                mappedlinks.setdefault(
-                                    link_id, ERRPROBLink(
-                                        intfref1, intfref2,
-                                        self.default_auto_errprob))
-                            else:
-                                mappedlinks.setdefault(
-                                    link_id, SNRLink(
-                                        intfref1, intfref2,
-                                        self.default_auto_snr))"""
-
-            # Create wmediumd config
-            wmd_config = tempfile.NamedTemporaryFile(
-                prefix='mn_wmd_config_', suffix='.cfg', delete=False)
-            WStarter.wmd_config_name = wmd_config.name
-            debug("Name of wmediumd config: %s\n" % WStarter.wmd_config_name)
-            configstr = 'ifaces:\n{\n\tids = [\n'
-            intfref_id = 0
-            for intfref in kwargs['intfrefs']:
-                if intfref_id != 0:
-                    configstr += ', \n'
-                grepped_mac = intfref.get_mac()
-                configstr += '\t\t"%s"' % grepped_mac
-                mappedintf[intfref.id()] = intfref_id
-                intfref_id += 1
-            configstr += '\n\t];\n'
-            if "mediums" in kwargs and kwargs['mediums']:
-                configstr += '\tmedium_array = ' + str(kwargs['mediums']).replace("[","(").replace("]",")") + ';\n'
-            if wmediumd_mode.mode is w_cst.INTERFERENCE_MODE:
-                kwargs['configstr'] = configstr
-                configstr = set_interference(**kwargs).configstr
-            else:
-                configstr += '};\nmodel:\n{\n\ttype = "'
-                if wmediumd_mode.mode == w_cst.ERRPROB_MODE:
-                    configstr += 'prob'
+        with StartupProfiler.span('wmediumd config'):
+            if wmediumd_mode.mode is not w_cst.SPECPROB_MODE:
+                for intfref_id, intfref in enumerate(kwargs['intfrefs']):
+                    mappedintf[intfref.id()] = intfref_id
+
+                # Create wmediumd config
+                if self.binary_config:
+                    wmd_config = tempfile.NamedTemporaryFile(
+                        prefix='mn_wmd_config_', suffix='.bin', delete=False)
+                    self.write_binary_config(wmd_config, mappedintf,
+                                             mappedlinks, **kwargs)
                 else:
-                    configstr += 'snr'
-                configstr += '";\n\tdefault_prob = 1.0;\n\tlinks = ('
-                first_link = True
-                for mappedlink in mappedlinks.values():
-                    id1 = mappedlink.sta1intf.id()
-                    id2 = mappedlink.sta2intf.id()
-                    if first_link:
-                        first_link = False
-                    else:
-                        configstr += ','
-                    if wmediumd_mode.mode == w_cst.ERRPROB_MODE:
-                        configstr += '\n\t\t(%d, %d, %f)' % (
-                            mappedintf[id1], mappedintf[id2],
-                            mappedlink.errprob)
-                    else:
-                        configstr += '\n\t\t(%d, %d, %d)' % (
-                            mappedintf[id1], mappedintf[id2],
-                            mappedlink.snr)
-                configstr += '\n\t);\n};'
-            wmd_config.write(configstr.encode())
-            wmd_config.close()
+                    wmd_config = tempfile.NamedTemporaryFile(
+                        mode='w', prefix='mn_wmd_config_', suffix='.cfg',
+                        delete=False)
+                    self.write_config(wmd_config, mappedintf,
+                                      mappedlinks, **kwargs)
+                WStarter.wmd_config_name = wmd_config.name
+                debug("Name of wmediumd config: %s\n" % WStarter.wmd_config_name)
+                wmd_config.close()
         # Start wmediumd using the created config
         cmdline = ['wmediumd']
         if wmediumd_mode.mode is w_cst.SPECPROB_MODE:
             cmdline.append("-d")
         else:
-            cmdline.append("-c")
+            cmdline.append("-b" if self.binary_config else "-c")
             cmdline.append(WStarter.wmd_config_name)
             if wmediumd_mode.mode is w_cst.SNR_MODE \
                     or wmediumd_mode.mode is w_cst.INTERFERENCE_MODE:
@@ -330,10 +353,14 @@ def initialize(self, **kwargs):
         #if self.is_managed:
         #    cmdline[0:0] = ["nohup"]
 
-        self.wmd_process = subprocess.Popen(cmdline, shell=False,
-                                            stdout=WStarter.wmd_logfile,
-                                            stderr=subprocess.STDOUT,
-                                            preexec_fn=os.setpgrp)
+        env = None
+        if w_shm.enabled:
+            # a medium built with state table support maps it from here
+            env = dict(os.environ, WMEDIUMD_SHM=w_shm.path)
+        with StartupProfiler.cmd(cmdline):
+            self.wmd_process = subprocess.Popen(
+                cmdline, shell=False, stdout=WStarter.wmd_logfile,
+                stderr=subprocess.STDOUT, preexec_fn=os.setpgrp, env=env)
         self.is_connected = True
 
 
@@ -491,6 +518,7 @@ def __init__(self, staname, intfname, intfmac):
         self.__staname = staname
         self.__intfname = intfname
         self.__intfmac = intfmac
+        self.sta_id = None  # wmediumd station index, once known
 
     def get_station_name(self):
         """
@@ -557,6 +585,183 @@ def get_mac(self):
             return self.__sta.wintfs[index].mac
 
 
+class w_shm(object):
+    """Node state table shared with wmediumd
+
+    The table is a memory-mapped file holding one fixed-size slot per
+    wmediumd station id. Each slot is guarded by a sequence counter
+    (seqlock): the writer makes it odd, stores the payload and makes it
+    even again, while readers retry until they copy a slot whose counter
+    is even and unchanged. The layout is described in doc/wmediumd_shm.md"""
+
+    MAGIC = b'MNWS'
+    VERSION = 1
+    FLAG_VALID = 0x1
+    HEADER_SIZE = 64
+    SLOT_SIZE = 64
+    # order of the values returned by snapshot()
+    FIELDS = ('flags', 'stamp', 'x', 'y', 'z', 'txpower', 'gain',
+              'height', 'grandom', 'medium_id', 'mac')
+    __index = dict(zip(FIELDS, range(len(FIELDS))))
+
+    __header_struct = struct.Struct('<4sIII48x')
+    __seq_struct = struct.Struct('<I')
+    __body_struct = struct.Struct('<IQfffiiifi6s10x')
+
+    enabled = False
+    path = w_cst.SHM_PATH
+    capacity = 1024  # minimum number of slots, leaves room for runtime nodes
+    mm = None
+    nslots = 0
+    __fd = None
+    __owner = False
+    __seqs = []
+    __cache = []
+    __lock = Lock()
+
+    @classmethod
+    def open(cls, nslots, path=None):
+        "Creates the table (writer side)"
+        if cls.mm:
+            cls.close()
+        if path:
+            cls.path = path
+        cls.nslots = max(nslots, cls.capacity)
+        size = cls.HEADER_SIZE + cls.nslots * cls.SLOT_SIZE
+        cls.__fd = os.open(cls.path, os.O_CREAT | os.O_TRUNC | os.O_RDWR, 0o644)
+        os.ftruncate(cls.__fd, size)
+        cls.mm = mmap.mmap(cls.__fd, size, mmap.MAP_SHARED,
+                           mmap.PROT_READ | mmap.PROT_WRITE)
+        cls.__owner = True
+        cls.__seqs = [0] * cls.nslots
+        cls.__cache = [[0, 0, 0.0, 0.0, 0.0, 0, 0, 0, 0.0, 0, b'\0' * 6]
+                       for _ in range(cls.nslots)]
+        cls.__header_struct.pack_into(cls.mm, 0, cls.MAGIC, cls.VERSION,
+                                      cls.nslots, cls.SLOT_SIZE)
+        debug('%s state table at %s (%d slots)\n'
+              % (w_cst.LOG_PREFIX, cls.path, cls.nslots))
+
+    @classmethod
+    def attach(cls, path=None):
+        "Maps an existing table read-only (medium side)"
+        if path:
+            cls.path = path
+        cls.__fd = os.open(cls.path, os.O_RDONLY)
+        cls.mm = mmap.mmap(cls.__fd, 0, mmap.MAP_SHARED, mmap.PROT_READ)
+        magic, version, nslots, slot_size = \
+            cls.__header_struct.unpack_from(cls.mm, 0)
+        if magic != cls.MAGIC or version != cls.VERSION \
+                or slot_size != cls.SLOT_SIZE:
+            cls.close()
+            raise WmediumdException("%s is not a state table we understand"
+                                    % cls.path)
+        cls.nslots = nslots
+        cls.__owner = False
+        return nslots
+
+    @classmethod
+    def close(cls):
+        if cls.mm:
+            cls.mm.close()
+            cls.mm = None
+        if cls.__fd is not None:
+            os.close(cls.__fd)
+            cls.__fd = None
+            if cls.__owner:
+                try:
+                    os.remove(cls.path)
+                except OSError:
+                    pass
+        cls.nslots = 0
+
+    @classmethod
+    def populate(cls, intfrefs, pos=None, txpowers=None, **kwargs):
+        "Writes the state wmediumd was started with"
+        for sta_id, intfref in enumerate(intfrefs):
+            intfref.sta_id = sta_id
+            cls.register(intfref)
+        for mappedpos in pos or []:
+            cls.update_pos(mappedpos)
+        for mappedtxpower in txpowers or []:
+            cls.update_txpower(mappedtxpower)
+
+    @classmethod
+    def register(cls, intfref):
+        "Marks the slot of intfref as valid"
+        if py_version_info < (3, 0):
+            mac = intfref.get_mac().replace(':', '').decode('hex')
+        else:
+            mac = bytes.fromhex(intfref.get_mac().replace(':', ''))
+        return cls.write(intfref.sta_id, flags=cls.FLAG_VALID, mac=mac)
+
+    @classmethod
+    def unregister(cls, intfref):
+        return cls.write(intfref.sta_id, flags=0)
+
+    @classmethod
+    def write(cls, sta_id, **fields):
+        """Updates a slot in place
+        :return False if sta_id has no slot"""
+        if not cls.mm or sta_id is None or not 0 <= sta_id < cls.nslots:
+            return False
+        off = cls.HEADER_SIZE + sta_id * cls.SLOT_SIZE
+        with cls.__lock:
+            values = cls.__cache[sta_id]
+            for key, value in fields.items():
+                values[cls.__index[key]] = value
+            values[1] = monotonic_ns()
+            seq = cls.__seqs[sta_id] + 1
+            cls.__seq_struct.pack_into(cls.mm, off, seq & 0xffffffff)
+            cls.__body_struct.pack_into(cls.mm, off + 4, *values)
+            seq += 1
+            cls.__seq_struct.pack_into(cls.mm, off, seq & 0xffffffff)
+            cls.__seqs[sta_id] = seq
+        Metrics.inc('mn_wifi_wmediumd_messages{path="shm"}')
+        return True
+
+    @classmethod
+    def snapshot(cls, sta_id):
+        """Consistent copy of a slot (reader side)
+        :return (seq, values) where values follow FIELDS"""
+        off = cls.HEADER_SIZE + sta_id * cls.SLOT_SIZE
+        mm = cls.mm
+        while True:
+            seq = cls.__seq_struct.unpack_from(mm, off)[0]
+            if seq & 1:
+                continue
+            values = cls.__body_struct.unpack_from(mm, off + 4)
+            if cls.__seq_struct.unpack_from(mm, off)[0] == seq:
+                return seq, values
+
+    @classmethod
+    def update_pos(cls, pos):
+        x, y, z = pos.sta_pos[0], pos.sta_pos[1], pos.sta_pos[2]
+        return cls.write(pos.staintf.sta_id, x=x, y=y, z=z)
+
+    @classmethod
+    def update_txpower(cls, txpower):
+        return cls.write(txpower.staintf.sta_id,
+                         txpower=int(txpower.sta_txpower))
+
+    @classmethod
+    def update_gain(cls, gain):
+        return cls.write(gain.staintf.sta_id, gain=int(gain.sta_gain))
+
+    @classmethod
+    def update_height(cls, height):
+        return cls.write(height.staintf.sta_id, height=int(height.sta_height))
+
+    @classmethod
+    def update_gaussian_random(cls, gRandom):
+        return cls.write(gRandom.staintf.sta_id,
+                         grandom=gRandom.sta_gaussian_random)
+
+    @classmethod
+    def update_medium(cls, medium):
+        return cls.write(medium.staintf.sta_id,
+                         medium_id=int(medium.sta_medium_id))
+
+
 class w_server(object):
     'Server Conn'
     __mac_struct_fmt = '6s'
@@ -626,6 +831,10 @@ class w_server(object):
 
     sock = None
     connected = False
+    # one request and its response at a time: mobility, vanet, sumo,
+    # the shard parent and the control workers share this socket
+    lock = Lock()
+    batch = 256  # position updates written before reading their responses
 
     @classmethod
     def connect(cls, uds_address=w_cst.SOCKET_PATH):
@@ -638,7 +847,7 @@ def connect(cls, uds_address=w_cst.SOCKET_PATH):
             raise WmediumdException("Already connected to wmediumd server")
         cls.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
         info('*** Connecting to wmediumd server %s\n' % uds_address)
-        sleep(1)
+        StartupProfiler.sleep(1, 'wmediumd connect')
         cls.sock.connect(uds_address)
         cls.connected = True
 
@@ -660,20 +869,23 @@ def disconnect(cls):
 
             cls.sock.close()
             cls.connected = False
+        w_shm.close()
 
     @classmethod
-    def register_interface(cls, mac):
-        # type: (str) -> int
+    def register_interface(cls, mac, settle=1):
+        # type: (str, float) -> int
         """
         Register a new interface at wmediumd
         :param mac The mac address of the interface
+        :param settle Seconds the radio still needs before registering
         :return The wmediumd station index
 
         :type mac: str
         :rtype int
         """
         #info("\n{} Registering interface with mac {}".format(w_cst.LOG_PREFIX, mac))
-        sleep(1)
+        if settle > 0:
+            StartupProfiler.sleep(settle, 'wmediumd register')
         ret, sta_id = w_server.send_add(mac)
         if ret != w_cst.WUPDATE_SUCCESS:
             raise WmediumdException("Received error code from wmediumd: code {}".format(ret))
@@ -716,11 +928,54 @@ def update_pos(cls, pos):
         :param pos The pos to update
         :type pos: w_pos
         """
+        if w_shm.enabled and w_shm.update_pos(pos):
+            return
         ret = w_server.send_pos_update(pos)
         if ret != w_cst.WUPDATE_SUCCESS:
             raise WmediumdException("Received error code from wmediumd: "
                                     "code %d" % ret)
 
+    @classmethod
+    def update_positions(cls, positions):
+        # type: ([w_pos]) -> None
+        """
+        Update many Pos at wmediumd: requests are written batch at a time
+        and their responses read after each batch, so a batch costs one
+        round trip and neither side blocks on a full socket buffer
+        :param positions The pos to update
+        :type positions: list of w_pos
+        """
+        if w_shm.enabled:
+            positions = [pos for pos in positions if not w_shm.update_pos(pos)]
+        if not positions:
+            return
+        size = cls.__pos_update_response_struct.size
+        for start in range(0, len(positions), cls.batch):
+            chunk = positions[start:start + cls.batch]
+            with cls.lock:
+                cls.sock.sendall(b''.join(
+                    cls.__create_pos_update_request(pos, *pos.sta_pos[:3])
+                    for pos in chunk))
+                data = cls.__recv_all(size * len(chunk))
+            Metrics.inc('mn_wifi_wmediumd_messages{path="socket"}',
+                        len(chunk))
+            for n in range(len(chunk)):
+                ret = cls.__pos_update_response_struct.unpack_from(
+                    data, n * size)[-1]
+                if ret != w_cst.WUPDATE_SUCCESS:
+                    raise WmediumdException("Received error code from "
+                                            "wmediumd: code %d" % ret)
+
+    @classmethod
+    def __recv_all(cls, size):
+        data = b''
+        while len(data) < size:
+            chunk = cls.sock.recv(size - len(data))
+            if not chunk:
+                raise WmediumdException("Connection to wmediumd closed")
+            data += chunk
+        return data
+
     @classmethod
     def update_txpower(cls, txpower):
         # type: (w_txpower) -> None
@@ -730,6 +985,8 @@ def update_txpower(cls, txpower):
 
         :type txpower: w_txpower
         """
+        if w_shm.enabled and w_shm.update_txpower(txpower):
+            return
         ret = w_server.send_txpower_update(txpower)
         if ret != w_cst.WUPDATE_SUCCESS:
             raise WmediumdException("Received error code from wmediumd: "
@@ -743,6 +1000,8 @@ def update_gain(cls, gain):
         :param gain The gain to update
         :type gain: Gain
         """
+        if w_shm.enabled and w_shm.update_gain(gain):
+            return
         ret = w_server.send_gain_update(gain)
         if ret != w_cst.WUPDATE_SUCCESS:
             raise WmediumdException("Received error code from wmediumd: "
@@ -756,6 +1015,8 @@ def update_gaussian_random(cls, gRandom):
         :param gRandom The gRandom to update
         :type gRandom: WmediumdGRandom
         """
+        if w_shm.enabled and w_shm.update_gaussian_random(gRandom):
+            return
         ret = w_server.send_gaussian_random_update(gRandom)
         if ret != w_cst.WUPDATE_SUCCESS:
             raise WmediumdException("Received error code from wmediumd: "
@@ -769,6 +1030,8 @@ def update_height(cls, height):
         :param height The height to update
         :type height: Height
         """
+        if w_shm.enabled and w_shm.update_height(height):
+            return
         ret = w_server.send_height_update(height)
         if ret != w_cst.WUPDATE_SUCCESS:
             raise WmediumdException("Received error code from wmediumd: "
@@ -808,6 +1071,8 @@ def update_medium(cls, medium):
         :param medium The medium to update
         :type medium: w_medium
         """
+        if w_shm.enabled and w_shm.update_medium(medium):
+            return
         ret = w_server.send_medium_update(medium)
         if ret != w_cst.WUPDATE_SUCCESS:
             raise WmediumdException("Received error code from wmediumd: "
@@ -825,8 +1090,8 @@ def send_snr_update(cls, link):
         #      "value %d\n" % (w_cst.LOG_PREFIX,
         #                      link.sta1intf.get_mac(),
         #                      link.sta2intf.get_mac(), link.snr))
-        cls.sock.send(cls.__create_snr_update_request(link))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_snr_update_request(link),
             w_cst.WSERVER_SNR_UPDATE_RESPONSE_TYPE,
             cls.__snr_update_response_struct)[-1]
 
@@ -844,8 +1109,8 @@ def send_pos_update(cls, pos):
         #debug("%s Updating Pos of %s to x=%s, y=%s, z=%s\n" % (
         #    w_cst.LOG_PREFIX, pos.staintf.get_mac(),
         #    posX, posY, posZ))
-        cls.sock.send(cls.__create_pos_update_request(pos, posX, posY, posZ))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_pos_update_request(pos, posX, posY, posZ),
             w_cst.WSERVER_POS_UPDATE_RESPONSE_TYPE,
             cls.__pos_update_response_struct)[-1]
 
@@ -861,8 +1126,8 @@ def send_txpower_update(cls, txpower):
         #debug("%s Updating TxPower of %s to %d\n" % (
         #    w_cst.LOG_PREFIX, txpower.staintf.get_mac(),
         #    txpower_))
-        cls.sock.send(cls.__create_txpower_update_request(txpower))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_txpower_update_request(txpower),
             w_cst.WSERVER_TXPOWER_UPDATE_RESPONSE_TYPE,
             cls.__txpower_update_response_struct)[-1]
 
@@ -878,8 +1143,8 @@ def send_gain_update(cls, gain):
         #debug("%s Updating Antenna Gain of %s to %d\n" % (
         #    w_cst.LOG_PREFIX, gain.staintf.get_mac(),
         #    gain_))
-        cls.sock.send(cls.__create_gain_update_request(gain))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_gain_update_request(gain),
             w_cst.WSERVER_GAIN_UPDATE_RESPONSE_TYPE,
             cls.__gain_update_response_struct)[-1]
 
@@ -895,8 +1160,8 @@ def send_gaussian_random_update(cls, gRandom):
         #debug("%s Updating Gaussian Random of %s to %s\n" % (
         #    w_cst.LOG_PREFIX, gRandom.staintf.get_mac(),
         #    gRandom_))
-        cls.sock.send(cls.__create_gaussian_random_update_request(gRandom))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_gaussian_random_update_request(gRandom),
             w_cst.WSERVER_GAUSSIAN_RANDOM_UPDATE_RESPONSE_TYPE,
             cls.__gaussian_random_update_response_struct)[-1]
 
@@ -912,8 +1177,8 @@ def send_height_update(cls, height):
         #debug("%s Updating Antenna Height of %s to %d\n" % (
         #    w_cst.LOG_PREFIX, height.staintf.get_mac(),
         #    height_))
-        cls.sock.send(cls.__create_height_update_request(height))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_height_update_request(height),
             w_cst.WSERVER_HEIGHT_UPDATE_RESPONSE_TYPE,
             cls.__height_update_response_struct)[-1]
 
@@ -930,8 +1195,8 @@ def send_errprob_update(cls, link):
         #          w_cst.LOG_PREFIX, link.sta1intf.get_mac(),
         #          link.sta2intf.get_mac(),
         #          link.errprob))
-        cls.sock.send(cls.__create_errprob_update_request(link))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_errprob_update_request(link),
             w_cst.WSERVER_ERRPROB_UPDATE_RESPONSE_TYPE,
             cls.__errprob_update_response_struct)[-1]
 
@@ -946,8 +1211,8 @@ def send_specprob_update(cls, link):
         #debug("\n%s Updating SPECPROB from interface %s to interface %s" % (
         #    w_cst.LOG_PREFIX, link.sta1intf.get_mac(),
         #    link.sta2intf.get_mac()))
-        cls.sock.send(cls.__create_specprob_update_request(link))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_specprob_update_request(link),
             w_cst.WSERVER_SPECPROB_UPDATE_RESPONSE_TYPE,
             cls.__specprob_update_response_struct)[-1]
 
@@ -959,8 +1224,8 @@ def send_del_by_mac(cls, mac):
         :param mac: The mac address of the interface to be deleted
         :return: A WUPDATE_* constant
         """
-        cls.sock.send(cls.__create_station_del_by_mac_request(mac))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_station_del_by_mac_request(mac),
             w_cst.WSERVER_DEL_BY_MAC_RESPONSE_TYPE,
             cls.__station_del_by_mac_response_struct)[-1]
 
@@ -972,8 +1237,8 @@ def send_del_by_id(cls, sta_id):
         :param sta_id: The wmediumd index of the station
         :return: A WUPDATE_* constant
         """
-        cls.sock.send(cls.__create_station_del_by_id_request(sta_id))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_station_del_by_id_request(sta_id),
             w_cst.WSERVER_DEL_BY_ID_RESPONSE_TYPE,
             cls.__station_del_by_id_response_struct)[-1]
 
@@ -986,8 +1251,8 @@ def send_add(cls, mac):
         :return: A WUPDATE_* constant and on success at the second pos
         the index
         """
-        cls.sock.send(cls.__create_station_add_request(mac))
-        resp = cls.__parse_response(
+        resp = cls.__request(
+            cls.__create_station_add_request(mac),
             w_cst.WSERVER_ADD_RESPONSE_TYPE,
             cls.__station_add_response_struct)
         return resp[-1], resp[-2]
@@ -1004,8 +1269,8 @@ def send_medium_update(cls, medium):
         debug("%s Updating Medium ID of %s to %d\n" % (
            w_cst.LOG_PREFIX, medium.staintf.get_mac(),
            medium_))
-        cls.sock.send(cls.__create_medium_update_request(medium))
-        return cls.__parse_response(
+        return cls.__request(
+            cls.__create_medium_update_request(medium),
             w_cst.WSERVER_MEDIUM_UPDATE_REQUEST_TYPE,
             cls.__medium_update_response_struct)[-1]
 
@@ -1158,11 +1423,19 @@ def __create_medium_update_request(cls, medium):
         mediumid_ = medium.sta_medium_id
         return cls.__medium_update_request_struct.pack(msgtype, mac, mediumid_)
 
+    @classmethod
+    def __request(cls, request, expected_type, resp_struct):
+        "sends request and parses its response, holding the socket"
+        with cls.lock:
+            cls.sock.send(request)
+            return cls.__parse_response(expected_type, resp_struct)
+
     @classmethod
     def __parse_response(cls, expected_type, resp_struct):
         "parse response"
         # type: (int, struct.Struct) -> tuple
         recvd_data = cls.sock.recv(resp_struct.size)
+        Metrics.inc('mn_wifi_wmediumd_messages{path="socket"}')
         # recvd_type = cls.__base_struct.unpack(recvd_data[0])[0]
         # if recvd_type != expected_type:
         #    raise WmediumdException(
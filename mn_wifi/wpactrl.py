@@ -0,0 +1,143 @@
+"""
+    Persistent wpa_supplicant/hostapd control interface sessions, so that
+    handovers are a few datagrams instead of wpa_cli/pkill/iw processes.
+"""
+
+import os
+import socket
+from itertools import count
+from threading import Lock
+
+from mininet.log import info, debug
+
+
+class WpaCtrl(object):
+    "Client end of a ctrl_iface unix socket"
+
+    ids = count(1)  # next() is atomic: sessions open from several threads
+
+    def __init__(self, path, timeout=2.0):
+        self.path = path
+        self.local = '/tmp/mn%d_wpa_ctrl_%d' % (os.getpid(), next(WpaCtrl.ids))
+        if os.path.exists(self.local):
+            os.unlink(self.local)
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+        self.sock.settimeout(timeout)
+        self.sock.bind(self.local)
+        try:
+            self.sock.connect(path)
+        except OSError:
+            self.close()
+            raise
+
+    def request(self, cmd):
+        self.sock.send(cmd.encode())
+        while True:
+            reply = self.sock.recv(4096).decode()
+            # skip unsolicited events of attached monitors
+            if not reply.startswith('<'):
+                return reply.strip()
+
+    def close(self):
+        self.sock.close()
+        if os.path.exists(self.local):
+            os.unlink(self.local)
+
+
+class Histogram(object):
+    "Latencies in power of two buckets of microseconds"
+
+    def __init__(self):
+        self.buckets = {}
+        self.n = 0
+        self.total = 0.0
+        self.max = 0.0
+
+    def add(self, seconds):
+        us = max(1, int(seconds * 1e6))
+        bucket = 1 << (us.bit_length() - 1)
+        self.buckets[bucket] = self.buckets.get(bucket, 0) + 1
+        self.n += 1
+        self.total += seconds
+        self.max = max(self.max, seconds)
+
+    def __str__(self):
+        lines = ['n=%d mean=%.3fms max=%.3fms' %
+                 (self.n, self.total / self.n * 1e3, self.max * 1e3)]
+        for bucket in sorted(self.buckets):
+            lines.append('  %8dus - %8dus: %d' %
+                         (bucket, bucket * 2, self.buckets[bucket]))
+        return '\n'.join(lines)
+
+
+class CtrlPool(object):
+    """One ctrl_iface session per interface, opened on first use and
+    reopened when the daemon behind it is restarted"""
+
+    enabled = False
+    measure = False
+    wpa_dir = '/var/run/wpa_supplicant'
+    hostapd_dir = '/var/run/hostapd'
+    sessions = {}
+    locks = {}  # path -> lock held around one request of that session
+    stats = {}
+    lock = Lock()  # guards the dicts only, never held across I/O
+
+    @classmethod
+    def request(cls, path, cmd):
+        "Returns the reply of the daemon or None when it is not reachable"
+        with cls.lock:
+            session_lock = cls.locks.setdefault(path, Lock())
+        with session_lock:
+            for _ in range(2):
+                with cls.lock:
+                    ctrl = cls.sessions.get(path)
+                try:
+                    if ctrl is None:
+                        ctrl = WpaCtrl(path)
+                        with cls.lock:
+                            cls.sessions[path] = ctrl
+                    return ctrl.request(cmd)
+                except OSError as e:
+                    debug('ctrl_iface %s: %s\n' % (path, e))
+                    if ctrl is not None:
+                        ctrl.close()
+                    with cls.lock:
+                        cls.sessions.pop(path, None)
+        return None
+
+    @classmethod
+    def wpa(cls, intf, cmd):
+        return cls.request('%s/%s' % (cls.wpa_dir, intf.name), cmd)
+
+    @classmethod
+    def hostapd(cls, intf, cmd):
+        return cls.request('%s/%s' % (cls.hostapd_dir, intf.name), cmd)
+
+    @classmethod
+    def has_wpa(cls, intf):
+        return os.path.exists('%s/%s' % (cls.wpa_dir, intf.name))
+
+    @classmethod
+    def record(cls, path, seconds):
+        "Adds the latency of a handover step taken through path"
+        with cls.lock:
+            if path not in cls.stats:
+                cls.stats[path] = Histogram()
+            cls.stats[path].add(seconds)
+
+    @classmethod
+    def report(cls):
+        return '\n'.join('%s: %s' % (path, hist)
+                         for path, hist in sorted(cls.stats.items()))
+
+    @classmethod
+    def close(cls):
+        if cls.measure and cls.stats:
+            info('*** Handover latency\n%s\n' % cls.report())
+        with cls.lock:
+            for ctrl in cls.sessions.values():
+                ctrl.close()
+            cls.sessions = {}
+            cls.locks = {}
+            cls.stats = {}
@@ -0,0 +1,595 @@
+/* mncap: packet capture utility for mininet-wifi
+ *
+ * Captures on interfaces of many network namespaces at once and writes
+ * one pcapng stream, instead of one tcpdump process per capture point:
+ *
+ *  - one AF_PACKET socket per interface, opened inside the namespace of
+ *    the given pid (setns) and kept after switching back
+ *  - TPACKET_V3 (PACKET_MMAP) receive rings: packets are read where the
+ *    kernel wrote them, and copied once, into the output buffer
+ *  - optional classic BPF filters, as printed by tcpdump -ddd
+ *  - packets of all interfaces merged in timestamp order, one pcapng
+ *    interface ID per captured interface
+ *  - kernel drops per interface written as interface statistics blocks
+ *    and reported on stderr when capture ends (SIGINT/SIGTERM) or on
+ *    SIGUSR1
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+#if !defined(VERSION)
+#define VERSION "(devel)"
+#endif
+
+/* pcap link types */
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_IEEE802_11 105
+#define LINKTYPE_IEEE802_11_PRISM 119
+#define LINKTYPE_IEEE802_11_RADIOTAP 127
+#define LINKTYPE_IEEE802_15_4_NOFCS 230
+
+#define MAX_FILTERS 8
+
+struct ring {
+    int fd;
+    char *map;
+    struct tpacket_req3 req;
+    unsigned int block;        /* block to read next */
+    struct tpacket3_hdr *pkt;  /* next packet, NULL until the block is ours */
+    unsigned int left;         /* packets left in the block */
+    unsigned long long packets, drops;
+    int linktype;
+    char name[IFNAMSIZ];
+    char desc[64];
+};
+
+struct filter {
+    int linktype;              /* 0: any */
+    struct sock_fprog prog;
+};
+
+static struct ring *rings;
+static int nrings;
+static struct filter filters[MAX_FILTERS];
+static int nfilters;
+static FILE *out;
+static unsigned int snaplen = 65535;
+static volatile sig_atomic_t stop, report;
+
+void usage(char *name)
+{
+    printf("Capture utility for Mininet-WiFi\n\n"
+           "Usage: %s [-w file] [-f [linktype:]file] [-s snaplen] "
+           "[-b block_kb] [-n blocks] [-t ms] [pid:]intf...\n\n"
+           "Options:\n"
+           "  -w file: write pcapng to file (default: stdout)\n"
+           "  -f [linktype:]file: classic BPF program, as printed by\n"
+           "     tcpdump -ddd, for the interfaces of that pcap link type\n"
+           "     (all interfaces without a linktype); repeatable\n"
+           "  -s snaplen: bytes kept per packet (default: 65535)\n"
+           "  -b block_kb: ring block size in KiB (default: 256)\n"
+           "  -n blocks: ring blocks per interface (default: 16)\n"
+           "  -t ms: block retire timeout (default: 8)\n"
+           "  -v: print version\n\n"
+           "Each [pid:]intf captures intf in the network namespace of pid\n"
+           "(the current one without pid). Packets are merged in time\n"
+           "order; drops are reported on exit and on SIGUSR1.\n",
+           name);
+}
+
+void on_signal(int sig)
+{
+    if (sig == SIGUSR1)
+        report = 1;
+    else
+        stop = 1;
+}
+
+/* Realtime clock in ns, the clock of the packet timestamps */
+long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Reads a program printed by tcpdump -ddd: a count, then one
+ * "code jt jf k" line per instruction */
+void load_filter(char *arg)
+{
+    struct filter *f;
+    char *path = arg, *colon = strchr(arg, ':');
+    FILE *in;
+    unsigned int i, code, jt, jf, k, len;
+
+    if (nfilters == MAX_FILTERS) {
+        fprintf(stderr, "mncap: too many filters\n");
+        exit(1);
+    }
+    f = &filters[nfilters++];
+    if (colon) {
+        *colon = '\0';
+        f->linktype = atoi(arg);
+        path = colon + 1;
+    }
+    in = fopen(path, "r");
+    if (!in) {
+        perror(path);
+        exit(1);
+    }
+    if (fscanf(in, "%u", &len) != 1 || len == 0 || len > BPF_MAXINSNS) {
+        fprintf(stderr, "mncap: %s is not a tcpdump -ddd program\n", path);
+        exit(1);
+    }
+    f->prog.len = len;
+    f->prog.filter = calloc(len, sizeof(struct sock_filter));
+    for (i = 0; i < len; i++) {
+        if (fscanf(in, "%u %u %u %u", &code, &jt, &jf, &k) != 4) {
+            fprintf(stderr, "mncap: %s: truncated program\n", path);
+            exit(1);
+        }
+        f->prog.filter[i].code = code;
+        f->prog.filter[i].jt = jt;
+        f->prog.filter[i].jf = jf;
+        f->prog.filter[i].k = k;
+    }
+    fclose(in);
+}
+
+int linktype(int arphrd)
+{
+    switch (arphrd) {
+    case ARPHRD_IEEE80211_RADIOTAP: return LINKTYPE_IEEE802_11_RADIOTAP;
+    case ARPHRD_IEEE80211: return LINKTYPE_IEEE802_11;
+    case ARPHRD_IEEE80211_PRISM: return LINKTYPE_IEEE802_11_PRISM;
+    case ARPHRD_IEEE802154: return LINKTYPE_IEEE802_15_4_NOFCS;
+    case ARPHRD_NONE: return LINKTYPE_RAW;
+    default: return LINKTYPE_ETHERNET;  /* ether, loopback */
+    }
+}
+
+/* Opens the ring of [pid:]intf; home is our own network namespace */
+void open_ring(struct ring *r, char *target, int home, unsigned int block_kb,
+               unsigned int blocks, unsigned int tov)
+{
+    char path[PATH_MAX], *intf = target, *colon = strchr(target, ':');
+    int pid = 0, ns, i, version = TPACKET_V3;
+    struct ifreq ifr;
+    struct sockaddr_ll sll;
+
+    if (colon) {
+        *colon = '\0';
+        pid = atoi(target);
+        intf = colon + 1;
+    }
+    if (pid) {
+        sprintf(path, "/proc/%d/ns/net", pid);
+        ns = open(path, O_RDONLY);
+        if (ns < 0 || setns(ns, CLONE_NEWNET) != 0) {
+            perror(path);
+            exit(1);
+        }
+        close(ns);
+    }
+
+    /* protocol 0: nothing is queued before the filter is in place */
+    r->fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (r->fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%s", intf);
+    if (ioctl(r->fd, SIOCGIFINDEX, &ifr) < 0) {
+        fprintf(stderr, "mncap: %s: no such interface in the namespace "
+                "of pid %d\n", intf, pid);
+        exit(1);
+    }
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifr.ifr_ifindex;
+    if (ioctl(r->fd, SIOCGIFHWADDR, &ifr) < 0) {
+        perror("SIOCGIFHWADDR");
+        exit(1);
+    }
+    r->linktype = linktype(ifr.ifr_hwaddr.sa_family);
+    snprintf(r->name, sizeof(r->name), "%s", intf);
+    snprintf(r->desc, sizeof(r->desc), "netns of pid %d", pid);
+    if (pid && setns(home, CLONE_NEWNET) != 0) {
+        perror("setns");
+        exit(1);
+    }
+
+    for (i = 0; i < nfilters; i++)
+        if (!filters[i].linktype || filters[i].linktype == r->linktype) {
+            if (setsockopt(r->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                           &filters[i].prog, sizeof(filters[i].prog)) < 0) {
+                perror("SO_ATTACH_FILTER");
+                exit(1);
+            }
+            break;
+        }
+
+    if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &version,
+                   sizeof(version)) < 0) {
+        perror("PACKET_VERSION");
+        exit(1);
+    }
+    memset(&r->req, 0, sizeof(r->req));
+    r->req.tp_block_size = block_kb * 1024;
+    r->req.tp_block_nr = blocks;
+    r->req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    r->req.tp_frame_nr = r->req.tp_block_size / r->req.tp_frame_size
+                         * blocks;
+    r->req.tp_retire_blk_tov = tov;
+    if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &r->req,
+                   sizeof(r->req)) < 0) {
+        perror("PACKET_RX_RING");
+        exit(1);
+    }
+    r->map = mmap(NULL, (size_t)r->req.tp_block_size * blocks,
+                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, r->fd, 0);
+    if (r->map == MAP_FAILED) {
+        /* MAP_LOCKED may exceed RLIMIT_MEMLOCK */
+        r->map = mmap(NULL, (size_t)r->req.tp_block_size * blocks,
+                      PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+        if (r->map == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+    }
+    if (bind(r->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+}
+
+static struct tpacket_block_desc *block_desc(struct ring *r)
+{
+    return (struct tpacket_block_desc *)
+        (r->map + (size_t)r->block * r->req.tp_block_size);
+}
+
+static void release_block(struct ring *r)
+{
+    __sync_synchronize();
+    block_desc(r)->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    r->block = (r->block + 1) % r->req.tp_block_nr;
+    r->pkt = NULL;
+}
+
+/* The next packet of the ring, or NULL when the kernel still owns the
+ * next block */
+static struct tpacket3_hdr *head(struct ring *r)
+{
+    struct tpacket_block_desc *bd;
+
+    while (!r->pkt) {
+        bd = block_desc(r);
+        if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+            return NULL;
+        __sync_synchronize();
+        if (!bd->hdr.bh1.num_pkts) {
+            release_block(r);
+            continue;
+        }
+        r->left = bd->hdr.bh1.num_pkts;
+        r->pkt = (struct tpacket3_hdr *)
+            ((char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+    }
+    return r->pkt;
+}
+
+static void advance(struct ring *r)
+{
+    if (--r->left == 0)
+        release_block(r);
+    else
+        r->pkt = (struct tpacket3_hdr *)((char *)r->pkt +
+                                         r->pkt->tp_next_offset);
+}
+
+static long long ts(struct tpacket3_hdr *pkt)
+{
+    return pkt->tp_sec * 1000000000LL + pkt->tp_nsec;
+}
+
+/* pcapng blocks */
+
+static void put(const void *data, size_t len)
+{
+    static const char pad[4];
+    fwrite(data, 1, len, out);
+    if (len % 4)
+        fwrite(pad, 1, 4 - len % 4, out);
+}
+
+static void put_option(uint16_t code, const void *data, uint16_t len)
+{
+    uint16_t hdr[2] = { code, len };
+    put(hdr, sizeof(hdr));
+    put(data, len);
+}
+
+#define PAD4(n) (((n) + 3) & ~3u)
+
+void write_header(void)
+{
+    uint32_t shb[7] = { 0x0A0D0D0A, 28, 0x1A2B3C4D, 1, 0xFFFFFFFF,
+                        0xFFFFFFFF, 28 };
+    uint32_t idb[4];
+    uint8_t tsresol = 9;  /* ns */
+    uint32_t len, zero = 0;
+    int i;
+
+    put(shb, sizeof(shb));  /* version 1.0, section length unknown */
+    for (i = 0; i < nrings; i++) {
+        len = 16 + 4 + PAD4(strlen(rings[i].name)) + 4 +
+              PAD4(strlen(rings[i].desc)) + 4 + 4 + 4 + 4;
+        idb[0] = 1;
+        idb[1] = len;
+        idb[2] = rings[i].linktype;
+        idb[3] = snaplen;
+        put(idb, sizeof(idb));
+        put_option(2, rings[i].name, strlen(rings[i].name));  /* if_name */
+        put_option(3, rings[i].desc, strlen(rings[i].desc));  /* if_description */
+        put_option(9, &tsresol, 1);  /* if_tsresol */
+        put(&zero, 4);  /* opt_endofopt */
+        put(&len, 4);
+    }
+}
+
+static void write_packet(int id, struct tpacket3_hdr *pkt)
+{
+    uint32_t caplen = pkt->tp_snaplen < snaplen ? pkt->tp_snaplen : snaplen;
+    uint64_t t = ts(pkt);
+    uint32_t epb[7], len = 32 + PAD4(caplen);
+
+    epb[0] = 6;
+    epb[1] = len;
+    epb[2] = id;
+    epb[3] = t >> 32;
+    epb[4] = (uint32_t)t;
+    epb[5] = caplen;
+    epb[6] = pkt->tp_len;
+    put(epb, sizeof(epb));
+    put((char *)pkt + pkt->tp_mac, caplen);
+    put(&len, 4);
+}
+
+/* Adds the kernel counters (reset on read) to the totals */
+void read_stats(void)
+{
+    struct tpacket_stats_v3 st;
+    socklen_t len;
+    int i;
+
+    for (i = 0; i < nrings; i++) {
+        len = sizeof(st);
+        if (getsockopt(rings[i].fd, SOL_PACKET, PACKET_STATISTICS,
+                       &st, &len) == 0) {
+            rings[i].packets += st.tp_packets;
+            rings[i].drops += st.tp_drops;
+        }
+    }
+}
+
+void print_stats(void)
+{
+    int i;
+    read_stats();
+    for (i = 0; i < nrings; i++)
+        fprintf(stderr, "mncap: interface %d (%s, %s): %llu packets, "
+                "%llu dropped\n", i, rings[i].name, rings[i].desc,
+                rings[i].packets, rings[i].drops);
+}
+
+void write_stats(void)
+{
+    uint32_t isb[5], len = 20 + 12 + 12 + 4 + 4;
+    uint64_t t = now_ns(), zero = 0;
+    int i;
+
+    for (i = 0; i < nrings; i++) {
+        isb[0] = 5;
+        isb[1] = len;
+        isb[2] = i;
+        isb[3] = t >> 32;
+        isb[4] = (uint32_t)t;
+        put(isb, sizeof(isb));
+        put_option(4, &rings[i].packets, 8);  /* isb_ifrecv */
+        put_option(5, &rings[i].drops, 8);  /* isb_ifdrop */
+        put(&zero, 4);
+        put(&len, 4);
+    }
+}
+
+/* Min-heap of ring indices by the timestamp of their next packet */
+
+static int *heap;
+static int nheap;
+
+static int before(int a, int b)
+{
+    return ts(rings[heap[a]].pkt) < ts(rings[heap[b]].pkt);
+}
+
+static void swap(int a, int b)
+{
+    int t = heap[a];
+    heap[a] = heap[b];
+    heap[b] = t;
+}
+
+static void push(int ring)
+{
+    int i = nheap++;
+    heap[i] = ring;
+    while (i && before(i, (i - 1) / 2)) {
+        swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift(void)
+{
+    int i = 0, c;
+    while ((c = 2 * i + 1) < nheap) {
+        if (c + 1 < nheap && before(c + 1, c))
+            c++;
+        if (!before(c, i))
+            break;
+        swap(i, c);
+        i = c;
+    }
+}
+
+/* Writes, in time order, every packet up to limit. A block is handed to
+ * us when it is full or its retire timeout expires, so waiting a few
+ * timeouts before writing keeps packets of late blocks in order. */
+void drain(long long limit)
+{
+    struct tpacket3_hdr *pkt;
+    int i, r;
+
+    nheap = 0;
+    for (i = 0; i < nrings; i++) {
+        pkt = head(&rings[i]);
+        if (pkt && ts(pkt) <= limit)
+            push(i);
+    }
+    while (nheap) {
+        r = heap[0];
+        write_packet(r, rings[r].pkt);
+        advance(&rings[r]);
+        pkt = head(&rings[r]);
+        if (pkt && ts(pkt) <= limit) {
+            sift();
+        } else {
+            heap[0] = heap[--nheap];
+            sift();
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int c, i, home;
+    char *file = NULL;
+    unsigned int block_kb = 256, blocks = 16, tov = 8;
+    long long hold, last_stats = 0;
+    struct pollfd *fds;
+    struct sigaction sa;
+
+    while ((c = getopt(argc, argv, "w:f:s:b:n:t:vh")) != -1)
+        switch(c) {
+        case 'w':
+            file = optarg;
+            break;
+        case 'f':
+            load_filter(optarg);
+            break;
+        case 's':
+            snaplen = atoi(optarg);
+            break;
+        case 'b':
+            block_kb = atoi(optarg);
+            break;
+        case 'n':
+            blocks = atoi(optarg);
+            break;
+        case 't':
+            tov = atoi(optarg);
+            break;
+        case 'v':
+            printf("%s\n", VERSION);
+            exit(0);
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+
+    nrings = argc - optind;
+    if (nrings <= 0 || !snaplen || !block_kb || !blocks || !tov) {
+        usage(argv[0]);
+        exit(1);
+    }
+    home = open("/proc/self/ns/net", O_RDONLY);
+    if (home < 0) {
+        perror("/proc/self/ns/net");
+        return 1;
+    }
+    rings = calloc(nrings, sizeof(*rings));
+    heap = calloc(nrings, sizeof(*heap));
+    fds = calloc(nrings, sizeof(*fds));
+    for (i = 0; i < nrings; i++) {
+        open_ring(&rings[i], argv[optind + i], home, block_kb, blocks, tov);
+        fds[i].fd = rings[i].fd;
+        fds[i].events = POLLIN | POLLERR;
+    }
+
+    out = file ? fopen(file, "wb") : stdout;
+    if (!out) {
+        perror(file);
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    write_header();
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    hold = 4LL * tov * 1000000;
+    while (!stop) {
+        poll(fds, nrings, tov);
+        drain(now_ns() - hold);
+        fflush(out);
+        if (now_ns() - last_stats > 1000000000LL) {
+            /* keep the kernel counters from wrapping */
+            read_stats();
+            last_stats = now_ns();
+        }
+        if (report) {
+            report = 0;
+            print_stats();
+        }
+    }
+
+    /* blocks still being filled come to us once they retire */
+    usleep(2 * tov * 1000);
+    drain(LLONG_MAX);
+    print_stats();
+    write_stats();
+    fclose(out);
+    return 0;
+}
@@ -9,6 +9,8 @@
  *  - printing out the pid of a process so we can identify it later
  *  - attaching to a namespace and cgroup
  *  - setting RT scheduling
+ *  - firing USDT probes (mnexec:start, unshare, attach, exec,
+ *    exec_failed) for bpftrace/perf when built with sys/sdt.h
  *
  * Partially based on public domain setsid(1)
 */
@@ -24,6 +26,21 @@
 #include <sched.h>
 #include <ctype.h>
 #include <sys/mount.h>
+#include <errno.h>
+#include <time.h>
+
+/* USDT probes: no-ops unless systemtap-sdt-dev provides sys/sdt.h */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MN_PROBES 1
+#endif
+#endif
+#if !defined(MN_PROBES)
+#define DTRACE_PROBE(p, n)
+#define DTRACE_PROBE1(p, n, a) ((void)(a))
+#define DTRACE_PROBE2(p, n, a, b) ((void)(a), (void)(b))
+#endif
 
 #if !defined(VERSION)
 #define VERSION "(devel)"
@@ -46,6 +63,14 @@ void usage(char *name)
 }
 
 
+/* Monotonic time in ns, for the probe arguments */
+long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 int setns(int fd, int nstype)
 {
     return syscall(__NR_setns, fd, nstype);
@@ -99,9 +124,11 @@ int main(int argc, char *argv[])
     char path[PATH_MAX];
     int nsid;
     int pid;
+    long long t;
     char *cwd = get_current_dir_name();
 
     static struct sched_param sp;
+    DTRACE_PROBE1(mnexec, start, now_ns());
     while ((c = getopt(argc, argv, "+cdnpa:g:r:vh")) != -1)
         switch(c) {
         case 'c':
@@ -126,6 +153,7 @@ int main(int argc, char *argv[])
             break;
         case 'n':
             /* run in network and mount namespaces */
+            t = now_ns();
             if (unshare(CLONE_NEWNET|CLONE_NEWNS) == -1) {
                 perror("unshare");
                 return 1;
@@ -144,6 +172,7 @@ int main(int argc, char *argv[])
                 perror("mount");
                 return 1;
             }
+            DTRACE_PROBE1(mnexec, unshare, now_ns() - t);
             break;
         case 'p':
             /* print pid */
@@ -153,6 +182,7 @@ int main(int argc, char *argv[])
         case 'a':
             /* Attach to pid's network namespace and mount namespace */
             pid = atoi(optarg);
+            t = now_ns();
             sprintf(path, "/proc/%d/ns/net", pid);
             nsid = open(path, O_RDONLY);
             if (nsid < 0) {
@@ -179,6 +209,7 @@ int main(int argc, char *argv[])
                 perror(cwd);
                 return 1;
             }
+            DTRACE_PROBE2(mnexec, attach, pid, now_ns() - t);
             break;
         case 'g':
             /* Attach to cgroup */
@@ -204,7 +235,9 @@ int main(int argc, char *argv[])
         }
 
     if (optind < argc) {
+        DTRACE_PROBE2(mnexec, exec, argv[optind], now_ns());
         execvp(argv[optind], &argv[optind]);
+        DTRACE_PROBE1(mnexec, exec_failed, errno);
         perror(argv[optind]);
         return 1;
     }
@@ -0,0 +1,154 @@
+#!/usr/bin/env python
+
+"""
+Load generator for the control API of Mininet_wifi.socketServer (see
+mn_wifi/control.py). Every connection keeps up to -d requests in flight,
+each one a SET_POSITIONS frame moving -b nodes, and the run reports the
+commands per second and the latency percentiles.
+
+Against a running topology (the nodes must exist):
+    util/mn_ctrl_loadgen.py -p 12345 --nodes sta1,sta2
+Without one, serve a stand-in network whose nodes accept any position:
+    util/mn_ctrl_loadgen.py --local
+
+--text sends the same updates as set.<node>.setPosition("x,y,z") text
+commands, one per line, a batch at a time, for comparison.
+"""
+
+import socket
+import sys
+from argparse import ArgumentParser
+from threading import Thread
+from time import monotonic, sleep
+
+sys.path.append('.')
+from mn_wifi.control import (ControlServer, ControlClient, encode_positions,
+                             OK)
+
+
+class stand_in_node(object):
+
+    def __init__(self, name):
+        self.name = name
+        self.position = (0, 0, 0)
+
+    def setPosition(self, pos):
+        self.position = tuple(float(p) for p in pos.split(','))
+
+
+class stand_in_net(object):
+    "Just enough of Mininet_wifi for the control server"
+
+    def __init__(self, names):
+        self.nodes = {name: stand_in_node(name) for name in names}
+
+    def getNodeByName(self, name):
+        return self.nodes[name]
+
+    def setPositions(self, positions):
+        for name, pos in positions.items():
+            self.nodes[name].position = pos
+
+    def socket_command(self, cmd):
+        name = cmd.split('.')[1]
+        self.nodes[name].setPosition(cmd.split('("')[1].split('")')[0])
+        return 'command accepted!'
+
+
+def binary_worker(args, names, latencies, errors):
+    client = ControlClient(args.host, args.port)
+    sent = {}
+    done = 0
+    step = 0
+    while done < args.requests:
+        while len(sent) < args.depth and done + len(sent) < args.requests:
+            step += 1
+            batch = {names[(step + i) % len(names)]: (step % 100, i, 0)
+                     for i in range(args.batch)}
+            req_id = client.next_id()
+            sent[req_id] = monotonic()
+            client.send(encode_positions(req_id, batch))
+        req_id, status, _ = client.recv_reply()
+        latencies.append(monotonic() - sent.pop(req_id))
+        if status != OK:
+            errors.append(req_id)
+        done += 1
+    client.close()
+
+
+def text_worker(args, names, latencies, errors):
+    s = socket.create_connection((args.host, args.port))
+    s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    f = s.makefile('rb')
+    for step in range(args.requests):
+        start = monotonic()
+        s.sendall(''.join('set.%s.setPosition("%d,%d,0")\n' % (
+            names[(step + i) % len(names)], step % 100, i)
+            for i in range(args.batch)).encode())
+        for _ in range(args.batch):
+            if f.readline() != b'command accepted!\n':
+                errors.append(step)
+        latencies.append(monotonic() - start)
+    s.close()
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+
+def main():
+    parser = ArgumentParser(description='control API load generator')
+    parser.add_argument('-H', '--host', default='127.0.0.1')
+    parser.add_argument('-p', '--port', type=int, default=12345)
+    parser.add_argument('-c', '--connections', type=int, default=4)
+    parser.add_argument('-n', '--requests', type=int, default=5000,
+                        help='requests per connection')
+    parser.add_argument('-d', '--depth', type=int, default=16,
+                        help='requests in flight per connection')
+    parser.add_argument('-b', '--batch', type=int, default=8,
+                        help='nodes moved per request')
+    parser.add_argument('--nodes', default='',
+                        help='comma separated node names')
+    parser.add_argument('--local', action='store_true',
+                        help='serve a stand-in network in this process')
+    parser.add_argument('--text', action='store_true',
+                        help='use the text protocol')
+    args = parser.parse_args()
+
+    names = [n for n in args.nodes.split(',') if n] or \
+        ['sta%d' % (i + 1) for i in range(max(args.batch, 64))]
+    if args.local:
+        server = ControlServer(stand_in_net(names), args.host, args.port)
+        Thread(target=server.serve, daemon=True).start()
+        sleep(0.1)
+
+    worker = text_worker if args.text else binary_worker
+    latencies, errors = [], []
+    threads = [Thread(target=worker, args=(args, names, latencies, errors))
+               for _ in range(args.connections)]
+    start = monotonic()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = monotonic() - start
+
+    latencies.sort()
+    requests = len(latencies)
+    print('%s protocol, %d connections, batch %d%s' % (
+        'text' if args.text else 'binary', args.connections, args.batch,
+        '' if args.text else ', depth %d' % args.depth))
+    print('%d requests (%d node updates) in %.2fs, %d errors' % (
+        requests, requests * args.batch, elapsed, len(errors)))
+    print('%.0f requests/s, %.0f node updates/s' % (
+        requests / elapsed, requests * args.batch / elapsed))
+    print('latency p50 %.3fms p99 %.3fms max %.3fms' % (
+        percentile(latencies, 50) * 1e3, percentile(latencies, 99) * 1e3,
+        latencies[-1] * 1e3))
+    if args.local:
+        server.stop()
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
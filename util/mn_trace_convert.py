@@ -0,0 +1,37 @@
+#!/usr/bin/env python
+
+"""
+Convert text mobility traces into the binary trace read by
+ReplayingMobility(net, trace=...) (see doc/mobility_trace.md).
+
+usage: util/mn_trace_convert.py [-r rate] [-t] -o out.bin sta1=sta1.txt ...
+"""
+
+import sys
+from argparse import ArgumentParser
+
+sys.path.append('.')
+from mn_wifi.replaying import BinaryTrace
+
+
+def main():
+    parser = ArgumentParser(description='text to binary mobility trace')
+    parser.add_argument('-o', '--output', required=True)
+    parser.add_argument('-r', '--rate', type=float, default=1.0,
+                        help='samples per second of untimed traces')
+    parser.add_argument('-t', '--timestamp', action='store_true',
+                        help="lines are 't x y [z]' instead of 'x y [z]'")
+    parser.add_argument('traces', nargs='+', metavar='node=file')
+    args = parser.parse_args()
+
+    traces = dict(trace.split('=', 1) for trace in args.traces)
+    BinaryTrace.convert(traces, args.output, args.rate, args.timestamp)
+    trace = BinaryTrace(args.output)
+    print('%s: %d nodes, %d samples, %.2fs to %.2fs'
+          % (args.output, len(trace.names), len(trace.time),
+             trace.start, trace.end))
+    trace.close()
+
+
+if __name__ == '__main__':
+    main()
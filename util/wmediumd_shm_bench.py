@@ -0,0 +1,147 @@
+#!/usr/bin/env python
+
+"""
+Measure the end-to-end latency of node state updates towards the medium,
+through the wmediumd socket protocol and through the shared state table
+(see doc/wmediumd_shm.md). Neither wmediumd nor root is required: the
+socket side talks to a stand-in server that acknowledges every request
+and the table side is read by a stand-in medium process.
+
+usage: util/wmediumd_shm_bench.py [-n updates] [-s stations]
+"""
+
+import os
+import socket
+import sys
+import tempfile
+from argparse import ArgumentParser
+from multiprocessing import Process, Value
+from time import monotonic_ns, sleep
+
+sys.path.append('.')
+from mn_wifi.wmediumdConnector import (w_server, w_shm, w_pos, w_cst,
+                                       WmediumdIntfRef)
+
+
+POS_REQUEST_SIZE = 1 + 6 + 3 * 4  # type, mac, x, y, z
+POS_RESPONSE_SIZE = 1 + POS_REQUEST_SIZE + 1
+
+
+def stand_in_server(path):
+    "Acknowledges every position update with WUPDATE_SUCCESS"
+    srv = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    srv.bind(path)
+    srv.listen(1)
+    conn, _ = srv.accept()
+    response = bytes([w_cst.WSERVER_POS_UPDATE_RESPONSE_TYPE]) + \
+        bytes(POS_RESPONSE_SIZE - 1)
+    while conn.recv(POS_REQUEST_SIZE):
+        conn.sendall(response)
+    conn.close()
+    srv.close()
+
+
+def stand_in_medium(path, nslots, updates, ready, seen, lat_sum, lat_max):
+    "Spins on the table and stamps every new version of the slots"
+    w_shm.attach(path)
+    last = [w_shm.snapshot(sta_id)[0] for sta_id in range(nslots)]
+    ready.value = 1
+    count = total = worst = 0
+    while count < updates:
+        idle = True
+        for sta_id in range(nslots):
+            seq, values = w_shm.snapshot(sta_id)
+            if seq != last[sta_id]:
+                delta = monotonic_ns() - values[1]
+                last[sta_id] = seq
+                total += delta
+                worst = max(worst, delta)
+                count += 1
+                seen.value = count
+                idle = False
+        if idle:
+            # let the writer run when both share a single cpu
+            os.sched_yield()
+    lat_sum.value = total
+    lat_max.value = worst
+    w_shm.close()
+
+
+def percentile(samples, p):
+    samples = sorted(samples)
+    return samples[min(len(samples) - 1, int(len(samples) * p))]
+
+
+def report(name, samples):
+    print('%-8s n=%-7d mean=%8.2fus  p50=%8.2fus  p99=%8.2fus  max=%8.2fus'
+          % (name, len(samples), sum(samples) / len(samples) / 1e3,
+             percentile(samples, 0.5) / 1e3, percentile(samples, 0.99) / 1e3,
+             max(samples) / 1e3))
+
+
+def bench_socket(intfrefs, updates):
+    path = tempfile.mktemp(prefix='mn_wmd_bench_', suffix='.sock')
+    server = Process(target=stand_in_server, args=(path,))
+    server.start()
+    while not os.path.exists(path):
+        sleep(0.01)
+    w_server.connect(path)
+    samples = []
+    for i in range(updates):
+        intfref = intfrefs[i % len(intfrefs)]
+        start = monotonic_ns()
+        w_server.send_pos_update(w_pos(intfref, [float(i), 1.0, 0.0]))
+        samples.append(monotonic_ns() - start)
+    w_server.sock.close()
+    w_server.connected = False
+    server.join()
+    os.remove(path)
+    report('socket', samples)
+
+
+def bench_shm(intfrefs, updates):
+    path = tempfile.mktemp(prefix='mn_wmd_bench_', suffix='.state')
+    w_shm.capacity = 0
+    w_shm.open(len(intfrefs), path)
+    w_shm.populate(intfrefs)
+    ready = Value('B', 0, lock=False)
+    seen = Value('L', 0, lock=False)
+    lat_sum = Value('Q', 0, lock=False)
+    lat_max = Value('Q', 0, lock=False)
+    medium = Process(target=stand_in_medium,
+                     args=(path, len(intfrefs), updates, ready, seen,
+                           lat_sum, lat_max))
+    medium.start()
+    while not ready.value:
+        sleep(0.01)
+    samples = []
+    for i in range(updates):
+        intfref = intfrefs[i % len(intfrefs)]
+        start = monotonic_ns()
+        w_shm.update_pos(w_pos(intfref, [float(i), 1.0, 0.0]))
+        samples.append(monotonic_ns() - start)
+        # wait for the medium so that no update is coalesced
+        while seen.value <= i:
+            os.sched_yield()
+    medium.join()
+    w_shm.close()
+    report('shm', samples)
+    print('%-8s mean=%8.2fus  max=%8.2fus  (write to medium snapshot)'
+          % ('shm e2e', lat_sum.value / updates / 1e3, lat_max.value / 1e3))
+
+
+def main():
+    parser = ArgumentParser(description='wmediumd update latency')
+    parser.add_argument('-n', '--updates', type=int, default=10000)
+    parser.add_argument('-s', '--stations', type=int, default=16)
+    args = parser.parse_args()
+
+    intfrefs = [WmediumdIntfRef('sta%d' % i, 'sta%d-wlan0' % i,
+                                '02:00:00:00:%02x:%02x' % (i >> 8, i & 0xff))
+                for i in range(args.stations)]
+    bench_socket(intfrefs, args.updates)
+    bench_shm(intfrefs, args.updates)
+
+
+if __name__ == '__main__':
+    main()